@@ -19,6 +19,8 @@
 #include <openssl/asn1.h>
 #include <openssl/asn1t.h>
 #include <openssl/proverr.h>
+#include <limits.h>
+#include <string.h>
 //#include "internal/asn1.h"
 //instead just:
 int asn1_d2i_read_bio(BIO *in, BUF_MEM **pb); // TBD: OK to use?
@@ -52,9 +54,10 @@ struct keytype_desc_st {
      * The EVP_PKEY_xxx type macro.  Should be zero for type specific
      * structures, non-zero when the outermost structure is PKCS#8 or
      * SubjectPublicKeyInfo.  This determines which of the function
-     * pointers below will be used.
+     * pointers below will be used. Set on first use by der2key_newctx,
+     * possibly by several threads creating decoders at once.
      */
-    int evp_type;
+    _Atomic int evp_type;
 
     /* The selection mask for OSSL_FUNC_decoder_does_selection() */
     int selection_mask;
@@ -130,25 +133,184 @@ struct der2key_ctx_st {
     int selection;
     /* Flag used to signal that a failure is fatal */
     unsigned int flag_fatal : 1;
+    /* Input is a PrivateKeyInfo, i.e., the OID follows a version */
+    unsigned int flag_p8 : 1;
+    /* Shared AlgorithmIdentifier DER of keytype or NULL, to reject other input early */
+    const unsigned char *aid;
 };
 
-int oqs_read_der(PROV_OQS_CTX *provctx, OSSL_CORE_BIO *cin,  unsigned char **data,
-                  long *len) {
-    OQS_DEC_PRINTF("OQS DEC provider: oqs_read_der called.\n");
+#define OQS_DER_PREFIX 32        /* enough for outer headers and OID */
+#define OQS_DER_CHUNK  (64*1024) /* allocated before more data arrives */
+
+/* reads exactly len bytes, without a BIO around cin */
+static int oqs_core_bio_read_all(OSSL_CORE_BIO *cin, unsigned char *buf, size_t len)
+{
+    size_t n;
+
+    while (len > 0) {
+        if (!oqs_prov_bio_read_ex(cin, buf, len, &n) || n == 0)
+            return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/*
+ * Size of the header of the element at p, of which n bytes are available,
+ * and its content length in *len. 0 if not known from these bytes or not
+ * of definite length.
+ */
+static size_t oqs_der_header_size(const unsigned char *p, size_t n, size_t *len)
+{
+    size_t hl, i;
+
+    if (n < 2)
+        return 0;
+    if (!(p[1] & 0x80)) {
+        *len = p[1];
+        return 2;
+    }
+    hl = 2 + (p[1] & 0x7f);
+    if (hl == 2 || hl > 6 || hl > n)
+        return 0;
+    for (*len = 0, i = 2; i < hl; i++)
+        *len = *len << 8 | p[i];
+    return hl;
+}
+
+/*
+ * Single scan of the start of the contents of a PrivateKeyInfo (p8 set) or
+ * SubjectPublicKeyInfo for the algorithm OID. 1: *oid and *oidlen set,
+ * -1: not such a structure, 0: cannot tell from the n bytes at p.
+ */
+static int oqs_der_find_oid(const unsigned char *p, size_t n, int p8,
+                            const unsigned char **oid, size_t *oidlen)
+{
+    size_t hl, len;
+
+    if (p8) {
+        if (n < 1)
+            return 0;
+        if (p[0] != V_ASN1_INTEGER)
+            return -1;
+        if ((hl = oqs_der_header_size(p, n, &len)) == 0 || len > n - hl)
+            return 0;
+        p += hl + len;
+        n -= hl + len;
+    }
+    if (n < 1)
+        return 0;
+    if (p[0] != (V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED))
+        return -1;
+    if ((hl = oqs_der_header_size(p, n, &len)) == 0)
+        return 0;
+    p += hl;
+    n -= hl;
+    if (n < 1)
+        return 0;
+    if (p[0] != V_ASN1_OBJECT)
+        return -1;
+    // BER may encode the OID length in long form: left to the full decoder
+    if ((hl = oqs_der_header_size(p, n, &len)) != 2 || len > n - hl)
+        return 0;
+    *oid = p;
+    *oidlen = hl + len;
+    return 1;
+}
 
+/*
+ * Reads the DER element at the start of cin into a buffer of its size.
+ * With aid given, the element must be a PrivateKeyInfo (p8 set) or
+ * SubjectPublicKeyInfo of that algorithm: as the decoder chain has every
+ * decoder try the same input, keys of other algorithms are rejected after
+ * reading a short prefix, before anything is allocated. Elements of
+ * indefinite length are read by the generic ASN.1 reader.
+ */
+static int oqs_read_der_expect(PROV_OQS_CTX *provctx, OSSL_CORE_BIO *cin,
+                               const unsigned char *aid, int p8,
+                               unsigned char **data, long *len)
+{
+    unsigned char prefix[OQS_DER_PREFIX], *buf = NULL, *tmp;
+    const unsigned char *oid;
+    size_t hl, total, have, alloc, n, oidlen;
+    BIO *in;
     BUF_MEM *mem = NULL;
-    BIO *in = oqs_bio_new_from_core_bio(provctx, cin);
-    int ok = (asn1_d2i_read_bio(in, &mem) >= 0);
+    long start;
+    int ok = 0;
 
-    if (ok) {
-        *data = (unsigned char *)mem->data;
-        *len = (long)mem->length;
-        OPENSSL_free(mem);
+    start = oqs_prov_bio_ctrl(cin, BIO_C_FILE_TELL, 0, NULL);
+    if (!oqs_core_bio_read_all(cin, prefix, 2))
+        return 0;
+    hl = prefix[1] & 0x80 ? 2 + (prefix[1] & 0x7f) : 2;
+    if ((hl == 2 && prefix[1] == 0x80) || hl > 6) {
+        // not handled here: from the start again, if possible
+        if (start < 0 || oqs_prov_bio_ctrl(cin, BIO_C_FILE_SEEK, start, NULL) < 0
+            || (in = oqs_bio_new_from_core_bio(provctx, cin)) == NULL)
+            return 0;
+        if ((ok = asn1_d2i_read_bio(in, &mem) >= 0)) {
+            *data = (unsigned char *)mem->data;
+            *len = (long)mem->length;
+            OPENSSL_free(mem);
+        }
+        BIO_free(in);
+        return ok;
+    }
+    if (!oqs_core_bio_read_all(cin, prefix + 2, hl - 2)
+        || oqs_der_header_size(prefix, hl, &total) != hl
+        || total > LONG_MAX - hl)
+        return 0;
+    total += hl;
+    have = hl;
+    if (aid != NULL) {
+        n = total - hl < sizeof(prefix) - hl ? total - hl : sizeof(prefix) - hl;
+        if (!oqs_core_bio_read_all(cin, prefix + hl, n))
+            return 0;
+        have += n;
+        switch (oqs_der_find_oid(prefix + hl, n, p8, &oid, &oidlen)) {
+        case -1:
+            return 0;
+        case 1:
+            if (oqsx_find_aid(oid, oidlen) != aid) {
+                OQS_DEC_PRINTF("OQS DEC provider: oqs_read_der rejected other algorithm.\n");
+                return 0;
+            }
+        }
+    }
+
+    // exact size unless large: then grown as data actually arrives
+    alloc = total < OQS_DER_CHUNK ? total : OQS_DER_CHUNK;
+    if ((buf = OPENSSL_malloc(alloc)) == NULL)
+        return 0;
+    memcpy(buf, prefix, have);
+    while (have < total) {
+        if (have == alloc) {
+            alloc = total - alloc < alloc ? total : 2 * alloc;
+            if ((tmp = OPENSSL_realloc(buf, alloc)) == NULL)
+                goto end;
+            buf = tmp;
+        }
+        if (!oqs_core_bio_read_all(cin, buf + have, alloc - have))
+            goto end;
+        have = alloc;
     }
-    BIO_free(in);
+    *data = buf;
+    *len = (long)total;
+    buf = NULL;
+    ok = 1;
+
+ end:
+    OPENSSL_free(buf);
     return ok;
 }
 
+int oqs_read_der(PROV_OQS_CTX *provctx, OSSL_CORE_BIO *cin,  unsigned char **data,
+                  long *len) {
+    OQS_DEC_PRINTF("OQS DEC provider: oqs_read_der called.\n");
+
+    return oqs_read_der_expect(provctx, cin, NULL, 0, data, len);
+}
+
 typedef void *key_from_pkcs8_t(const PKCS8_PRIV_KEY_INFO *p8inf,
                                OSSL_LIB_CTX *libctx, const char *propq);
 static void *oqs_der2key_decode_p8(const unsigned char **input_der,
@@ -179,10 +341,13 @@ OQSX_KEY *oqsx_d2i_PUBKEY(OQSX_KEY **a,
 
     OQS_DEC_PRINTF2("OQS DEC provider: oqsx_d2i_PUBKEY called with length %ld\n", length);
 
-    // only way to re-create X509 object?? TBD
-    xpk = oqsx_d2i_X509_PUBKEY_INTERNAL(pp, length, NULL);
-
-    key = oqsx_key_from_x509pubkey(xpk, NULL, NULL);
+    // plain DER of our algorithms, i.e., nearly all input, is walked directly
+    if (!oqsx_key_from_spki(pp, length, NULL, NULL, &key)) {
+        // only way to re-create X509 object?? TBD
+        xpk = oqsx_d2i_X509_PUBKEY_INTERNAL(pp, length, NULL);
+        key = oqsx_key_from_x509pubkey(xpk, NULL, NULL);
+        X509_PUBKEY_free(xpk);
+    }
 
     if (key == NULL)
         return NULL;
@@ -205,6 +370,7 @@ static struct der2key_ctx_st *
 der2key_newctx(void *provctx, struct keytype_desc_st *desc, const char* tls_name)
 {
     struct der2key_ctx_st *ctx = OPENSSL_zalloc(sizeof(*ctx));
+    size_t aidlen;
 
     OQS_DEC_PRINTF3("OQS DEC provider: der2key_newctx called with tls_name %s. Keytype: %d\n", tls_name, desc->evp_type);
 
@@ -215,6 +381,9 @@ der2key_newctx(void *provctx, struct keytype_desc_st *desc, const char* tls_name
            ctx->desc->evp_type = OBJ_sn2nid(tls_name);
            OQS_DEC_PRINTF2("OQS DEC provider: der2key_newctx set evp_type to %d\n", ctx->desc->evp_type);
         }
+        ctx->flag_p8 = !strcmp(desc->structure_name, "PrivateKeyInfo");
+        if (ctx->flag_p8 || !strcmp(desc->structure_name, "SubjectPublicKeyInfo"))
+            ctx->aid = oqsx_get_aid(tls_name, &aidlen);
     }
     return ctx;
 }
@@ -273,6 +442,7 @@ static int oqs_der2key_decode(void *vctx, OSSL_CORE_BIO *cin, int selection,
     const unsigned char *derp;
     long der_len = 0;
     void *key = NULL;
+    OQSX_KEYCACHE *cache = NULL; // set if key is to be cached once decoded
     int ok = 0;
 
     OQS_DEC_PRINTF("OQS DEC provider: oqs_der2key_decode called.\n");
@@ -293,7 +463,7 @@ static int oqs_der2key_decode(void *vctx, OSSL_CORE_BIO *cin, int selection,
         return 0;
     }
 
-    ok = oqs_read_der(ctx->provctx, cin, &der, &der_len);
+    ok = oqs_read_der_expect(ctx->provctx, cin, ctx->aid, ctx->flag_p8, &der, &der_len);
     if (!ok)
         goto next;
 
@@ -313,6 +483,12 @@ static int oqs_der2key_decode(void *vctx, OSSL_CORE_BIO *cin, int selection,
     }
     if (key == NULL && (selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) != 0) {
         derp = der;
+        // keys are cached by the type of decoder that checked them
+        if (ctx->desc->d2i_PUBKEY != NULL && ctx->desc->evp_type != NID_undef)
+            cache = ctx->provctx->keycache;
+        if (cache != NULL
+            && (key = oqsx_keycache_get(cache, der, der_len, ctx->desc->evp_type)) != NULL)
+            goto next; // decoded, checked and adjusted before
         if (ctx->desc->d2i_PUBKEY != NULL)
             key = ctx->desc->d2i_PUBKEY(NULL, &derp, der_len);
         else
@@ -345,6 +521,9 @@ static int oqs_der2key_decode(void *vctx, OSSL_CORE_BIO *cin, int selection,
     if (key != NULL && ctx->desc->adjust_key != NULL)
         ctx->desc->adjust_key(key, ctx);
 
+    if (key != NULL && cache != NULL)
+        oqsx_keycache_put(cache, der, der_len, ctx->desc->evp_type, key);
+
  next:
     /*
      * Indicated that we successfully decoded something, or not at all.
@@ -167,6 +167,179 @@ static X509_PUBKEY *oqsx_key_to_pubkey(const void *key, int key_nid,
     return xpk;
 }
 
+/* DER SEQUENCE, BIT STRING headers and AlgorithmIdentifier of at most 128 bytes */
+#define OQSX_SPKI_PREFIX_MAX (6 + 128 + 6 + 1)
+
+static size_t der_header_len(size_t len)
+{
+    size_t n = 2;
+
+    if (len >= 0x80)
+        for (; len > 0; len >>= 8)
+            n++;
+    return n;
+}
+
+static unsigned char *der_put_header(unsigned char *p, int tag, size_t len)
+{
+    int n = (int)der_header_len(len) - 2;
+
+    *p++ = tag;
+    if (n == 0) {
+        *p++ = (unsigned char)len;
+        return p;
+    }
+    *p++ = 0x80 | n;
+    while (n-- > 0)
+        *p++ = (unsigned char)(len >> (8 * n));
+    return p;
+}
+
+/*
+ * Shared AlgorithmIdentifier of key, provided it is of type key_nid and is
+ * not handled by the encoding library, NULL otherwise.
+ */
+static const unsigned char *oqsx_plain_aid(const OQSX_KEY *key, int key_nid,
+                                           size_t *aidlen)
+{
+    const unsigned char *aid;
+
+#ifdef USE_ENCODING_LIB
+    if (key->oqsx_encoding_ctx.encoding_ctx != NULL
+        && key->oqsx_encoding_ctx.encoding_impl != NULL)
+        return NULL;
+#endif
+    if (key->tls_name == NULL
+        || (aid = oqsx_get_aid(key->tls_name, aidlen)) == NULL
+        || *aidlen > 128 || OBJ_sn2nid(key->tls_name) != key_nid)
+        return NULL;
+    return aid;
+}
+
+/*
+ * DER of the SubjectPublicKeyInfo of key up to its public key: headers
+ * around the shared AlgorithmIdentifier and the unused bits byte. The key
+ * follows as is, so it need not be copied or wrapped in an X509_PUBKEY.
+ * Returns the length written to prefix, 0 if the key needs encoding or is
+ * not of type key_nid, which is left to oqsx_key_to_pubkey.
+ */
+static size_t oqsx_spki_prefix(const OQSX_KEY *key, int key_nid,
+                               unsigned char prefix[OQSX_SPKI_PREFIX_MAX])
+{
+    const unsigned char *aid;
+    size_t aidlen, bitslen;
+    unsigned char *p = prefix;
+
+    if (key->pubkey == NULL
+        || (aid = oqsx_plain_aid(key, key_nid, &aidlen)) == NULL)
+        return 0;
+    bitslen = key->pubkeylen + 1;
+    p = der_put_header(p, V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED,
+                       aidlen + der_header_len(bitslen) + bitslen);
+    memcpy(p, aid, aidlen);
+    p = der_put_header(p + aidlen, V_ASN1_BIT_STRING, bitslen);
+    *p++ = 0;
+    return p - prefix;
+}
+
+/* DER PrivateKeyInfo headers and version around an AlgorithmIdentifier of at most 128 bytes */
+#define OQSX_P8_PREFIX_MAX (6 + 3 + 128 + 6 + 6)
+
+/*
+ * Length of the private key as saved in PKCS#8: for hybrids, the classic
+ * private key counts at its actual length. -1 if that is invalid.
+ */
+static int oqsx_pki_privkeylen(const OQSX_KEY *key)
+{
+    int privkeylen = key->privkeylen;
+    int actualprivkeylen;
+
+    if (key->numkeys > 1) { // hybrid
+        DECODE_UINT32(actualprivkeylen, key->privkey);
+        if (actualprivkeylen > key->evp_info->length_private_key) {
+            ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
+            return -1;
+        }
+        privkeylen -= (key->evp_info->length_private_key - actualprivkeylen);
+    }
+    return privkeylen;
+}
+
+/*
+ * DER of the PrivateKeyInfo of key up to its key blob of bloblen bytes:
+ * version, shared AlgorithmIdentifier and the headers of the privateKey
+ * OCTET STRING and of the OCTET STRING within it. Returns the length
+ * written to prefix, 0 if the key is left to key_to_p8info.
+ */
+static size_t oqsx_p8_prefix(const OQSX_KEY *key, int key_nid, size_t bloblen,
+                             unsigned char prefix[OQSX_P8_PREFIX_MAX])
+{
+    const unsigned char *aid;
+    size_t aidlen, octlen;
+    unsigned char *p = prefix;
+
+    if ((aid = oqsx_plain_aid(key, key_nid, &aidlen)) == NULL)
+        return 0;
+    octlen = der_header_len(bloblen) + bloblen;
+    p = der_put_header(p, V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED,
+                       3 + aidlen + der_header_len(octlen) + octlen);
+    *p++ = V_ASN1_INTEGER;
+    *p++ = 1;
+    *p++ = 0; // version
+    memcpy(p, aid, aidlen);
+    p = der_put_header(p + aidlen, V_ASN1_OCTET_STRING, octlen);
+    p = der_put_header(p, V_ASN1_OCTET_STRING, bloblen);
+    return p - prefix;
+}
+
+/*
+ * Writes the PrivateKeyInfo of key in a single pass, as oqsx_pki_priv_to_der
+ * and key_to_p8info would produce it: DER goes from the key straight to out,
+ * PEM is assembled once in secure memory, cleared once after writing.
+ * Returns -1 for keys left to key_to_p8info.
+ */
+static int oqsx_p8_write(BIO *out, const OQSX_KEY *key, int key_nid, int pem)
+{
+    unsigned char prefix[OQSX_P8_PREFIX_MAX], *der;
+    const unsigned char *pub = NULL;
+    int privkeylen, publen = 0, ret;
+    size_t prefixlen, derlen;
+
+    if (key->privkey == NULL)
+        return -1;
+#ifndef NOPUBKEY_IN_PRIVKEY
+    if (key->pubkey == NULL)
+        return -1;
+    pub = key->comp_pubkey[key->numkeys - 1];
+    publen = oqsx_key_get_oqs_public_key_len((OQSX_KEY *)key);
+#endif
+    if ((privkeylen = oqsx_pki_privkeylen(key)) < 0)
+        return 0;
+    if (publen < 0
+        || (prefixlen = oqsx_p8_prefix(key, key_nid, (size_t)privkeylen + publen,
+                                       prefix)) == 0)
+        return -1;
+
+    if (!pem)
+        return BIO_write(out, prefix, (int)prefixlen) == (int)prefixlen
+               && BIO_write(out, key->privkey, privkeylen) == privkeylen
+               && (publen == 0 || BIO_write(out, pub, publen) == publen);
+
+    derlen = prefixlen + privkeylen + publen;
+    if ((der = OPENSSL_secure_malloc(derlen)) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    memcpy(der, prefix, prefixlen);
+    memcpy(der + prefixlen, key->privkey, privkeylen);
+    if (publen > 0)
+        memcpy(der + prefixlen + privkeylen, pub, publen);
+    OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, privkeylen + publen);
+    ret = PEM_write_bio(out, PEM_STRING_PKCS8INF, "", der, (long)derlen) > 0;
+    OPENSSL_secure_clear_free(der, derlen);
+    return ret;
+}
+
 /*
  * key_to_epki_* produce encoded output with the private key data in a
  * EncryptedPrivateKeyInfo structure (defined by PKCS#8).  They require
@@ -257,6 +430,8 @@ static int key_to_pki_der_priv_bio(BIO *out, const void *key,
     void *str = NULL;
     int strtype = V_ASN1_UNDEF;
     PKCS8_PRIV_KEY_INFO *p8info;
+    const unsigned char *blob;
+    int bloblen;
 
     OQS_ENC_PRINTF("OQS ENC provider: key_to_pki_der_priv_bio called\n");
 
@@ -264,15 +439,21 @@ static int key_to_pki_der_priv_bio(BIO *out, const void *key,
         return key_to_epki_der_priv_bio(out, key, key_nid, pemname,
                                         p2s, k2d, ctx);
 
+    if ((ret = oqsx_p8_write(out, key, key_nid, 0)) >= 0)
+        return ret;
+    ret = 0;
+
     if (p2s != NULL && !p2s(key, key_nid, ctx->save_parameters,
                             &str, &strtype))
         return 0;
 
     p8info = key_to_p8info(key, key_nid, str, strtype, k2d);
 
-    if (p8info != NULL)
-        ret = i2d_PKCS8_PRIV_KEY_INFO_bio(out, p8info);
-    else
+    if (p8info != NULL) {
+        if ((ret = i2d_PKCS8_PRIV_KEY_INFO_bio(out, p8info))
+            && PKCS8_pkey_get0(NULL, &blob, &bloblen, NULL, p8info))
+            OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, bloblen); // serialized first
+    } else
         free_asn1_data(strtype, str);
 
     PKCS8_PRIV_KEY_INFO_free(p8info);
@@ -291,6 +472,8 @@ static int key_to_pki_pem_priv_bio(BIO *out, const void *key,
     void *str = NULL;
     int strtype = V_ASN1_UNDEF;
     PKCS8_PRIV_KEY_INFO *p8info;
+    const unsigned char *blob;
+    int bloblen;
 
     OQS_ENC_PRINTF("OQS ENC provider: key_to_pki_pem_priv_bio called\n");
 
@@ -298,15 +481,21 @@ static int key_to_pki_pem_priv_bio(BIO *out, const void *key,
         return key_to_epki_pem_priv_bio(out, key, key_nid, pemname,
                                         p2s, k2d, ctx);
 
+    if ((ret = oqsx_p8_write(out, key, key_nid, 1)) >= 0)
+        return ret;
+    ret = 0;
+
     if (p2s != NULL && !p2s(key, key_nid, ctx->save_parameters,
                             &str, &strtype))
         return 0;
 
     p8info = key_to_p8info(key, key_nid, str, strtype, k2d);
 
-    if (p8info != NULL)
-        ret = PEM_write_bio_PKCS8_PRIV_KEY_INFO(out, p8info);
-    else
+    if (p8info != NULL) {
+        if ((ret = PEM_write_bio_PKCS8_PRIV_KEY_INFO(out, p8info))
+            && PKCS8_pkey_get0(NULL, &blob, &bloblen, NULL, p8info))
+            OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, bloblen); // serialized first
+    } else
         free_asn1_data(strtype, str);
 
     PKCS8_PRIV_KEY_INFO_free(p8info);
@@ -326,17 +515,24 @@ static int key_to_spki_der_pub_bio(BIO *out, const void *key,
     X509_PUBKEY *xpk = NULL;
     void *str = NULL;
     int strtype = V_ASN1_UNDEF;
+    unsigned char prefix[OQSX_SPKI_PREFIX_MAX];
+    size_t prefixlen;
 
     OQS_ENC_PRINTF("OQS ENC provider: key_to_spki_der_pub_bio called\n");
 
+    // plain public keys go straight from the key to the output
+    if ((prefixlen = oqsx_spki_prefix(okey, key_nid, prefix)) > 0)
+        return BIO_write(out, prefix, (int)prefixlen) == (int)prefixlen
+               && BIO_write(out, okey->pubkey, (int)okey->pubkeylen) == (int)okey->pubkeylen;
+
     if (p2s != NULL && !p2s(key, key_nid, ctx->save_parameters,
                             &str, &strtype))
         return 0;
 
     xpk = oqsx_key_to_pubkey(key, key_nid, str, strtype, k2d);
 
-    if (xpk != NULL)
-        ret = i2d_X509_PUBKEY_bio(out, xpk);
+    if (xpk != NULL && (ret = i2d_X509_PUBKEY_bio(out, xpk)))
+        OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, okey->pubkeylen); // serialized first
 
     X509_PUBKEY_free(xpk);
     return ret;
@@ -350,21 +546,40 @@ static int key_to_spki_pem_pub_bio(BIO *out, const void *key,
                                    struct key2any_ctx_st *ctx)
 {
     int ret = 0;
+    const OQSX_KEY *okey = key;
     X509_PUBKEY *xpk = NULL;
     void *str = NULL;
     int strtype = V_ASN1_UNDEF;
+    unsigned char prefix[OQSX_SPKI_PREFIX_MAX], *der;
+    size_t prefixlen;
 
     OQS_ENC_PRINTF("OQS ENC provider: key_to_spki_pem_pub_bio called\n");
 
+    // plain public keys: DER assembled once, for base64 encoding
+    if ((prefixlen = oqsx_spki_prefix(okey, key_nid, prefix)) > 0) {
+        if ((der = OPENSSL_malloc(prefixlen + okey->pubkeylen)) == NULL) {
+            ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+            return 0;
+        }
+        memcpy(der, prefix, prefixlen);
+        memcpy(der + prefixlen, okey->pubkey, okey->pubkeylen);
+        OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, okey->pubkeylen);
+        ret = PEM_write_bio(out, PEM_STRING_PUBLIC, "", der,
+                            (long)(prefixlen + okey->pubkeylen)) > 0;
+        OPENSSL_free(der);
+        return ret;
+    }
+
     if (p2s != NULL && !p2s(key, key_nid, ctx->save_parameters,
                             &str, &strtype))
         return 0;
 
     xpk = oqsx_key_to_pubkey(key, key_nid, str, strtype, k2d);
 
-    if (xpk != NULL)
-        ret = PEM_write_bio_X509_PUBKEY(out, xpk);
-    else
+    if (xpk != NULL) {
+        if ((ret = PEM_write_bio_X509_PUBKEY(out, xpk)))
+            OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, okey->pubkeylen);
+    } else
         free_asn1_data(strtype, str);
 
     /* Also frees |str| */
@@ -523,6 +738,7 @@ static int oqsx_spki_pub_to_der(const void *vxkey, unsigned char **pder)
         buf = OPENSSL_secure_zalloc(buflen);
         ret = qsc_encode(encoding_ctx->encoding_ctx, encoding_ctx->encoding_impl, oqsxkey->pubkey, &buf, 0, 0, 1);
         if (ret != QSC_ENC_OK) return -1;
+        OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, buflen);
 
         *pder = buf;
         return buflen;
@@ -533,6 +749,7 @@ static int oqsx_spki_pub_to_der(const void *vxkey, unsigned char **pder)
             ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
             return 0;
         }
+        OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, oqsxkey->pubkeylen);
         *pder = keyblob;
         return oqsxkey->pubkeylen;
 #ifdef USE_ENCODING_LIB
@@ -565,16 +782,8 @@ static int oqsx_pki_priv_to_der(const void *vxkey, unsigned char **pder)
 
     // only concatenate private classic key (if any) and OQS private and public key
     // NOT saving public classic key component (if any)
-    privkeylen = oqsxkey->privkeylen;
-    if (oqsxkey->numkeys > 1) { // hybrid
-        int actualprivkeylen;
-        DECODE_UINT32(actualprivkeylen, oqsxkey->privkey);
-	if (actualprivkeylen > oqsxkey->evp_info->length_private_key) {
-            ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
-            return 0;
-	}
-	privkeylen -= (oqsxkey->evp_info->length_private_key - actualprivkeylen);
-    }
+    if ((privkeylen = oqsx_pki_privkeylen(oqsxkey)) < 0)
+        return 0;
 #ifdef USE_ENCODING_LIB
     if (oqsxkey->oqsx_encoding_ctx.encoding_ctx != NULL && oqsxkey->oqsx_encoding_ctx.encoding_impl != NULL) {
         const OQSX_ENCODING_CTX* encoding_ctx = &oqsxkey->oqsx_encoding_ctx;
@@ -622,6 +831,7 @@ static int oqsx_pki_priv_to_der(const void *vxkey, unsigned char **pder)
         ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
         keybloblen = 0; // signal error
     }
+    OQSX_STATS_ADD(OQSX_STAT_ENCODE_COPY_BYTES, buflen + keybloblen);
 
     OPENSSL_secure_clear_free(buf, buflen);
     return keybloblen;
@@ -899,6 +1109,31 @@ static int key2any_encode(struct key2any_ctx_st *ctx, OSSL_CORE_BIO *cout,
     return ret;
 }
 
+void *oqsx_key2any_newctx(PROV_OQS_CTX *provctx)
+{
+    return key2any_newctx(provctx);
+}
+
+void oqsx_key2any_freectx(void *ctx)
+{
+    if (ctx != NULL)
+        key2any_freectx(ctx);
+}
+
+/* as the PrivateKeyInfo DER encoders, but to a BIO of the caller */
+int oqsx_key_to_pki_der_bio(void *ctx, BIO *out, const OQSX_KEY *key)
+{
+    int type;
+
+    if (key == NULL || key->tls_name == NULL
+        || (type = OBJ_sn2nid(key->tls_name)) <= 0) {
+        ERR_raise(ERR_LIB_USER, ERR_R_PASSED_NULL_PARAMETER);
+        return 0;
+    }
+    return key_to_pki_der_priv_bio(out, key, type, NULL, prepare_oqsx_params,
+                                   oqsx_pki_priv_to_der, ctx);
+}
+
 #define DO_PRIVATE_KEY_selection_mask OSSL_KEYMGMT_SELECT_PRIVATE_KEY
 #define DO_PRIVATE_KEY(impl, type, kind, output)                            \
     if ((selection & DO_PRIVATE_KEY_selection_mask) != 0)                   \
@@ -15,6 +15,7 @@
 #include <openssl/core_names.h>
 #include <openssl/params.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <string.h>
 #include "oqs_prov.h"
 
@@ -43,6 +44,7 @@ static OSSL_FUNC_kem_freectx_fn oqs_kem_freectx;
 typedef struct {
     OSSL_LIB_CTX *libctx;
     OQSX_KEY *kem;
+    int parallel; // run hybrid halves concurrently
 } PROV_OQSKEM_CTX;
 
 /// Common KEM functions
@@ -55,6 +57,7 @@ static void *oqs_kem_newctx(void *provctx)
     if (pkemctx == NULL)
         return NULL;
     pkemctx->libctx = PROV_OQS_LIBCTX_OF(provctx);
+    pkemctx->parallel = ((PROV_OQS_CTX *)provctx)->hybrid_kem_parallel;
     // kem will only be set in init
 
     return pkemctx;
@@ -147,22 +150,102 @@ static int oqs_qs_kem_decaps(void *vpkemctx, unsigned char *out, size_t *outlen,
 
 /// EVP KEM functions
 
+/* X25519/X448: ephemeral key from raw random bytes, its public key written
+ * straight into ct; no parameter copies or encoded key round trips needed.
+ */
+static int oqs_evp_kem_encaps_raw(OSSL_LIB_CTX *libctx, const char *propq,
+                                  const OQSX_EVP_INFO *evp_info,
+                                  const unsigned char *pubkey_kex, unsigned char *ct,
+                                  unsigned char *secret, size_t *secretlen)
+{
+    int ret = OQS_SUCCESS, ret2 = 0;
+    unsigned char privkey[56]; // X448 is the largest raw key supported
+    size_t privkeylen = evp_info->length_private_key;
+    size_t pubkeylen = evp_info->length_public_key;
+    const char *keytype = OBJ_nid2sn(evp_info->keytype);
+
+    // Free at err:
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL, *peerpk = NULL;
+
+    ON_ERR_SET_GOTO(privkeylen > sizeof(privkey), ret, -1, err);
+
+    ret2 = RAND_priv_bytes_ex(libctx, privkey, privkeylen, 0);
+    ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, err);
+
+    pkey = EVP_PKEY_new_raw_private_key_ex(libctx, keytype, propq, privkey, privkeylen);
+    ON_ERR_SET_GOTO(!pkey, ret, -1, err);
+
+    peerpk = EVP_PKEY_new_raw_public_key_ex(libctx, keytype, propq, pubkey_kex, pubkeylen);
+    ON_ERR_SET_GOTO(!peerpk, ret, -1, err);
+
+    ctx = EVP_PKEY_CTX_new_from_pkey(libctx, pkey, propq);
+    ON_ERR_SET_GOTO(!ctx, ret, -1, err);
+
+    ret = EVP_PKEY_derive_init(ctx);
+    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+
+    ret = EVP_PKEY_derive_set_peer(ctx, peerpk);
+    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+
+    ret = EVP_PKEY_derive(ctx, secret, secretlen);
+    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+
+    ret2 = EVP_PKEY_get_raw_public_key(pkey, ct, &pubkeylen);
+    ON_ERR_SET_GOTO(ret2 <= 0 || pubkeylen != evp_info->length_public_key, ret, -1, err);
+
+    err:
+    OPENSSL_cleanse(privkey, sizeof(privkey));
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_free(peerpk);
+    return ret;
+}
+
+/* EC curves: one initialized keygen ctx per curve, shared by all KEM ctxs
+ * (libssl makes a new one per handshake). It is taken for the duration of a
+ * keygen and handed back afterwards; concurrent users set up their own.
+ */
+static EVP_PKEY_CTX *oqs_kem_keygen_ctx_get(OQSX_EVP_CTX *evp_ctx)
+{
+    EVP_PKEY_CTX *ctx = atomic_exchange_explicit(&evp_ctx->keygen_ctx, NULL,
+                                                 memory_order_acquire);
+
+    if (ctx != NULL)
+        return ctx;
+    if ((ctx = EVP_PKEY_CTX_new(evp_ctx->keyParam, NULL)) == NULL
+        || EVP_PKEY_keygen_init(ctx) != 1) {
+        EVP_PKEY_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void oqs_kem_keygen_ctx_put(OQSX_EVP_CTX *evp_ctx, EVP_PKEY_CTX *ctx)
+{
+    EVP_PKEY_CTX *expected = NULL;
+
+    if (!atomic_compare_exchange_strong_explicit(&evp_ctx->keygen_ctx, &expected, ctx,
+                                                 memory_order_release,
+                                                 memory_order_relaxed))
+        EVP_PKEY_CTX_free(ctx);
+}
+
 static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t *ctlen,
                                       unsigned char *secret, size_t *secretlen, int keyslot)
 {
     int ret = OQS_SUCCESS, ret2 = 0;
 
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
+    PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
+    OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
 
     size_t pubkey_kexlen = 0;
     size_t kexDeriveLen = 0, pkeylen = 0;
     unsigned char *pubkey_kex = pkemctx->kem->comp_pubkey[keyslot];
 
     // Free at err:
-    EVP_PKEY_CTX *ctx = NULL, *kgctx = NULL;;
+    EVP_PKEY_CTX *ctx = NULL, *kgctx;
     EVP_PKEY *pkey = NULL, *peerpk = NULL;
-    unsigned char *ctkex_encoded = NULL;
 
     pubkey_kexlen = evp_ctx->evp_info->length_public_key;
     kexDeriveLen = evp_ctx->evp_info->kex_length_secret;
@@ -175,6 +258,11 @@ static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t
         return 1;
     }
 
+    if (evp_ctx->evp_info->raw_key_support)
+        return oqs_evp_kem_encaps_raw(pkemctx->libctx, pkemctx->kem->propq,
+                                      evp_ctx->evp_info, pubkey_kex,
+                                      ct, secret, &kexDeriveLen);
+
     peerpk = EVP_PKEY_new();
     ON_ERR_SET_GOTO(!peerpk, ret, -1, err);
 
@@ -184,13 +272,11 @@ static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t
     ret2 = EVP_PKEY_set1_encoded_public_key(peerpk, pubkey_kex, pubkey_kexlen);
     ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, err);
 
-    kgctx = EVP_PKEY_CTX_new(evp_ctx->keyParam, NULL);
+    kgctx = oqs_kem_keygen_ctx_get(evp_ctx);
     ON_ERR_SET_GOTO(!kgctx, ret, -1, err);
 
-    ret2 = EVP_PKEY_keygen_init(kgctx);
-    ON_ERR_SET_GOTO(ret2 != 1, ret, -1, err);
-
     ret2 = EVP_PKEY_keygen(kgctx, &pkey);
+    oqs_kem_keygen_ctx_put(evp_ctx, kgctx);
     ON_ERR_SET_GOTO(ret2 != 1, ret, -1, err);
 
     ctx = EVP_PKEY_CTX_new(pkey, NULL);
@@ -205,17 +291,15 @@ static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t
     ret = EVP_PKEY_derive(ctx, secret, &kexDeriveLen);
     ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
 
-    pkeylen = EVP_PKEY_get1_encoded_public_key(pkey, &ctkex_encoded);
-    ON_ERR_SET_GOTO(pkeylen <= 0 || !ctkex_encoded || pkeylen != pubkey_kexlen, ret, -1, err);
-
-    memcpy(ct, ctkex_encoded, pkeylen);
+    // encode ephemeral public key directly into ct
+    ret2 = EVP_PKEY_get_octet_string_param(pkey, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                           ct, pubkey_kexlen, &pkeylen);
+    ON_ERR_SET_GOTO(ret2 <= 0 || pkeylen != pubkey_kexlen, ret, -1, err);
 
     err:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_CTX_free(kgctx);
     EVP_PKEY_free(pkey);
     EVP_PKEY_free(peerpk);
-    OPENSSL_free(ctkex_encoded);
     return ret;
 }
 
@@ -230,23 +314,17 @@ static int oqs_evp_kem_decaps_keyslot(void *vpkemctx, unsigned char *secret, siz
 
     size_t pubkey_kexlen = evp_ctx->evp_info->length_public_key;
     size_t kexDeriveLen = evp_ctx->evp_info->kex_length_secret;
-    unsigned char *privkey_kex = pkemctx->kem->comp_privkey[keyslot];
-    size_t privkey_kexlen = evp_ctx->evp_info->length_private_key;
+    EVP_PKEY *pkey = NULL; // owned by kem key
 
     // Free at err:
     EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey = NULL, *peerpkey = NULL;
+    EVP_PKEY *peerpkey = NULL;
 
     *secretlen = kexDeriveLen;
     if (secret == NULL) return 1;
 
-    if (evp_ctx->evp_info->raw_key_support) {
-        pkey = EVP_PKEY_new_raw_private_key(evp_ctx->evp_info->keytype, NULL, privkey_kex, privkey_kexlen);
-        ON_ERR_SET_GOTO(!pkey, ret, -10, err);
-    } else {
-        pkey = d2i_AutoPrivateKey(&pkey, (const unsigned char **)&privkey_kex, privkey_kexlen);
-        ON_ERR_SET_GOTO(!pkey, ret, -2, err);
-    }
+    pkey = oqsx_key_get0_classical_privkey(pkemctx->kem);
+    ON_ERR_SET_GOTO(!pkey, ret, -2, err);
 
     peerpkey = EVP_PKEY_new();
     ON_ERR_SET_GOTO(!peerpkey, ret, -3, err);
@@ -270,45 +348,116 @@ static int oqs_evp_kem_decaps_keyslot(void *vpkemctx, unsigned char *secret, siz
 
     err:
     EVP_PKEY_free(peerpkey);
-    EVP_PKEY_free(pkey);
     EVP_PKEY_CTX_free(ctx);
     return ret;
 }
 
 /// Hybrid KEM functions
 
+/* The classical (keyslot 0) and quantum-safe (keyslot 1) half of a hybrid
+ * KEM operation are independent: with hybrid_kem_parallel set, they run on
+ * two threads of the provider's worker pool.
+ */
+typedef struct {
+    void *vpkemctx;
+    unsigned char *ct[2];           // encaps output
+    const unsigned char *ct_in[2];  // decaps input
+    size_t ctlen[2];
+    unsigned char *secret[2];
+    size_t secretlen[2];
+    int ret[2];
+    uint64_t ns[2];
+    int parallel;
+} OQSX_KEM_HALVES;
+
+static void oqs_hyb_kem_encaps_half(void *vh, size_t keyslot)
+{
+    OQSX_KEM_HALVES *h = vh;
+    uint64_t t0 = OQSX_STATS_NSEC();
+
+    if (h->parallel)
+        ERR_set_mark(); // caller reports failure, on its own thread
+    if (keyslot == 0)
+        h->ret[0] = oqs_evp_kem_encaps_keyslot(h->vpkemctx, h->ct[0], &h->ctlen[0],
+                                               h->secret[0], &h->secretlen[0], 0);
+    else
+        h->ret[1] = oqs_qs_kem_encaps_keyslot(h->vpkemctx, h->ct[1], &h->ctlen[1],
+                                              h->secret[1], &h->secretlen[1], 1);
+    if (h->parallel)
+        ERR_pop_to_mark();
+    h->ns[keyslot] = OQSX_STATS_NSEC() - t0;
+}
+
+static void oqs_hyb_kem_decaps_half(void *vh, size_t keyslot)
+{
+    OQSX_KEM_HALVES *h = vh;
+    uint64_t t0 = OQSX_STATS_NSEC();
+
+    if (h->parallel)
+        ERR_set_mark();
+    if (keyslot == 0)
+        h->ret[0] = oqs_evp_kem_decaps_keyslot(h->vpkemctx, h->secret[0], &h->secretlen[0],
+                                               h->ct_in[0], h->ctlen[0], 0);
+    else
+        h->ret[1] = oqs_qs_kem_decaps_keyslot(h->vpkemctx, h->secret[1], &h->secretlen[1],
+                                              h->ct_in[1], h->ctlen[1], 1);
+    if (h->parallel)
+        ERR_pop_to_mark();
+    h->ns[keyslot] = OQSX_STATS_NSEC() - t0;
+}
+
+/* runs both halves, concurrently if configured; returns 1 if both succeeded */
+static int oqs_hyb_kem_run(const PROV_OQSKEM_CTX *pkemctx, OQSX_KEM_HALVES *h,
+                           oqsx_task_fn half)
+{
+    if ((h->parallel = pkemctx->parallel)) {
+        if (!oqsx_parallel_for(2, 2, half, h))
+            return 0;
+        if (h->ret[0] <= 0 || h->ret[1] <= 0) {
+            ERR_raise(ERR_LIB_USER, ERR_R_OPERATION_FAIL);
+            return 0;
+        }
+    } else {
+        half(h, 0);
+        if (h->ret[0] <= 0)
+            return 0;
+        half(h, 1);
+        if (h->ret[1] <= 0)
+            return 0;
+    }
+    OQSX_STATS_ADD(OQSX_STAT_KEM_CLASSICAL_NS, h->ns[0]);
+    OQSX_STATS_ADD(OQSX_STAT_KEM_QS_NS, h->ns[1]);
+    OQSX_STATS_ADD(OQSX_STAT_KEM_HYB_OPS, 1);
+    return 1;
+}
+
 static int oqs_hyb_kem_encaps(void *vpkemctx, unsigned char *ct, size_t *ctlen,
                               unsigned char *secret, size_t *secretlen)
 {
     int ret = OQS_SUCCESS;
     const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    size_t secretLen0 = 0, secretLen1 = 0;
-    size_t ctLen0 = 0, ctLen1 = 0;
-    unsigned char *ct0, *ct1, *secret0, *secret1;
+    OQSX_KEM_HALVES h = { vpkemctx };
 
-    ret = oqs_evp_kem_encaps_keyslot(vpkemctx, NULL, &ctLen0, NULL, &secretLen0, 0);
+    ret = oqs_evp_kem_encaps_keyslot(vpkemctx, NULL, &h.ctlen[0], NULL, &h.secretlen[0], 0);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
-    ret = oqs_qs_kem_encaps_keyslot(vpkemctx, NULL, &ctLen1, NULL, &secretLen1, 1);
+    ret = oqs_qs_kem_encaps_keyslot(vpkemctx, NULL, &h.ctlen[1], NULL, &h.secretlen[1], 1);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
 
 
-    *ctlen = ctLen0 + ctLen1;
-    *secretlen = secretLen0 + secretLen1;
+    *ctlen = h.ctlen[0] + h.ctlen[1];
+    *secretlen = h.secretlen[0] + h.secretlen[1];
 
     if (ct == NULL || secret == NULL) {
         OQS_KEM_PRINTF3("HYB KEM returning lengths %ld and %ld\n", *ctlen, *secretlen);
         return 1;
     }
 
-    ct0 = ct;
-    ct1 = ct + ctLen0;
-    secret0 = secret;
-    secret1 = secret + secretLen0;
+    h.ct[0] = ct;
+    h.ct[1] = ct + h.ctlen[0];
+    h.secret[0] = secret;
+    h.secret[1] = secret + h.secretlen[0];
 
-    ret = oqs_evp_kem_encaps_keyslot(vpkemctx, ct0, &ctLen0, secret0, &secretLen0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
-
-    ret = oqs_qs_kem_encaps_keyslot(vpkemctx, ct1, &ctLen1, secret1, &secretLen1, 1);
+    ret = oqs_hyb_kem_run(pkemctx, &h, oqs_hyb_kem_encaps_half);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
 
     err:
@@ -322,34 +471,28 @@ static int oqs_hyb_kem_decaps(void *vpkemctx, unsigned char *secret, size_t *sec
     const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
     const OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
     const OQS_KEM *qs_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_qs_ctx.kem;
+    OQSX_KEM_HALVES h = { vpkemctx };
 
-    size_t secretLen0 = 0, secretLen1 = 0;
-    size_t ctLen0 = 0, ctLen1 = 0;
-    const unsigned char *ct0, *ct1;
-    unsigned char *secret0, *secret1;
-
-    ret = oqs_evp_kem_decaps_keyslot(vpkemctx, NULL, &secretLen0, NULL, 0, 0);
+    ret = oqs_evp_kem_decaps_keyslot(vpkemctx, NULL, &h.secretlen[0], NULL, 0, 0);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
-    ret = oqs_qs_kem_decaps_keyslot(vpkemctx, NULL, &secretLen1, NULL, 0, 1);
+    ret = oqs_qs_kem_decaps_keyslot(vpkemctx, NULL, &h.secretlen[1], NULL, 0, 1);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
 
-    *secretlen = secretLen0 + secretLen1;
+    *secretlen = h.secretlen[0] + h.secretlen[1];
 
     if (secret == NULL) return 1;
 
-    ctLen0 = evp_ctx->evp_info->length_public_key;
-    ctLen1 = qs_ctx->length_ciphertext;
+    h.ctlen[0] = evp_ctx->evp_info->length_public_key;
+    h.ctlen[1] = qs_ctx->length_ciphertext;
 
-    ON_ERR_SET_GOTO(ctLen0 + ctLen1 != ctlen, ret, OQS_ERROR, err);
+    ON_ERR_SET_GOTO(h.ctlen[0] + h.ctlen[1] != ctlen, ret, OQS_ERROR, err);
 
-    ct0 = ct;
-    ct1 = ct + ctLen0;
-    secret0 = secret;
-    secret1 = secret + secretLen0;
+    h.ct_in[0] = ct;
+    h.ct_in[1] = ct + h.ctlen[0];
+    h.secret[0] = secret;
+    h.secret[1] = secret + h.secretlen[0];
 
-    ret = oqs_evp_kem_decaps_keyslot(vpkemctx, secret0, &secretLen0, ct0, ctLen0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
-    ret = oqs_qs_kem_decaps_keyslot(vpkemctx, secret1, &secretLen1, ct1, ctLen1, 1);
+    ret = oqs_hyb_kem_run(pkemctx, &h, oqs_hyb_kem_decaps_half);
     ON_ERR_SET_GOTO(ret <= 0, ret, OQS_ERROR, err);
 
     err:
@@ -20,6 +20,8 @@
 #include "openssl/param_build.h"
 #include "oqs_prov.h"
 
+static int oqsx_param_set_octet(OSSL_PARAM *p, const unsigned char *data, size_t data_len);
+
 // stolen from openssl/crypto/param_build_set.c as ossl_param_build_set_octet_string not public API:
 
 int oqsx_param_build_set_octet_string(OSSL_PARAM_BLD *bld, OSSL_PARAM *p,
@@ -27,15 +29,32 @@ int oqsx_param_build_set_octet_string(OSSL_PARAM_BLD *bld, OSSL_PARAM *p,
                                       const unsigned char *data,
                                       size_t data_len)
 {
-    if (bld != NULL)
+    if (bld != NULL) {
+        OQSX_STATS_ADD(OQSX_STAT_PARAM_COPY_BYTES, data_len);
         return OSSL_PARAM_BLD_push_octet_string(bld, key, data, data_len);
+    }
 
     p = OSSL_PARAM_locate(p, key);
     if (p != NULL)
-        return OSSL_PARAM_set_octet_string(p, data, data_len);
+        return oqsx_param_set_octet(p, data, data_len);
     return 1;
 }
 
+/* Hands out public data by reference if the requester asks for an
+ * OSSL_PARAM_OCTET_PTR, copies it into the requester's buffer otherwise.
+ * Referenced data lives as long as the key.
+ */
+static int oqsx_param_set_octet(OSSL_PARAM *p, const unsigned char *data, size_t data_len)
+{
+    if (p->data_type == OSSL_PARAM_OCTET_PTR) {
+        OQSX_STATS_ADD(OQSX_STAT_PARAM_REF_BYTES, data_len);
+        return OSSL_PARAM_set_octet_ptr(p, data, data_len);
+    }
+    if (p->data != NULL) // else size query only
+        OQSX_STATS_ADD(OQSX_STAT_PARAM_COPY_BYTES, data_len);
+    return OSSL_PARAM_set_octet_string(p, data, data_len);
+}
+
 
 
 #ifdef NDEBUG
@@ -67,12 +86,13 @@ static OSSL_FUNC_keymgmt_export_types_fn oqs_imexport_types;
 struct oqsx_gen_ctx {
     OSSL_LIB_CTX *libctx;
     char *propq;
-    char *oqs_name;
-    char *tls_name;
+    char *oqs_name;       // static, like all algorithm names below
+    const char *tls_name;
     int primitive;
     int selection;
     int bit_security;
     int alg_idx;
+    OQSX_KEYPOOL *keypool; // pre-generated keys, if enabled for tls_name
 };
 
 static int oqsx_has(const void *keydata, int selection)
@@ -230,14 +250,15 @@ int oqsx_key_to_params(const OQSX_KEY *key, OSSL_PARAM_BLD *tmpl,
     return ret;
 }
 
+/* Params passed to param_cb refer to the key's buffers: they are only read
+ * during the callback, so nothing needs to be copied into a param block.
+ */
 static int oqsx_export(void *keydata, int selection, OSSL_CALLBACK *param_cb,
                       void *cbarg)
 {
     OQSX_KEY *key = keydata;
-    OSSL_PARAM_BLD *tmpl;
-    OSSL_PARAM *params = NULL;
-    OSSL_PARAM *p;
-    int ok = 1;
+    OSSL_PARAM params[3];
+    int n = 0;
 
     OQS_KM_PRINTF("OQSKEYMGMT: export called\n");
 
@@ -249,30 +270,25 @@ static int oqsx_export(void *keydata, int selection, OSSL_CALLBACK *param_cb,
         return 0;
     }
 
-    tmpl = OSSL_PARAM_BLD_new();
-    if (tmpl == NULL) {
-        ERR_raise(ERR_LIB_USER, OQSPROV_UNEXPECTED_NULL);
-        return 0;
-    }
-
     if ((selection & OSSL_KEYMGMT_SELECT_KEYPAIR) != 0) {
-        int include_private =
-            selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY ? 1 : 0;
-
-        ok = ok && oqsx_key_to_params(key, tmpl, NULL, include_private);
-    }
-
-    params = OSSL_PARAM_BLD_to_param(tmpl);
-    if (params == NULL) {
-        ok = 0;
-        goto err;
+        if (key->pubkey != NULL) {
+            if (key->pubkeylen == 0)
+                return 0;
+            params[n++] = OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY,
+                                                            key->pubkey, key->pubkeylen);
+            OQSX_STATS_ADD(OQSX_STAT_PARAM_REF_BYTES, key->pubkeylen);
+        }
+        if (key->privkey != NULL && (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) != 0) {
+            if (key->privkeylen == 0)
+                return 0;
+            params[n++] = OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PRIV_KEY,
+                                                            key->privkey, key->privkeylen);
+            OQSX_STATS_ADD(OQSX_STAT_PARAM_REF_BYTES, key->privkeylen);
+        }
     }
+    params[n] = OSSL_PARAM_construct_end();
 
-    ok = ok & param_cb(params, cbarg);
-    OSSL_PARAM_free(params);
-err:
-    OSSL_PARAM_BLD_free(tmpl);
-    return ok;
+    return param_cb(params, cbarg);
 }
 
 #define OQS_KEY_TYPES()                                                        \
@@ -320,16 +336,16 @@ static int oqsx_get_params(void *key, OSSL_PARAM params[])
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY)) != NULL) {
         // hybrid KEMs are special in that the classic length information shall not be passed out:
         if (oqsxk->keytype == KEY_TYPE_ECP_HYB_KEM || oqsxk->keytype == KEY_TYPE_ECX_HYB_KEM) {
-            if (!OSSL_PARAM_set_octet_string(p, oqsxk->pubkey+SIZE_OF_UINT32, oqsxk->pubkeylen-SIZE_OF_UINT32))
+            if (!oqsx_param_set_octet(p, oqsxk->pubkey+SIZE_OF_UINT32, oqsxk->pubkeylen-SIZE_OF_UINT32))
                 return 0;
         }
         else {
-            if (!OSSL_PARAM_set_octet_string(p, oqsxk->pubkey, oqsxk->pubkeylen))
+            if (!oqsx_param_set_octet(p, oqsxk->pubkey, oqsxk->pubkeylen))
                 return 0;
         }
     }
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY)) != NULL) {
-        if (!OSSL_PARAM_set_octet_string(p, oqsxk->pubkey, oqsxk->pubkeylen))
+        if (!oqsx_param_set_octet(p, oqsxk->pubkey, oqsxk->pubkeylen))
             return 0;
     }
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PRIV_KEY)) != NULL) {
@@ -357,17 +373,8 @@ static const OSSL_PARAM *oqs_gettable_params(void *provctx)
 
 static int set_property_query(OQSX_KEY *oqsxkey, const char *propq)
 {
-    OPENSSL_free(oqsxkey->propq);
-    oqsxkey->propq = NULL;
     OQS_KM_PRINTF("OQSKEYMGMT: property_query called\n");
-    if (propq != NULL) {
-        oqsxkey->propq = OPENSSL_strdup(propq);
-        if (oqsxkey->propq == NULL) {
-            ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
-            return 0;
-        }
-    }
-    return 1;
+    return oqsx_key_set_propq(oqsxkey, propq);
 }
 
 static int oqsx_set_params(void *key, const OSSL_PARAM params[])
@@ -376,27 +383,43 @@ static int oqsx_set_params(void *key, const OSSL_PARAM params[])
     const OSSL_PARAM *p;
 
     OQS_KM_PRINTF("OQSKEYMGMT: set_params called\n");
+    // other users' key, too, possibly read concurrently
+    if ((oqsxkey->flags & OQSX_KEY_FLAG_SHARED)
+        && (OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY) != NULL
+            || OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PROPERTIES) != NULL)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
+        return 0;
+    }
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY);
     if (p != NULL) {
         size_t used_len;
         int classic_pubkey_len;
         if (oqsxkey->keytype == KEY_TYPE_ECP_HYB_KEM || oqsxkey->keytype == KEY_TYPE_ECX_HYB_KEM) {
             // classic key len already stored by key setup; only data needs to be filled in
-            if (p->data_size != oqsxkey->pubkeylen-SIZE_OF_UINT32
+            if (oqsxkey->comp_pubkey[0] == NULL
+                || p->data_size != oqsxkey->pubkeylen-SIZE_OF_UINT32
                 || !OSSL_PARAM_get_octet_string(p, &oqsxkey->comp_pubkey[0], oqsxkey->pubkeylen-SIZE_OF_UINT32,
                                                 &used_len)) {
                 return 0;
             }
         }
         else {
+            oqsx_key_allocate_keymaterial(oqsxkey, 0); // key's own buffer, never fails
             if (p->data_size != oqsxkey->pubkeylen
                 || !OSSL_PARAM_get_octet_string(p, &oqsxkey->pubkey, oqsxkey->pubkeylen,
                                                 &used_len)) {
                 return 0;
             }
         }
-        OPENSSL_clear_free(oqsxkey->privkey, oqsxkey->privkeylen);
+        oqsx_slab_clear_free(oqsxkey->privkey, oqsxkey->privkeylen);
         oqsxkey->privkey = NULL;
+        // classic key and contexts of hybrids belong to the old key pair
+        EVP_PKEY_CTX_free(oqsxkey->classical_sign_ctx);
+        EVP_PKEY_CTX_free(oqsxkey->classical_verify_ctx);
+        EVP_PKEY_free(oqsxkey->classical_pkey);
+        oqsxkey->classical_sign_ctx = NULL;
+        oqsxkey->classical_verify_ctx = NULL;
+        oqsxkey->classical_pkey = NULL;
     }
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PROPERTIES);
     if (p != NULL) {
@@ -430,12 +453,13 @@ static void *oqsx_gen_init(void *provctx, int selection, char* oqs_name, char* t
 
     if ((gctx = OPENSSL_zalloc(sizeof(*gctx))) != NULL) {
         gctx->libctx = libctx;
-        gctx->oqs_name = OPENSSL_strdup(oqs_name);
-        gctx->tls_name = OPENSSL_strdup(tls_name);
+        gctx->oqs_name = oqs_name;
+        gctx->tls_name = tls_name;
         gctx->primitive = primitive;
         gctx->selection = selection;
         gctx->bit_security = bit_security;
         gctx->alg_idx = alg_idx;
+        gctx->keypool = oqsx_keypool_get(provctx, tls_name, primitive);
     }
     return gctx;
 }
@@ -447,6 +471,10 @@ static void *oqsx_genkey(struct oqsx_gen_ctx *gctx)
     OQS_KM_PRINTF3("OQSKEYMGMT: gen called for %s (%s)\n", gctx->oqs_name, gctx->tls_name);
     if (gctx == NULL)
         return NULL;
+    if (gctx->keypool != NULL && gctx->propq == NULL
+        && (key = oqsx_keypool_pop(gctx->keypool, gctx->oqs_name, gctx->tls_name, gctx->primitive,
+                                   gctx->bit_security, gctx->alg_idx)) != NULL)
+        return key;
     if ((key = oqsx_key_new(gctx->libctx, gctx->oqs_name, gctx->tls_name, gctx->primitive, gctx->propq, gctx->bit_security, gctx->alg_idx)) == NULL) {
 	OQS_KM_PRINTF2("OQSKM: Error generating key for %s\n", gctx->tls_name);
         ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
@@ -474,8 +502,6 @@ static void oqsx_gen_cleanup(void *genctx)
     struct oqsx_gen_ctx *gctx = genctx;
 
     OQS_KM_PRINTF("OQSKEYMGMT: gen_cleanup called\n");
-    OPENSSL_free(gctx->oqs_name);
-    OPENSSL_free(gctx->tls_name);
     OPENSSL_free(gctx->propq);
     OPENSSL_free(gctx);
 }
@@ -516,10 +542,13 @@ static int oqsx_gen_set_params(void *genctx, const OSSL_PARAM params[])
 
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_GROUP_NAME);
     if (p != NULL) {
-        const char *algname = (char*)p->data;
-
-        OPENSSL_free(gctx->tls_name);
-        gctx->tls_name = OPENSSL_strdup(algname);
+        // keys are of this keymgmt's algorithm: only its own name makes sense,
+        // in any case, as fetching the keymgmt by name ignores case, too
+        if (p->data_type != OSSL_PARAM_UTF8_STRING
+            || strcasecmp(p->data, gctx->tls_name)) {
+            ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
+            return 0;
+        }
     }
     p = OSSL_PARAM_locate_const(params, OSSL_KDF_PARAM_PROPERTIES);
     if (p != NULL) {
@@ -84,15 +84,40 @@
                         "x448_" #oqsname "")
 #endif
 
+typedef struct oqsx_keypool_st OQSX_KEYPOOL;
+typedef struct oqsx_keycache_st OQSX_KEYCACHE;
+typedef struct oqsx_pubstore_st OQSX_PUBSTORE;
+
 typedef struct prov_oqs_ctx_st {
     const OSSL_CORE_HANDLE *handle;
     OSSL_LIB_CTX *libctx;         /* For all provider modules */
     BIO_METHOD *corebiometh; 
+    int hybrid_sig_parallel;      /* sign/verify hybrid halves concurrently */
+    int hybrid_kem_parallel;      /* encaps/decaps hybrid halves concurrently */
+    OQSX_KEYPOOL *keypools;       /* pre-generated KEM keys, see oqsprov_keypool.c */
+    OQSX_KEYCACHE *keycache;      /* decoded public keys, see oqsprov_keycache.c */
 } PROV_OQS_CTX;
 
+/* Boolean options read from the provider's openssl.cnf section */
+# define OQS_PROV_CONF_HYBRID_SIG_PARALLEL "hybrid_sig_parallel"
+# define OQS_PROV_CONF_HYBRID_KEM_PARALLEL "hybrid_kem_parallel"
+/* KEM keypair pools: comma separated group names and number of keys each */
+# define OQS_PROV_CONF_KEM_KEYPOOL_GROUPS  "kem_keypool_groups"
+# define OQS_PROV_CONF_KEM_KEYPOOL_DEPTH   "kem_keypool_depth"
+# define OQSX_KEYPOOL_MAX_DEPTH            4096
+/* Number of public keys decoded from SPKI DER kept for reuse */
+# define OQS_PROV_CONF_SPKI_CACHE_SIZE     "spki_cache_size"
+# define OQSX_KEYCACHE_MAX_SIZE            (1 << 20)
+/* Register algorithm objects when an operation is first queried, not on load */
+# define OQS_PROV_CONF_LAZY_INIT           "lazy_init"
+
 PROV_OQS_CTX *oqsx_newprovctx(OSSL_LIB_CTX *libctx, const OSSL_CORE_HANDLE *handle, BIO_METHOD *bm);
 void oqsx_freeprovctx(PROV_OQS_CTX *ctx);
 # define PROV_OQS_LIBCTX_OF(provctx) (((PROV_OQS_CTX *)provctx)->libctx)
+/* context of prov if it is an instance of this provider, else NULL */
+PROV_OQS_CTX *oqsx_provctx_of(const OSSL_PROVIDER *prov);
+/* Registers the signature algorithm objects unless done already; 0 on error */
+int oqsx_objects_init(const PROV_OQS_CTX *provctx);
 
 #include "oqs/oqs.h"
 #ifdef USE_ENCODING_LIB
@@ -115,13 +140,17 @@ struct oqsx_evp_info_st {
 typedef struct oqsx_evp_info_st OQSX_EVP_INFO;
 
 struct oqsx_evp_ctx_st {
-    EVP_PKEY_CTX *ctx;
     EVP_PKEY *keyParam;
     const OQSX_EVP_INFO *evp_info;
+    /* hybrid ECP KEMs: initialized ephemeral keygen ctx, see oqs_kem.c */
+    _Atomic(EVP_PKEY_CTX *) keygen_ctx;
 };
 
 typedef struct oqsx_evp_ctx_st OQSX_EVP_CTX;
 
+/* liboqs algorithm descriptors: shared by all keys of an algorithm and owned
+ * by the provider (see oqsprov_keys.c); keys must not free them.
+ */
 typedef union {
     OQS_SIG *sig;
     OQS_KEM *kem;
@@ -149,6 +178,17 @@ enum oqsx_key_type_en {
 
 typedef enum oqsx_key_type_en OQSX_KEY_TYPE;
 
+/* max. number of component keys: classic key, if present, and OQS key */
+#define OQSX_MAX_COMP_KEYS 2
+
+/* OQSX_KEY flags */
+#define OQSX_KEY_FLAG_PROPQ_ALLOCATED 0x1 // propq not stored in key allocation
+#define OQSX_KEY_FLAG_SHARED          0x2 // handed out repeatedly: immutable
+#define OQSX_KEY_FLAG_PUBKEY_BORROWED 0x4 // pubkey within pubkey_store, not owned
+
+/* Keys are allocated in one piece: header, then public key material, then
+ * propq; private key material lives in a separate secure heap block.
+ */
 struct oqsx_key_st {
     OSSL_LIB_CTX *libctx;
     char *propq;
@@ -157,7 +197,10 @@ struct oqsx_key_st {
 #ifdef USE_ENCODING_LIB
     OQSX_ENCODING_CTX oqsx_encoding_ctx;
 #endif
-    EVP_PKEY *classical_pkey; // for hybrid sigs
+    _Atomic(EVP_PKEY *) classical_pkey; // hybrids: decoded classic key, see oqsx_key_get0_classical_privkey
+    /* hybrid sigs: initialized classic sign/verify ctx, see oqs_sig.c */
+    _Atomic(EVP_PKEY_CTX *) classical_sign_ctx;
+    _Atomic(EVP_PKEY_CTX *) classical_verify_ctx;
     const OQSX_EVP_INFO *evp_info;
     size_t numkeys;
 
@@ -166,33 +209,58 @@ struct oqsx_key_st {
     size_t privkeylen;
     size_t pubkeylen;
     size_t bit_security;
-    char *tls_name;
+    const char *tls_name; // static: not owned by key
     _Atomic int references;
+    unsigned int flags;
 
     /* point to actual priv key material -- classic key, if present, first
      * i.e., OQS key always at comp_*key[numkeys-1]
      */
-    void **comp_privkey;
-    void **comp_pubkey;
+    void *comp_privkey[OQSX_MAX_COMP_KEYS];
+    void *comp_pubkey[OQSX_MAX_COMP_KEYS];
 
     /* contain key material: First SIZE_OF_UINT32 bytes indicating actual classic 
      * key length in case of hybrid keys (if numkeys>1)
      */
     void *privkey;
-    void *pubkey;
+    void *pubkey; // NULL, material below or in pubkey_store
+    OQSX_PUBSTORE *pubkey_store; // referenced if OQSX_KEY_FLAG_PUBKEY_BORROWED
+    unsigned char material[];
 };
 
 typedef struct oqsx_key_st OQSX_KEY;
 
 /* Register given NID with tlsname in OSSL3 registry */
 int oqs_set_nid(char* tlsname, int nid);
-
-/* Create OQSX_KEY data structure based on parameters; key material allocated separately */ 
-OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int is_kem, const char *propq, int bit_security, int alg_idx);
+/* Index NIDs set by oqs_set_nid for key creation; once all are registered */
+void oqsx_nid_index_init(void);
+/* DER AlgorithmIdentifier of signature algorithm tls_name, shared; NULL if unknown */
+const unsigned char *oqsx_get_aid(const char *tls_name, size_t *len);
+/* Same, for algorithm with DER OID (incl. tag and length) oid; NULL if none of ours */
+const unsigned char *oqsx_find_aid(const unsigned char *oid, size_t oidlen);
+/* FNV-1a based 64 bit hash, not for untrusted collisions */
+uint64_t oqsx_hash(const unsigned char *p, size_t len, uint32_t seed);
+
+/* Create OQSX_KEY data structure based on parameters; private key material allocated separately.
+ * tls_name must outlive the key, e.g., be a string literal */ 
+OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, const char* tls_name, int is_kem, const char *propq, int bit_security, int alg_idx);
+
+/* Create OQSX_KEY of signature algorithm nid, as oqsx_key_new */
+OQSX_KEY *oqsx_key_new_from_nid(OSSL_LIB_CTX *libctx, const char *propq, int nid);
+
+/* Create immutable public OQSX_KEY of signature algorithm nid whose pubkey
+ * is pubkeylen bytes at pubkey, not copied: pubkey must stay valid while
+ * store, of which the key takes a reference, does */
+OQSX_KEY *oqsx_key_new_borrowed(OSSL_LIB_CTX *libctx, int nid,
+                                const unsigned char *pubkey, size_t pubkeylen,
+                                OQSX_PUBSTORE *store);
 
 /* allocate key material; component pointers need to be set separately */
 int oqsx_key_allocate_keymaterial(OQSX_KEY *key, int include_private);
 
+/* replace property query of key */
+int oqsx_key_set_propq(OQSX_KEY *key, const char *propq);
+
 /* free all data structures, incl. key material */
 void oqsx_key_free(OQSX_KEY *key);
 
@@ -202,11 +270,30 @@ int oqsx_key_up_ref(OQSX_KEY *key);
 /* do (composite) key generation */
 int oqsx_key_gen(OQSX_KEY *key);
 
+/* retrieve decoded classic private key of hybrid key, decoding it on first use */
+EVP_PKEY *oqsx_key_get0_classical_privkey(OQSX_KEY *key);
+/* same, from public key, for keys without private key lacking it */
+EVP_PKEY *oqsx_key_get0_classical_pubkey(OQSX_KEY *key);
+
+/* PrivateKeyInfo DER encoder of oqs_encode_key2any.c writing to a BIO of the
+ * caller; contexts are not thread-safe, use one per thread */
+void *oqsx_key2any_newctx(PROV_OQS_CTX *provctx);
+void oqsx_key2any_freectx(void *ctx);
+int oqsx_key_to_pki_der_bio(void *ctx, BIO *out, const OQSX_KEY *key);
+
 /* create OQSX_KEY from pkcs8 data structure */
 OQSX_KEY *oqsx_key_from_pkcs8(const PKCS8_PRIV_KEY_INFO *p8inf, OSSL_LIB_CTX *libctx, const char *propq);
 
 /* create OQSX_KEY (public key material only) from X509 data structure */
 OQSX_KEY *oqsx_key_from_x509pubkey(const X509_PUBKEY *xpk, OSSL_LIB_CTX *libctx, const char *propq);
+/* Decodes SubjectPublicKeyInfo of an OQS signature algorithm in plain DER
+ * without an X509_PUBKEY; returns 0 if not of that shape, else 1 with *key
+ * set, NULL on error */
+int oqsx_key_from_spki(const unsigned char **pp, long len,
+                       OSSL_LIB_CTX *libctx, const char *propq, OQSX_KEY **key);
+/* Generic SPKI decoding to X509_PUBKEY, for input not taken by oqsx_key_from_spki */
+X509_PUBKEY *oqsx_d2i_X509_PUBKEY_INTERNAL(const unsigned char **pp,
+                                           long len, OSSL_LIB_CTX *libctx);
 
 /* Backend support */
 /* populate key material from parameters */
@@ -221,11 +308,92 @@ int oqsx_key_maxsize(OQSX_KEY *k);
 void oqsx_key_set0_libctx(OQSX_KEY *key, OSSL_LIB_CTX *libctx);
 int oqs_patch_codepoints(void);
 
+/* Worker thread pool, see oqsprov_threads.c */
+typedef void (*oqsx_task_fn)(void *arg, size_t idx);
+/* number of threads to use for request of nthreads (<= 0: one per CPU) */
+int oqsx_thread_count(int nthreads);
+/* run fn(arg, i) for all i < n on up to nthreads threads incl. the caller */
+int oqsx_parallel_for(size_t n, int nthreads, oqsx_task_fn fn, void *arg);
+void oqsx_thread_pool_free(void);
+
+/* Slab allocator for (private) key buffers, see oqsprov_slab.c */
+/* zeroed buffer of given size, from secure heap */
+void *oqsx_slab_zalloc(size_t size);
+/* zeroizes and releases buffer obtained from oqsx_slab_zalloc for same size */
+void oqsx_slab_clear_free(void *ptr, size_t size);
+/* return all slabs to secure heap, on teardown of last provider instance */
+void oqsx_slab_free_all(void);
+/* run fn(arg, 0) on a worker thread, without waiting for it */
+int oqsx_run_async(oqsx_task_fn fn, void *arg);
+
+/* Pre-generated KEM keypairs, see oqsprov_keypool.c */
+int oqsx_keypools_new(PROV_OQS_CTX *provctx, const char *groups, size_t depth);
+void oqsx_keypools_free(PROV_OQS_CTX *provctx);
+OQSX_KEYPOOL *oqsx_keypool_get(PROV_OQS_CTX *provctx, const char *tls_name, int primitive);
+/* returns a fresh key or NULL if none is ready; triggers refill when low */
+OQSX_KEY *oqsx_keypool_pop(OQSX_KEYPOOL *pool, char *oqs_name, const char *tls_name,
+                           int primitive, int bit_security, int alg_idx);
+/* keys handed out and refills done by all pools of provctx */
+#define OQS_PROV_PARAM_KEM_KEYPOOL_HITS    "oqs-kem-keypool-hits"
+#define OQS_PROV_PARAM_KEM_KEYPOOL_REFILLS "oqs-kem-keypool-refills"
+int oqsx_keypools_get_params(PROV_OQS_CTX *provctx, OSSL_PARAM params[]);
+
+/* Decoded public keys by SPKI DER, see oqsprov_keycache.c */
+int oqsx_keycache_new(PROV_OQS_CTX *provctx, size_t size);
+void oqsx_keycache_free(PROV_OQS_CTX *provctx);
+/* returns a new reference to the key decoded from der as type nid or NULL */
+OQSX_KEY *oqsx_keycache_get(OQSX_KEYCACHE *cache, const unsigned char *der, size_t derlen,
+                            int nid);
+/* keeps a reference to key, just decoded from der as type nid; key becomes immutable */
+void oqsx_keycache_put(OQSX_KEYCACHE *cache, const unsigned char *der, size_t derlen,
+                       int nid, OQSX_KEY *key);
+/* lookups answered from and missing the cache of provctx */
+#define OQS_PROV_PARAM_SPKI_CACHE_HITS     "oqs-spki-cache-hits"
+#define OQS_PROV_PARAM_SPKI_CACHE_MISSES   "oqs-spki-cache-misses"
+int oqsx_keycache_get_params(PROV_OQS_CTX *provctx, OSSL_PARAM params[]);
+
+/* Memory-mapped public key stores, see oqsprov_pubstore.c */
+void oqsx_pubstore_up_ref(OQSX_PUBSTORE *store);
+void oqsx_pubstore_free(OQSX_PUBSTORE *store);
+
+/* Optional run-time counters, exported as provider parameters */
+#define OQS_PROV_PARAM_STAT_KEM_HYB_OPS       "oqs-kem-hybrid-ops"
+#define OQS_PROV_PARAM_STAT_KEM_CLASSICAL_NS  "oqs-kem-classical-ns"
+#define OQS_PROV_PARAM_STAT_KEM_QS_NS         "oqs-kem-qs-ns"
+#define OQS_PROV_PARAM_STAT_PARAM_COPY_BYTES  "oqs-param-copy-bytes"
+#define OQS_PROV_PARAM_STAT_PARAM_REF_BYTES   "oqs-param-ref-bytes"
+#define OQS_PROV_PARAM_STAT_SLAB_BYTES        "oqs-slab-bytes"
+#define OQS_PROV_PARAM_STAT_SLAB_IN_USE       "oqs-slab-in-use"
+#define OQS_PROV_PARAM_STAT_SLAB_CACHE_HITS   "oqs-slab-cache-hits"
+#define OQS_PROV_PARAM_STAT_ENCODE_COPY_BYTES "oqs-encode-copy-bytes"
+
+#ifdef OQS_PROVIDER_STATS
+typedef enum {
+    OQSX_STAT_KEM_HYB_OPS, OQSX_STAT_KEM_CLASSICAL_NS, OQSX_STAT_KEM_QS_NS,
+    OQSX_STAT_PARAM_COPY_BYTES, OQSX_STAT_PARAM_REF_BYTES,
+    OQSX_STAT_SLAB_BYTES, OQSX_STAT_SLAB_IN_USE, OQSX_STAT_SLAB_CACHE_HITS,
+    OQSX_STAT_ENCODE_COPY_BYTES,
+    OQSX_STAT_MAX
+} oqsx_stat_t;
+
+extern _Atomic uint64_t oqsx_stats[OQSX_STAT_MAX];
+uint64_t oqsx_stats_nsec(void);
+int oqsx_stats_get_params(OSSL_PARAM params[]);
+
+# define OQSX_STATS_ADD(stat, v) \
+    atomic_fetch_add_explicit(&oqsx_stats[stat], (v), memory_order_relaxed)
+# define OQSX_STATS_NSEC() oqsx_stats_nsec()
+#else
+# define OQSX_STATS_ADD(stat, v) ((void)(v))
+# define OQSX_STATS_NSEC() 0
+#endif
+
 /* Function prototypes */
 
 extern const OSSL_DISPATCH oqs_generic_kem_functions[];
 extern const OSSL_DISPATCH oqs_hybrid_kem_functions[];
 extern const OSSL_DISPATCH oqs_signature_functions[];
+extern const OSSL_DISPATCH oqs_pubkey_store_functions[];
 
 ///// OQS_TEMPLATE_FRAGMENT_ENDECODER_FUNCTIONS_START
 extern const OSSL_DISPATCH oqs_dilithium2_to_PrivateKeyInfo_der_encoder_functions[];
@@ -31,6 +31,9 @@
 #define OSSL_MAX_NAME_SIZE 50
 #define OSSL_MAX_PROPQUERY_SIZE     256 /* Property query strings */
 
+/* initial capacity of buffer collecting data to be signed without digest */
+#define OQS_SIG_MDDATA_MIN 1024
+
 #ifdef NDEBUG
 #define OQS_SIG_PRINTF(a)
 #define OQS_SIG_PRINTF2(a, b)
@@ -63,18 +66,6 @@ static OSSL_FUNC_signature_gettable_ctx_md_params_fn oqs_sig_gettable_ctx_md_par
 static OSSL_FUNC_signature_set_ctx_md_params_fn oqs_sig_set_ctx_md_params;
 static OSSL_FUNC_signature_settable_ctx_md_params_fn oqs_sig_settable_ctx_md_params;
 
-// OIDS:
-static int get_aid(unsigned char** oidbuf, const char *tls_name) {
-   X509_ALGOR *algor = X509_ALGOR_new();
-   int aidlen = 0;
-
-   X509_ALGOR_set0(algor, OBJ_txt2obj(tls_name, 0), V_ASN1_UNDEF, NULL);
-
-   aidlen = i2d_X509_ALGOR(algor, oidbuf); 
-   X509_ALGOR_free(algor);
-   return(aidlen);
-}
-
 /*
  * What's passed as an actual key is defined by the KEYMGMT interface.
  */
@@ -94,17 +85,17 @@ typedef struct {
 
     char mdname[OSSL_MAX_NAME_SIZE];
 
-    /* The Algorithm Identifier of the combined signature algorithm */
-    unsigned char *aid;
-    size_t  aid_len;
-
     /* main digest */
     EVP_MD *md;
     EVP_MD_CTX *mdctx;
     size_t mdsize;
-    // for collecting data if no MD is active:
+    // for collecting data if no MD is active; capacity kept across re-inits:
     unsigned char* mddata;
+    size_t mdalloc; // allocated size of mddata
+    // hybrids without MD: digest of classical component, updated while collecting
+    EVP_MD_CTX *classical_mdctx;
     int operation;
+    int parallel; // compute hybrid halves concurrently
 } PROV_OQSSIG_CTX;
 
 static void *oqs_sig_newctx(void *provctx, const char *propq)
@@ -118,6 +109,7 @@ static void *oqs_sig_newctx(void *provctx, const char *propq)
         return NULL;
 
     poqs_sigctx->libctx = ((PROV_OQS_CTX*)provctx)->libctx;
+    poqs_sigctx->parallel = ((PROV_OQS_CTX*)provctx)->hybrid_sig_parallel;
     if (propq != NULL && (poqs_sigctx->propq = OPENSSL_strdup(propq)) == NULL) {
         OPENSSL_free(poqs_sigctx);
         poqs_sigctx = NULL;
@@ -149,11 +141,6 @@ static int oqs_sig_setup_md(PROV_OQSSIG_CTX *ctx,
         EVP_MD_free(ctx->md);
 	ctx->md = NULL;
 
-        if (ctx->aid) 
-            OPENSSL_free(ctx->aid);
-        ctx->aid = NULL; // ensure next function allocates memory
-        ctx->aid_len = get_aid(&(ctx->aid), ctx->sig->tls_name);
-
         ctx->md = md;
         OPENSSL_strlcpy(ctx->mdname, mdname, sizeof(ctx->mdname));
     }
@@ -178,6 +165,12 @@ static int oqs_sig_signverify_init(void *vpoqs_sigctx, void *voqssig, int operat
         ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_KEY);
         return 0;
     }
+    // hybrid keys from public key stores decode their classic key on first use
+    if (poqs_sigctx->sig->numkeys == 2
+            && oqsx_key_get0_classical_pubkey(poqs_sigctx->sig) == NULL) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_KEY);
+        return 0;
+    }
     return 1;
 }
 
@@ -193,26 +186,163 @@ static int oqs_sig_verify_init(void *vpoqs_sigctx, void *voqssig, const OSSL_PAR
     return oqs_sig_signverify_init(vpoqs_sigctx, voqssig, EVP_PKEY_OP_VERIFY);
 }
 
+/* classical schemes can't sign arbitrarily large data; we hash it first */
+static const EVP_MD *oqs_sig_classical_md(int nist_level)
+{
+    switch (nist_level) {
+    case 1:
+      return EVP_sha256();
+    case 2:
+    case 3:
+      return EVP_sha384();
+    case 4:
+    case 5:
+    default:
+      return EVP_sha512();
+    }
+}
+
+/* Hybrid keys keep one initialized classical ctx per operation: it is taken
+ * from the key for the duration of a sign/verify call and handed back
+ * afterwards. Concurrent users of the same key set up a ctx of their own.
+ */
+static EVP_PKEY_CTX *oqs_sig_classical_ctx_get(OQSX_KEY *oqsxkey, int operation, int nist_level)
+{
+    _Atomic(EVP_PKEY_CTX *) *slot = operation == EVP_PKEY_OP_SIGN ?
+                                    &oqsxkey->classical_sign_ctx : &oqsxkey->classical_verify_ctx;
+    EVP_PKEY_CTX *ctx = atomic_exchange_explicit(slot, NULL, memory_order_acquire);
+
+    if (ctx != NULL)
+        return ctx;
+
+    if ((ctx = EVP_PKEY_CTX_new(oqsxkey->classical_pkey, NULL)) == NULL ||
+        (operation == EVP_PKEY_OP_SIGN ? EVP_PKEY_sign_init(ctx) : EVP_PKEY_verify_init(ctx)) <= 0 ||
+        (oqsxkey->evp_info->keytype == EVP_PKEY_RSA &&
+         EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+        EVP_PKEY_CTX_set_signature_md(ctx, oqs_sig_classical_md(nist_level)) <= 0) {
+      EVP_PKEY_CTX_free(ctx);
+      return NULL;
+    }
+    return ctx;
+}
+
+static void oqs_sig_classical_ctx_put(OQSX_KEY *oqsxkey, int operation, EVP_PKEY_CTX *ctx)
+{
+    _Atomic(EVP_PKEY_CTX *) *slot = operation == EVP_PKEY_OP_SIGN ?
+                                    &oqsxkey->classical_sign_ctx : &oqsxkey->classical_verify_ctx;
+    EVP_PKEY_CTX *expected = NULL;
+
+    if (ctx != NULL &&
+        !atomic_compare_exchange_strong_explicit(slot, &expected, ctx,
+                                                 memory_order_release,
+                                                 memory_order_relaxed))
+      EVP_PKEY_CTX_free(ctx);
+}
+
+/* The classical and the quantum-safe half of a hybrid signature are
+ * independent: with hybrid_sig_parallel set, they are computed on two
+ * threads of the provider's pool. Errors are reported by the caller after
+ * both halves are done, as the error queue is per thread.
+ */
+typedef struct {
+    OQSX_KEY *oqsxkey;
+    OQS_SIG *oqs_key;
+    const unsigned char *tbs;
+    size_t tbslen;
+    const unsigned char *classical_digest; // NULL: hash tbs first
+    EVP_PKEY_CTX *classical_ctx;
+    unsigned char *classical_sig;
+    size_t classical_siglen;
+    unsigned char *oqs_sig;
+    size_t oqs_siglen;
+    int parallel;
+    int classical_ok;
+    int oqs_ok;
+} OQSX_SIG_HALVES;
+
+#define OQSX_SIG_HALF_CLASSICAL 0
+#define OQSX_SIG_HALF_QS        1
+
+/* digest the classical half signs, if not computed while streaming */
+static const unsigned char *oqs_sig_classical_digest(OQSX_SIG_HALVES *h, unsigned char *digest)
+{
+    const EVP_MD *classical_md = oqs_sig_classical_md(h->oqs_key->claimed_nist_level);
+
+    if (h->classical_digest != NULL)
+        return h->classical_digest;
+    if (!EVP_Digest(h->tbs, h->tbslen, digest, NULL, classical_md, NULL))
+        return NULL;
+    return digest;
+}
+
+static void oqs_sig_sign_half(void *vh, size_t half)
+{
+    OQSX_SIG_HALVES *h = vh;
+
+    if (h->parallel)
+        ERR_set_mark(); // caller raises errors, on its own thread
+    if (half == OQSX_SIG_HALF_CLASSICAL) {
+        /* unconditionally hash to be in line with oqs-openssl111:
+         * signing a pre-performed hash (mdctx != NULL) would skip the digest
+         */
+        unsigned char digest[SHA512_DIGEST_LENGTH]; /* init with max length */
+        int digest_len = EVP_MD_get_size(oqs_sig_classical_md(h->oqs_key->claimed_nist_level));
+        const unsigned char *tbd = oqs_sig_classical_digest(h, digest);
+
+        h->classical_ok = tbd != NULL
+                          && EVP_PKEY_sign(h->classical_ctx, h->classical_sig, &h->classical_siglen,
+                                           tbd, digest_len) > 0;
+    } else {
+        h->oqs_ok = OQS_SIG_sign(h->oqs_key, h->oqs_sig, &h->oqs_siglen, h->tbs, h->tbslen,
+                                 h->oqsxkey->comp_privkey[h->oqsxkey->numkeys-1]) == OQS_SUCCESS;
+    }
+    if (h->parallel)
+        ERR_pop_to_mark();
+}
+
+static void oqs_sig_verify_half(void *vh, size_t half)
+{
+    OQSX_SIG_HALVES *h = vh;
+
+    if (h->parallel)
+        ERR_set_mark();
+    if (half == OQSX_SIG_HALF_CLASSICAL) {
+        unsigned char digest[SHA512_DIGEST_LENGTH]; /* init with max length */
+        int digest_len = EVP_MD_get_size(oqs_sig_classical_md(h->oqs_key->claimed_nist_level));
+        const unsigned char *tbd = oqs_sig_classical_digest(h, digest);
+
+        h->classical_ok = tbd != NULL
+                          && EVP_PKEY_verify(h->classical_ctx, h->classical_sig, h->classical_siglen,
+                                             tbd, digest_len) > 0;
+    } else {
+        h->oqs_ok = OQS_SIG_verify(h->oqs_key, h->tbs, h->tbslen, h->oqs_sig, h->oqs_siglen,
+                                   h->oqsxkey->comp_pubkey[h->oqsxkey->numkeys-1]) == OQS_SUCCESS;
+    }
+    if (h->parallel)
+        ERR_pop_to_mark();
+}
+
 /* On entry to this function, data to be signed (tbs) might have been hashed already:
  * this would be the case if poqs_sigctx->mdctx != NULL; if that is NULL, we have to hash
- * in case of hybrid signatures
+ * in case of hybrid signatures, unless the classical digest has been computed while
+ * streaming the data (classical_digest != NULL)
  */
-static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
-                    size_t sigsize, const unsigned char *tbs, size_t tbslen)
+static int oqs_sig_sign_ex(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
+                    size_t sigsize, const unsigned char *tbs, size_t tbslen,
+                    const unsigned char *classical_digest)
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
     OQSX_KEY* oqsxkey = poqs_sigctx->sig;
     OQS_SIG*  oqs_key = poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig;
     EVP_PKEY* evpkey = oqsxkey->classical_pkey; // if this value is not NULL, we're running hybrid
-    EVP_PKEY_CTX *classical_ctx_sign = NULL;
+    OQSX_SIG_HALVES h = { oqsxkey, oqs_key, tbs, tbslen, classical_digest };
 
     OQS_SIG_PRINTF2("OQS SIG provider: sign called for %ld bytes\n", tbslen);
 
     int is_hybrid = evpkey!=NULL;
     size_t max_sig_len = oqs_key->length_signature;
-    size_t classical_sig_len = 0, oqs_sig_len = 0;
-    size_t actual_classical_sig_len = 0;
-    size_t index = 0;
+    size_t classical_sig_len = 0;
+    size_t max_classical_sig_len = 0;
     int rv = 0;
 
     if (!oqsxkey || !oqs_key || !oqsxkey->privkey) {
@@ -220,8 +350,8 @@ static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
       return rv;
     }
     if (is_hybrid) {
-      actual_classical_sig_len = oqsxkey->evp_info->length_signature;
-      max_sig_len += (SIZE_OF_UINT32 + actual_classical_sig_len);
+      max_classical_sig_len = oqsxkey->evp_info->length_signature;
+      max_sig_len += (SIZE_OF_UINT32 + max_classical_sig_len);
     }
 
     if (sig == NULL) {
@@ -234,99 +364,78 @@ static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
         return rv;
     }
 
-    if (is_hybrid) {
-        if ((classical_ctx_sign = EVP_PKEY_CTX_new(evpkey, NULL)) == NULL ||
-            EVP_PKEY_sign_init(classical_ctx_sign) <= 0) {
+    if (!is_hybrid) {
+      h.oqs_sig = sig;
+      oqs_sig_sign_half(&h, OQSX_SIG_HALF_QS);
+    } else {
+      if ((h.classical_ctx = oqs_sig_classical_ctx_get(oqsxkey, EVP_PKEY_OP_SIGN, oqs_key->claimed_nist_level)) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_FATAL);
+        goto endsign;
+      }
+      h.classical_sig = sig + SIZE_OF_UINT32;
+      h.classical_siglen = max_classical_sig_len;
+      if ((h.parallel = poqs_sigctx->parallel)) {
+        // classical length not known yet: QS half moved into place below
+        h.oqs_sig = sig + SIZE_OF_UINT32 + max_classical_sig_len;
+        if (!oqsx_parallel_for(2, 2, oqs_sig_sign_half, &h)) {
           ERR_raise(ERR_LIB_USER, ERR_R_FATAL);
           goto endsign;
         }
-        if (oqsxkey->evp_info->keytype == EVP_PKEY_RSA) {
-            if (EVP_PKEY_CTX_set_rsa_padding(classical_ctx_sign, RSA_PKCS1_PADDING) <= 0) {
-               ERR_raise(ERR_LIB_USER, ERR_R_FATAL);
-               goto endsign;
-            }
-        }
-
-	/* unconditionally hash to be in line with oqs-openssl111:
-         * uncomment the following line if using pre-performed hash:
-	 * if (poqs_sigctx->mdctx == NULL) { // hashing not yet done
-         */
-          const EVP_MD *classical_md;
-          int digest_len;
-          unsigned char digest[SHA512_DIGEST_LENGTH]; /* init with max length */
-
-          /* classical schemes can't sign arbitrarily large data; we hash it first */
-          switch (oqs_key->claimed_nist_level) {
-          case 1:
-            classical_md = EVP_sha256();
-            digest_len = SHA256_DIGEST_LENGTH;
-            SHA256(tbs, tbslen, (unsigned char*) &digest);
-            break;
-          case 2:
-          case 3:
-            classical_md = EVP_sha384();
-            digest_len = SHA384_DIGEST_LENGTH;
-            SHA384(tbs, tbslen, (unsigned char*) &digest);
-            break;
-          case 4:
-          case 5:
-          default:
-            classical_md = EVP_sha512();
-            digest_len = SHA512_DIGEST_LENGTH;
-            SHA512(tbs, tbslen, (unsigned char*) &digest);
-            break;
-          }
-          if ((EVP_PKEY_CTX_set_signature_md(classical_ctx_sign, classical_md) <= 0) ||
-              (EVP_PKEY_sign(classical_ctx_sign, sig + SIZE_OF_UINT32, &actual_classical_sig_len, digest, digest_len) <= 0)) {
-            ERR_raise(ERR_LIB_USER, ERR_R_FATAL);
-            goto endsign;
-          }
-      /* activate in case we want to use pre-performed hashes:
-       * }
-       * else { // hashing done before; just sign:
-       *     if (EVP_PKEY_sign(classical_ctx_sign, sig + SIZE_OF_UINT32, &actual_classical_sig_len, tbs, tbslen) <= 0) {
-       *       ERR_raise(ERR_LIB_USER, OQSPROV_R_SIGNING_FAILED);
-       *       goto endsign;
-       *     }
-       *  }
-       */
-      if (actual_classical_sig_len > oqsxkey->evp_info->length_signature) {
+      } else {
+        oqs_sig_sign_half(&h, OQSX_SIG_HALF_CLASSICAL);
+        h.oqs_sig = sig + SIZE_OF_UINT32 + h.classical_siglen;
+        if (h.classical_ok)
+          oqs_sig_sign_half(&h, OQSX_SIG_HALF_QS);
+      }
+      if (!h.classical_ok) {
+        EVP_PKEY_CTX_free(h.classical_ctx); // state unknown: don't reuse
+        h.classical_ctx = NULL;
+        ERR_raise(ERR_LIB_USER, ERR_R_FATAL);
+        goto endsign;
+      }
+      if (h.classical_siglen > max_classical_sig_len) {
         /* sig is bigger than expected */
         ERR_raise(ERR_LIB_USER, OQSPROV_R_BUFFER_LENGTH_WRONG);
         goto endsign;
       }
-      ENCODE_UINT32(sig, actual_classical_sig_len);
-      classical_sig_len = SIZE_OF_UINT32 + actual_classical_sig_len;
-      index += classical_sig_len;
+      ENCODE_UINT32(sig, h.classical_siglen);
+      classical_sig_len = SIZE_OF_UINT32 + h.classical_siglen;
+      if (h.oqs_ok && h.oqs_sig != sig + classical_sig_len)
+        memmove(sig + classical_sig_len, h.oqs_sig, h.oqs_siglen);
     }
 
-    if (OQS_SIG_sign(oqs_key, sig + index, &oqs_sig_len, tbs, tbslen, oqsxkey->comp_privkey[oqsxkey->numkeys-1]) != OQS_SUCCESS) {
+    if (!h.oqs_ok) {
       ERR_raise(ERR_LIB_USER, OQSPROV_R_SIGNING_FAILED);
       goto endsign;
     }
-    *siglen = classical_sig_len + oqs_sig_len;
+    *siglen = classical_sig_len + h.oqs_siglen;
     OQS_SIG_PRINTF2("OQS SIG provider: signing completes with size %ld\n", *siglen);
     rv = 1; /* success */
 
  endsign:
-    if (classical_ctx_sign) {
-      EVP_PKEY_CTX_free(classical_ctx_sign);
+    if (h.classical_ctx) {
+      oqs_sig_classical_ctx_put(oqsxkey, EVP_PKEY_OP_SIGN, h.classical_ctx);
     }
     return rv;
 }
 
-static int oqs_sig_verify(void *vpoqs_sigctx, const unsigned char *sig, size_t siglen,
-                      const unsigned char *tbs, size_t tbslen)
+static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
+                    size_t sigsize, const unsigned char *tbs, size_t tbslen)
+{
+    return oqs_sig_sign_ex(vpoqs_sigctx, sig, siglen, sigsize, tbs, tbslen, NULL);
+}
+
+static int oqs_sig_verify_ex(void *vpoqs_sigctx, const unsigned char *sig, size_t siglen,
+                      const unsigned char *tbs, size_t tbslen,
+                      const unsigned char *classical_digest)
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
     OQSX_KEY* oqsxkey = poqs_sigctx->sig;
     OQS_SIG*  oqs_key = poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig;
     EVP_PKEY* evpkey = oqsxkey->classical_pkey; // if this value is not NULL, we're running hybrid
-    EVP_PKEY_CTX *classical_ctx_sign = NULL;
-    EVP_PKEY_CTX *ctx_verify = NULL;
+    OQSX_SIG_HALVES h = { oqsxkey, oqs_key, tbs, tbslen, classical_digest };
     int is_hybrid = evpkey!=NULL;
     size_t classical_sig_len = 0;
-    size_t index = 0;
     int rv = 0;
 
     OQS_SIG_PRINTF3("OQS SIG provider: verify called with siglen %ld bytes and tbslen %ld\n", siglen, tbslen);
@@ -335,85 +444,63 @@ static int oqs_sig_verify(void *vpoqs_sigctx, const unsigned char *sig, size_t s
       ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
       goto endverify;
     }
+    if (!oqsxkey->comp_pubkey[oqsxkey->numkeys-1]) {
+      ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
+      goto endverify;
+    }
 
     if (is_hybrid) {
-      const EVP_MD *classical_md;
-      size_t actual_classical_sig_len = 0;
-      int digest_len;
-      unsigned char digest[SHA512_DIGEST_LENGTH]; /* init with max length */
-
-      if ((ctx_verify = EVP_PKEY_CTX_new(oqsxkey->classical_pkey, NULL)) == NULL ||
-          EVP_PKEY_verify_init(ctx_verify) <= 0) {
+      if (siglen < SIZE_OF_UINT32) {
         ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
         goto endverify;
       }
-      if (oqsxkey->evp_info->keytype == EVP_PKEY_RSA) {
-        if (EVP_PKEY_CTX_set_rsa_padding(ctx_verify, RSA_PKCS1_PADDING) <= 0) {
-          ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
-          goto endverify;
-        }
-      }
-      DECODE_UINT32(actual_classical_sig_len, sig);
-
-      /* same as with sign: activate if pre-existing hashing to be used:
-       *  if (poqs_sigctx->mdctx == NULL) { // hashing not yet done
-       */
-      switch (oqs_key->claimed_nist_level) {
-      case 1:
-        classical_md = EVP_sha256();
-        digest_len = SHA256_DIGEST_LENGTH;
-        SHA256(tbs, tbslen, (unsigned char*) &digest);
-        break;
-      case 2:
-      case 3:
-        classical_md = EVP_sha384();
-        digest_len = SHA384_DIGEST_LENGTH;
-        SHA384(tbs, tbslen, (unsigned char*) &digest);
-        break;
-      case 4:
-      case 5:
-      default:
-        classical_md = EVP_sha512();
-        digest_len = SHA512_DIGEST_LENGTH;
-        SHA512(tbs, tbslen, (unsigned char*) &digest);
-        break;
+      DECODE_UINT32(h.classical_siglen, sig);
+      if (h.classical_siglen > siglen - SIZE_OF_UINT32) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
+        goto endverify;
       }
-      if ((EVP_PKEY_CTX_set_signature_md(ctx_verify, classical_md) <= 0) ||
-          (EVP_PKEY_verify(ctx_verify, sig + SIZE_OF_UINT32, actual_classical_sig_len, digest, digest_len) <= 0)) {
+      if ((h.classical_ctx = oqs_sig_classical_ctx_get(oqsxkey, EVP_PKEY_OP_VERIFY, oqs_key->claimed_nist_level)) == NULL) {
         ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
         goto endverify;
       }
-     /* activate for using pre-existing digest:
-      * }
-      *  else { // hashing already done:
-      *     if (EVP_PKEY_verify(ctx_verify, sig + SIZE_OF_UINT32, actual_classical_sig_len, tbs, tbslen) <= 0) {
-      *       ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
-      *       goto endverify;
-      *     }
-      *  }
-      */
-      classical_sig_len = SIZE_OF_UINT32 + actual_classical_sig_len;
-      index += classical_sig_len;
+      h.classical_sig = (unsigned char *)sig + SIZE_OF_UINT32;
+      classical_sig_len = SIZE_OF_UINT32 + h.classical_siglen;
     }
+    h.oqs_sig = (unsigned char *)sig + classical_sig_len;
+    h.oqs_siglen = siglen - classical_sig_len;
 
-    if (!oqsxkey->comp_pubkey[oqsxkey->numkeys-1]) {
-      ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
-      goto endverify;
+    if (!is_hybrid) {
+      oqs_sig_verify_half(&h, OQSX_SIG_HALF_QS);
+    } else if ((h.parallel = poqs_sigctx->parallel)) {
+      if (!oqsx_parallel_for(2, 2, oqs_sig_verify_half, &h)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
+        goto endverify;
+      }
+    } else {
+      oqs_sig_verify_half(&h, OQSX_SIG_HALF_CLASSICAL);
+      if (h.classical_ok)
+        oqs_sig_verify_half(&h, OQSX_SIG_HALF_QS);
     }
-    if (OQS_SIG_verify(oqs_key, tbs, tbslen, sig + index, siglen - classical_sig_len, oqsxkey->comp_pubkey[oqsxkey->numkeys-1]) != OQS_SUCCESS) {
+    if ((is_hybrid && !h.classical_ok) || !h.oqs_ok) {
       ERR_raise(ERR_LIB_USER, OQSPROV_R_VERIFY_ERROR);
       goto endverify;
     }
     rv = 1;
 
  endverify:
-    if (ctx_verify) {
-      EVP_PKEY_CTX_free(ctx_verify);
+    if (h.classical_ctx) {
+      oqs_sig_classical_ctx_put(oqsxkey, EVP_PKEY_OP_VERIFY, h.classical_ctx);
     }
     OQS_SIG_PRINTF2("OQS SIG provider: verify rv = %d\n", rv);
     return rv;
 }
 
+static int oqs_sig_verify(void *vpoqs_sigctx, const unsigned char *sig, size_t siglen,
+                      const unsigned char *tbs, size_t tbslen)
+{
+    return oqs_sig_verify_ex(vpoqs_sigctx, sig, siglen, tbs, tbslen, NULL);
+}
+
 static int oqs_sig_digest_signverify_init(void *vpoqs_sigctx, const char *mdname,
                                       void *voqssig, int operation)
 {
@@ -436,6 +523,24 @@ static int oqs_sig_digest_signverify_init(void *vpoqs_sigctx, const char *mdname
        if (!EVP_DigestInit_ex(poqs_sigctx->mdctx, poqs_sigctx->md, NULL))
            goto error;
     }
+    else if (poqs_sigctx->sig->classical_pkey != NULL) {
+       const OQS_SIG *oqs_key = poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig;
+
+       if (poqs_sigctx->classical_mdctx == NULL
+           && (poqs_sigctx->classical_mdctx = EVP_MD_CTX_new()) == NULL)
+           goto error;
+
+       if (!EVP_DigestInit_ex(poqs_sigctx->classical_mdctx, oqs_sig_classical_md(oqs_key->claimed_nist_level), NULL))
+           goto error;
+    }
+    else {
+       EVP_MD_CTX_free(poqs_sigctx->classical_mdctx);
+       poqs_sigctx->classical_mdctx = NULL;
+    }
+    // keep buffer for reuse, but not its contents
+    if (poqs_sigctx->mddata != NULL)
+        OPENSSL_cleanse(poqs_sigctx->mddata, poqs_sigctx->mdsize);
+    poqs_sigctx->mdsize = 0;
 
     return 1;
 
@@ -476,20 +581,25 @@ int oqs_sig_digest_signverify_update(void *vpoqs_sigctx, const unsigned char *da
     if (poqs_sigctx->mdctx) 
     	return EVP_DigestUpdate(poqs_sigctx->mdctx, data, datalen);
     else {
-    // unconditionally collect data for passing in full to OQS API
-      if (poqs_sigctx->mddata) {
-	unsigned char* newdata = OPENSSL_realloc(poqs_sigctx->mddata, poqs_sigctx->mdsize+datalen);
+      // classical half of hybrids only needs the digest:
+      if (poqs_sigctx->classical_mdctx
+          && !EVP_DigestUpdate(poqs_sigctx->classical_mdctx, data, datalen))
+        return 0;
+      // unconditionally collect data for passing in full to OQS API;
+      // grow geometrically to keep realloc traffic linear in total size
+      if (poqs_sigctx->mdsize + datalen > poqs_sigctx->mdalloc) {
+	size_t newalloc = poqs_sigctx->mdalloc ? poqs_sigctx->mdalloc * 2 : OQS_SIG_MDDATA_MIN;
+	unsigned char* newdata;
+
+	if (newalloc < poqs_sigctx->mdsize + datalen)
+	  newalloc = poqs_sigctx->mdsize + datalen;
+	newdata = OPENSSL_clear_realloc(poqs_sigctx->mddata, poqs_sigctx->mdalloc, newalloc);
 	if (newdata == NULL) return 0;
-	memcpy(newdata+poqs_sigctx->mdsize, data, datalen);
 	poqs_sigctx->mddata = newdata;
-	poqs_sigctx->mdsize += datalen;
-      }
-      else { // simple alloc and copy
-	poqs_sigctx->mddata = OPENSSL_malloc(datalen);
-	if (poqs_sigctx->mddata == NULL) return 0;
-	poqs_sigctx->mdsize=datalen;
-	memcpy(poqs_sigctx->mddata, data, poqs_sigctx->mdsize);
+	poqs_sigctx->mdalloc = newalloc;
       }
+      memcpy(poqs_sigctx->mddata+poqs_sigctx->mdsize, data, datalen);
+      poqs_sigctx->mdsize += datalen;
       OQS_SIG_PRINTF2("OQS SIG provider: digest_signverify_update collected %ld bytes...\n", poqs_sigctx->mdsize);
     }
     return 1;
@@ -525,6 +635,11 @@ int oqs_sig_digest_sign_final(void *vpoqs_sigctx, unsigned char *sig, size_t *si
 
     if (poqs_sigctx->mdctx != NULL) 
 	return oqs_sig_sign(vpoqs_sigctx, sig, siglen, sigsize, digest, (size_t)dlen);
+    else if (sig != NULL && poqs_sigctx->classical_mdctx != NULL) {
+	if (!EVP_DigestFinal_ex(poqs_sigctx->classical_mdctx, digest, &dlen))
+		return 0;
+	return oqs_sig_sign_ex(vpoqs_sigctx, sig, siglen, sigsize, poqs_sigctx->mddata, poqs_sigctx->mdsize, digest);
+    }
     else
 	return oqs_sig_sign(vpoqs_sigctx, sig, siglen, sigsize, poqs_sigctx->mddata, poqs_sigctx->mdsize);
 	
@@ -551,6 +666,12 @@ int oqs_sig_digest_verify_final(void *vpoqs_sigctx, const unsigned char *sig,
 
     	return oqs_sig_verify(vpoqs_sigctx, sig, siglen, digest, (size_t)dlen);
     }
+    else if (poqs_sigctx->classical_mdctx) {
+	if (!EVP_DigestFinal_ex(poqs_sigctx->classical_mdctx, digest, &dlen))
+        	return 0;
+
+    	return oqs_sig_verify_ex(vpoqs_sigctx, sig, siglen, poqs_sigctx->mddata, poqs_sigctx->mdsize, digest);
+    }
     else 
     	return oqs_sig_verify(vpoqs_sigctx, sig, siglen, poqs_sigctx->mddata, poqs_sigctx->mdsize);
 }
@@ -567,12 +688,12 @@ static void oqs_sig_freectx(void *vpoqs_sigctx)
     ctx->mdctx = NULL;
     ctx->md = NULL;
     oqsx_key_free(ctx->sig);
-    OPENSSL_free(ctx->mddata);
+    EVP_MD_CTX_free(ctx->classical_mdctx);
+    ctx->classical_mdctx = NULL;
+    OPENSSL_clear_free(ctx->mddata, ctx->mdalloc);
     ctx->mddata = NULL;
     ctx->mdsize = 0;
-    OPENSSL_free(ctx->aid);
-    ctx->aid = NULL;
-    ctx->aid_len = 0;
+    ctx->mdalloc = 0;
     OPENSSL_free(ctx);
 }
 
@@ -591,6 +712,10 @@ static void *oqs_sig_dupctx(void *vpoqs_sigctx)
     dstctx->sig = NULL;
     dstctx->md = NULL;
     dstctx->mdctx = NULL;
+    dstctx->classical_mdctx = NULL;
+    dstctx->mddata = NULL;
+    dstctx->mdalloc = 0;
+    dstctx->propq = NULL;
 
     if (srcctx->sig != NULL && !oqsx_key_up_ref(srcctx->sig))
         goto err;
@@ -607,18 +732,18 @@ static void *oqs_sig_dupctx(void *vpoqs_sigctx)
             goto err;
     }
 
-    if (srcctx->mddata) {
-	dstctx->mddata=OPENSSL_memdup(srcctx->mddata, srcctx->mdsize);
-	if (dstctx->mddata == NULL)
+    if (srcctx->classical_mdctx != NULL) {
+        dstctx->classical_mdctx = EVP_MD_CTX_new();
+        if (dstctx->classical_mdctx == NULL
+                || !EVP_MD_CTX_copy_ex(dstctx->classical_mdctx, srcctx->classical_mdctx))
             goto err;
-	dstctx->mdsize = srcctx->mdsize;
     }
 
-    if (srcctx->aid) {
-      dstctx->aid = OPENSSL_memdup(srcctx->aid, srcctx->aid_len);
-      if (dstctx->aid == NULL)
-        goto err;
-      dstctx->aid_len = srcctx->aid_len;
+    if (srcctx->mddata && srcctx->mdsize > 0) {
+	dstctx->mddata=OPENSSL_memdup(srcctx->mddata, srcctx->mdsize);
+	if (dstctx->mddata == NULL)
+            goto err;
+	dstctx->mdalloc = srcctx->mdsize;
     }
 
     if (srcctx->propq) {
@@ -637,6 +762,8 @@ static int oqs_sig_get_ctx_params(void *vpoqs_sigctx, OSSL_PARAM *params)
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
     OSSL_PARAM *p;
+    const unsigned char *aid;
+    size_t aid_len;
 
     OQS_SIG_PRINTF("OQS SIG provider: get_ctx_params called\n");
     if (poqs_sigctx == NULL || params == NULL)
@@ -644,12 +771,11 @@ static int oqs_sig_get_ctx_params(void *vpoqs_sigctx, OSSL_PARAM *params)
 
     p = OSSL_PARAM_locate(params, OSSL_SIGNATURE_PARAM_ALGORITHM_ID);
 
-    if (poqs_sigctx->aid == NULL) {
-        poqs_sigctx->aid_len = get_aid(&(poqs_sigctx->aid), poqs_sigctx->sig->tls_name);
-    }
-
+    // The Algorithm Identifier of the combined signature algorithm
     if (p != NULL
-        && !OSSL_PARAM_set_octet_string(p, poqs_sigctx->aid, poqs_sigctx->aid_len))
+        && (poqs_sigctx->sig == NULL
+            || (aid = oqsx_get_aid(poqs_sigctx->sig->tls_name, &aid_len)) == NULL
+            || !OSSL_PARAM_set_octet_string(p, aid, aid_len)))
         return 0;
 
     p = OSSL_PARAM_locate(params, OSSL_SIGNATURE_PARAM_DIGEST);
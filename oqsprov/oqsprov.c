@@ -7,6 +7,9 @@
  *
  */
 
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <openssl/core.h>
@@ -16,7 +19,11 @@
 #include <openssl/objects.h>
 #include <openssl/err.h>
 #include <openssl/provider.h>
+#ifdef __APPLE__
+# include <crt_externs.h>
+#endif
 #include "oqs_prov.h"
+#include "oqsprovider.h"
 
 #ifdef NDEBUG
 #define OQS_PROV_PRINTF(a)
@@ -220,6 +227,142 @@ int oqs_patch_encodings(void) {
 /* Functions provided by the core */
 static OSSL_FUNC_core_gettable_params_fn *c_gettable_params = NULL;
 static OSSL_FUNC_core_get_params_fn *c_get_params = NULL;
+static OSSL_FUNC_core_obj_create_fn *c_obj_create = NULL;
+static OSSL_FUNC_core_obj_add_sigid_fn *c_obj_add_sigid = NULL;
+
+/* provider configuration option, NULL if not set */
+static const char *oqs_prov_conf_str(const OSSL_CORE_HANDLE *handle, const char *name)
+{
+    char *val = NULL;
+    OSSL_PARAM params[2] = { OSSL_PARAM_utf8_ptr(name, &val, 0), OSSL_PARAM_END };
+
+    if (c_get_params == NULL || !c_get_params(handle, params))
+        return NULL;
+    return val;
+}
+
+/* boolean provider configuration option: 1, yes, on or true enable it */
+static int oqs_prov_conf_flag(const OSSL_CORE_HANDLE *handle, const char *name)
+{
+    const char *val = oqs_prov_conf_str(handle, name);
+
+    if (val == NULL)
+        return 0;
+    return !strcmp(val, "1") || !strcmp(val, "yes") || !strcmp(val, "on")
+           || !strcmp(val, "true");
+}
+
+/*
+ * numeric provider configuration option: *val is left alone if the option is
+ * absent, anything but a decimal number in [min, max] is an error
+ */
+static int oqs_prov_conf_size(const OSSL_CORE_HANDLE *handle, const char *name,
+                              size_t min, size_t max, size_t *val)
+{
+    const char *str = oqs_prov_conf_str(handle, name);
+    unsigned long long v;
+    char *end;
+
+    if (str == NULL)
+        return 1;
+    errno = 0;
+    v = strtoull(str, &end, 10);
+    if (end == str || *end != '\0' || *str == '-' || errno == ERANGE
+        || v < min || v > max) {
+        ERR_raise_data(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS,
+                       "%s = %s, expected %zu to %zu", name, str, min, max);
+        return 0;
+    }
+    *val = (size_t)v;
+    return 1;
+}
+
+/* kinds of OQS_* variables found in the environment */
+#define OQS_ENV_CODEPOINTS 0x1
+#define OQS_ENV_OIDS       0x2
+#define OQS_ENV_ENCODINGS  0x4
+
+#ifdef __APPLE__
+/* shared libraries can't link against environ on macOS */
+# define environ (*_NSGetEnviron())
+#else
+extern char **environ;
+#endif
+
+/*
+ * One pass over the environment, instead of a getenv call per algorithm and
+ * setting: the oqs_patch_* functions only run if there is anything to patch.
+ */
+static int oqs_prov_env_overrides(void)
+{
+    char **e;
+    int found = 0;
+
+    for (e = environ; e != NULL && *e != NULL; e++) {
+        if (strncmp(*e, "OQS_", 4))
+            continue;
+        if (!strncmp(*e + 4, "CODEPOINT_", 10))
+            found |= OQS_ENV_CODEPOINTS;
+        else if (!strncmp(*e + 4, "OID_", 4))
+            found |= OQS_ENV_OIDS;
+        else if (!strncmp(*e + 4, "ENCODING_", 9))
+            found |= OQS_ENV_ENCODINGS;
+    }
+    return found;
+}
+
+/*
+ * The signature algorithm objects are global: they are registered once per
+ * process, when the provider is first loaded or, with lazy_init, once an
+ * operation is first queried.
+ */
+static pthread_mutex_t oqs_objects_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int oqs_objects_done = 0;
+
+static int oqs_objects_register(const OSSL_CORE_HANDLE *handle, int env)
+{
+    int i, ok = 1;
+
+    pthread_mutex_lock(&oqs_objects_lock);
+    if (oqs_objects_done)
+        goto end;
+
+    ok = !(env & OQS_ENV_OIDS) || oqs_patch_oids();
+#ifdef USE_ENCODING_LIB
+    ok = ok && (!(env & OQS_ENV_ENCODINGS) || oqs_patch_encodings());
+#endif
+    if (!ok)
+        goto end;
+
+    // insert all OIDs to the global objects list
+    for (i=0; i<OQS_OID_CNT;i+=2) {
+	if (!c_obj_create(handle, oqs_oid_alg_list[i], oqs_oid_alg_list[i+1], oqs_oid_alg_list[i+1]))
+                ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
+
+	if (!oqs_set_nid((char*)oqs_oid_alg_list[i+1], OBJ_sn2nid(oqs_oid_alg_list[i+1])))
+              ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
+
+	if (!c_obj_add_sigid(handle, oqs_oid_alg_list[i+1], "", oqs_oid_alg_list[i+1])) {
+              OQS_PROV_PRINTF2("error registering %s with no hash\n", oqs_oid_alg_list[i+1]);
+              ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
+	}
+
+        OQS_PROV_PRINTF3("OQS PROV: successfully registered %s with NID %d\n", oqs_oid_alg_list[i+1], OBJ_sn2nid(oqs_oid_alg_list[i+1]));
+    }
+    oqsx_nid_index_init();
+    atomic_store_explicit(&oqs_objects_done, 1, memory_order_release);
+
+ end:
+    pthread_mutex_unlock(&oqs_objects_lock);
+    return ok;
+}
+
+int oqsx_objects_init(const PROV_OQS_CTX *provctx)
+{
+    if (atomic_load_explicit(&oqs_objects_done, memory_order_acquire))
+        return 1;
+    return oqs_objects_register(provctx->handle, oqs_prov_env_overrides());
+}
 
 /* Parameters we provide to the core */
 static const OSSL_PARAM oqsprovider_param_types[] = {
@@ -227,6 +370,21 @@ static const OSSL_PARAM oqsprovider_param_types[] = {
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_VERSION, OSSL_PARAM_UTF8_PTR, NULL, 0),
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_BUILDINFO, OSSL_PARAM_UTF8_PTR, NULL, 0),
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_STATUS, OSSL_PARAM_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_KEM_KEYPOOL_HITS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_KEM_KEYPOOL_REFILLS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_SPKI_CACHE_HITS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_SPKI_CACHE_MISSES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+#ifdef OQS_PROVIDER_STATS
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_KEM_HYB_OPS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_KEM_CLASSICAL_NS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_KEM_QS_NS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_PARAM_COPY_BYTES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_PARAM_REF_BYTES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_SLAB_BYTES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_SLAB_IN_USE, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_SLAB_CACHE_HITS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_STAT_ENCODE_COPY_BYTES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+#endif
     OSSL_PARAM_END
 };
 
@@ -493,6 +651,12 @@ static const OSSL_ALGORITHM oqsprovider_decoder[] = {
 #undef DECODER_PROVIDER
 };
 
+/* memory-mapped public key stores, see oqsprov_pubstore.c */
+static const OSSL_ALGORITHM oqsprovider_store[] = {
+    ALG(OQSPROV_PUBKEY_STORE_SCHEME, oqs_pubkey_store_functions),
+    { NULL, NULL, NULL }
+};
+
 
 static const OSSL_PARAM *oqsprovider_gettable_params(void *provctx)
 {
@@ -524,6 +688,13 @@ static int oqsprovider_get_params(void *provctx, OSSL_PARAM params[])
     p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
     if (p != NULL && !OSSL_PARAM_set_int(p, 1)) // provider is always running
         return 0;
+    if (!oqsx_keypools_get_params(provctx, params)
+        || !oqsx_keycache_get_params(provctx, params))
+        return 0;
+#ifdef OQS_PROVIDER_STATS
+    if (!oqsx_stats_get_params(params))
+        return 0;
+#endif
     return 1;
 }
 
@@ -532,6 +703,10 @@ static const OSSL_ALGORITHM *oqsprovider_query(void *provctx, int operation_id,
 {
     *no_cache = 0;
 
+    // with lazy_init, algorithm objects are registered here first
+    if (!oqsx_objects_init(provctx))
+        return NULL;
+
     switch (operation_id) {
     case OSSL_OP_SIGNATURE:
         return oqsprovider_signatures;
@@ -543,6 +718,8 @@ static const OSSL_ALGORITHM *oqsprovider_query(void *provctx, int operation_id,
         return oqsprovider_encoder;
     case OSSL_OP_DECODER:
         return oqsprovider_decoder;
+    case OSSL_OP_STORE:
+        return oqsprovider_store;
     default:
         if (getenv("OQSPROV")) printf("Unknown operation %d requested from OQS provider\n", operation_id);
     }
@@ -565,35 +742,34 @@ static const OSSL_DISPATCH oqsprovider_dispatch_table[] = {
     { 0, NULL }
 };
 
+PROV_OQS_CTX *oqsx_provctx_of(const OSSL_PROVIDER *prov)
+{
+    if (prov == NULL || OSSL_PROVIDER_get0_dispatch(prov) != oqsprovider_dispatch_table)
+        return NULL;
+    return OSSL_PROVIDER_get0_provider_ctx(prov);
+}
+
 int OSSL_provider_init(const OSSL_CORE_HANDLE *handle,
                        const OSSL_DISPATCH *in,
                        const OSSL_DISPATCH **out,
                        void **provctx)
 {
     const OSSL_DISPATCH *orig_in=in;
-    OSSL_FUNC_core_obj_create_fn *c_obj_create= NULL;
-
-    OSSL_FUNC_core_obj_add_sigid_fn *c_obj_add_sigid= NULL;
     BIO_METHOD *corebiometh;
     OSSL_LIB_CTX *libctx = NULL;
-    int i, rc = 0;
+    size_t depth = 0, cachesize = 0;
+    int env, rc = 0;
 
     OQS_init();
 
     if (!oqs_prov_bio_from_dispatch(in))
         return 0;
 
-    if (!oqs_patch_codepoints())
-        return 0;
-
-    if (!oqs_patch_oids())
+    // TLS group capabilities are queried right away: codepoints can't wait
+    env = oqs_prov_env_overrides();
+    if ((env & OQS_ENV_CODEPOINTS) && !oqs_patch_codepoints())
         return 0;
 
-#ifdef USE_ENCODING_LIB
-    if (!oqs_patch_encodings())
-        return 0;
-#endif
-
     for (; in->function_id != 0; in++) {
         switch (in->function_id) {
         case OSSL_FUNC_CORE_GETTABLE_PARAMS:
@@ -618,21 +794,11 @@ int OSSL_provider_init(const OSSL_CORE_HANDLE *handle,
     if (c_obj_create == NULL || c_obj_add_sigid==NULL)
         return 0;
 
-    // insert all OIDs to the global objects list
-    for (i=0; i<OQS_OID_CNT;i+=2) {
-	if (!c_obj_create(handle, oqs_oid_alg_list[i], oqs_oid_alg_list[i+1], oqs_oid_alg_list[i+1]))
-                ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
-
-	if (!oqs_set_nid((char*)oqs_oid_alg_list[i+1], OBJ_sn2nid(oqs_oid_alg_list[i+1])))
-              ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
-
-	if (!c_obj_add_sigid(handle, oqs_oid_alg_list[i+1], "", oqs_oid_alg_list[i+1])) {
-              OQS_PROV_PRINTF2("error registering %s with no hash\n", oqs_oid_alg_list[i+1]);
-              ERR_raise(ERR_LIB_USER, OQSPROV_R_OBJ_CREATE_ERR);
-	}
-
-        OQS_PROV_PRINTF3("OQS PROV: successfully registered %s with NID %d\n", oqs_oid_alg_list[i+1], OBJ_sn2nid(oqs_oid_alg_list[i+1]));
-
+    if (!oqs_prov_conf_flag(handle, OQS_PROV_CONF_LAZY_INIT)) {
+        if (!oqs_objects_register(handle, env))
+            return 0;
+    } else {
+        OQS_PROV_PRINTF("OQS PROV: algorithm objects registered on first use\n");
     }
 
     // if libctx not yet existing, create a new one
@@ -644,6 +810,37 @@ int OSSL_provider_init(const OSSL_CORE_HANDLE *handle,
 	goto end_init;
     }
 
+    ((PROV_OQS_CTX *)*provctx)->hybrid_sig_parallel =
+        oqs_prov_conf_flag(handle, OQS_PROV_CONF_HYBRID_SIG_PARALLEL);
+    ((PROV_OQS_CTX *)*provctx)->hybrid_kem_parallel =
+        oqs_prov_conf_flag(handle, OQS_PROV_CONF_HYBRID_KEM_PARALLEL);
+    OQS_PROV_PRINTF3("OQS PROV: hybrid signature/KEM halves run concurrently: %d/%d\n",
+        ((PROV_OQS_CTX *)*provctx)->hybrid_sig_parallel,
+        ((PROV_OQS_CTX *)*provctx)->hybrid_kem_parallel);
+
+    if (!oqs_prov_conf_size(handle, OQS_PROV_CONF_KEM_KEYPOOL_DEPTH,
+                            0, OQSX_KEYPOOL_MAX_DEPTH, &depth)
+        || !oqs_prov_conf_size(handle, OQS_PROV_CONF_SPKI_CACHE_SIZE,
+                               0, OQSX_KEYCACHE_MAX_SIZE, &cachesize)) {
+        libctx = NULL; // freed with provctx
+        goto end_init;
+    }
+
+    if (depth != 0
+        && !oqsx_keypools_new(*provctx,
+                              oqs_prov_conf_str(handle, OQS_PROV_CONF_KEM_KEYPOOL_GROUPS),
+                              depth)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_LIB_CREATE_ERR);
+        libctx = NULL; // freed with provctx
+        goto end_init;
+    }
+
+    if (!oqsx_keycache_new(*provctx, cachesize)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_LIB_CREATE_ERR);
+        libctx = NULL; // freed with provctx
+        goto end_init;
+    }
+
     *out = oqsprovider_dispatch_table;
 
     // finally, warn if neither default nor fips provider are present:
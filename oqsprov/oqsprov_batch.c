@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Batch signature verification helper, see oqsprovider.h
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include "oqs_prov.h"
+#include "oqsprovider.h"
+
+/* items per task: multiple of 8 so tasks never share a results byte */
+#define OQSX_BATCH_CHUNK 64
+/* keys per task whose verification contexts are initialized once */
+#define OQSX_BATCH_KEYS  16
+
+typedef struct {
+    OSSL_LIB_CTX *libctx;
+    const char *propq;
+    const OQSPROV_VERIFY_ITEM *items;
+    size_t n;
+    unsigned char *results;
+    _Atomic size_t verified;
+} OQSX_BATCH;
+
+/* context initialized for verification with key, copied for each item */
+typedef struct {
+    const EVP_PKEY *key;
+    EVP_MD_CTX *mdctx;
+} OQSX_BATCH_KEYCTX;
+
+/* initialized context for key, set up in a free or the oldest slot */
+static EVP_MD_CTX *oqsx_batch_keyctx(OQSX_BATCH *batch, OQSX_BATCH_KEYCTX *keyctx,
+                                     size_t *next, EVP_PKEY *key)
+{
+    OQSX_BATCH_KEYCTX *kc;
+    size_t i;
+
+    for (i = 0; i < OQSX_BATCH_KEYS; i++)
+        if (keyctx[i].key == key)
+            return keyctx[i].mdctx;
+    kc = &keyctx[*next];
+    *next = (*next + 1) % OQSX_BATCH_KEYS;
+    kc->key = NULL;
+    // reset: re-init of a used ctx keeps its first key in OpenSSL 3.0
+    if ((kc->mdctx == NULL && (kc->mdctx = EVP_MD_CTX_new()) == NULL)
+        || !EVP_MD_CTX_reset(kc->mdctx)
+        || EVP_DigestVerifyInit_ex(kc->mdctx, NULL, NULL, batch->libctx, batch->propq,
+                                   key, NULL) <= 0)
+        return NULL;
+    kc->key = key;
+    return kc->mdctx;
+}
+
+static void oqsx_batch_verify_chunk(void *vbatch, size_t chunk)
+{
+    OQSX_BATCH *batch = vbatch;
+    size_t i = chunk * OQSX_BATCH_CHUNK, end = i + OQSX_BATCH_CHUNK, verified = 0;
+    OQSX_BATCH_KEYCTX keyctx[OQSX_BATCH_KEYS];
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new(), *initctx;
+    size_t next = 0;
+
+    memset(keyctx, 0, sizeof(keyctx));
+    if (end > batch->n)
+        end = batch->n;
+    for (; mdctx != NULL && i < end; i++) {
+        const OQSPROV_VERIFY_ITEM *item = &batch->items[i];
+
+        // failing items are reported in results only
+        ERR_set_mark();
+        if (item->key != NULL
+            && (initctx = oqsx_batch_keyctx(batch, keyctx, &next, item->key)) != NULL
+            && EVP_MD_CTX_copy_ex(mdctx, initctx)
+            && EVP_DigestVerify(mdctx, item->sig, item->siglen, item->msg, item->msglen) > 0) {
+            batch->results[i / 8] |= 1 << (i % 8);
+            verified++;
+        }
+        ERR_pop_to_mark();
+    }
+    for (i = 0; i < OQSX_BATCH_KEYS; i++)
+        EVP_MD_CTX_free(keyctx[i].mdctx);
+    EVP_MD_CTX_free(mdctx);
+    atomic_fetch_add_explicit(&batch->verified, verified, memory_order_relaxed);
+}
+
+int oqsprov_batch_verify(OSSL_LIB_CTX *libctx, const char *propq,
+                         const OQSPROV_VERIFY_ITEM *items, size_t n,
+                         int nthreads, unsigned char *results)
+{
+    OQSX_BATCH batch;
+
+    // the count returned must fit
+    if (((items == NULL || results == NULL) && n > 0) || n > INT_MAX) {
+        ERR_raise(ERR_LIB_USER, ERR_R_PASSED_INVALID_ARGUMENT);
+        return -1;
+    }
+
+    batch.libctx = libctx;
+    batch.propq = propq;
+    batch.items = items;
+    batch.n = n;
+    batch.results = results;
+    atomic_init(&batch.verified, 0);
+    memset(results, 0, (n + 7) / 8);
+
+    if (!oqsx_parallel_for((n + OQSX_BATCH_CHUNK - 1) / OQSX_BATCH_CHUNK, nthreads,
+                           oqsx_batch_verify_chunk, &batch))
+        return -1;
+    return (int)atomic_load(&batch.verified);
+}
@@ -495,7 +495,7 @@ int oqs_provider_get_capabilities(void *provctx, const char *capability,
 
 #ifdef OSSL_CAPABILITY_TLS_SIGALG_NAME
     if (strcasecmp(capability, "TLS-SIGALG") == 0)
-        return oqs_sigalg_capability(cb, arg);
+        return oqsx_objects_init(provctx) && oqs_sigalg_capability(cb, arg);
 #endif
 
     /* We don't support this capability */
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Cache of public keys decoded from SubjectPublicKeyInfo DER.
+ *
+ * Enabled by the provider configuration option spki_cache_size. Services
+ * decoding the same certificates over and over, e.g., intermediate CAs sent
+ * by every peer, then get the key decoded before instead of a new one. The
+ * cache holds a reference to each key and hands out further references, so
+ * cached keys are shared and must not be modified: they are marked with
+ * OQSX_KEY_FLAG_SHARED. When full, the least recently used key is dropped.
+ * Keys are found by DER and by the NID of the decoder that accepted them, so
+ * a decoder for another key type never gets them.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/params.h>
+#include "oqs_prov.h"
+
+#ifdef NDEBUG
+#define OQS_KC_PRINTF2(a, b)
+#else
+#define OQS_KC_PRINTF2(a, b) if (getenv("OQSKC")) printf(a, b)
+#endif // NDEBUG
+
+typedef struct oqsx_keycache_entry_st OQSX_KEYCACHE_ENTRY;
+
+struct oqsx_keycache_entry_st {
+    uint64_t hash;
+    unsigned char *der;
+    size_t derlen;
+    int nid;
+    OQSX_KEY *key;
+    OQSX_KEYCACHE_ENTRY *prev, *next; // LRU list, most recently used first
+    OQSX_KEYCACHE_ENTRY *chain;       // next in hash bucket
+};
+
+struct oqsx_keycache_st {
+    pthread_mutex_t lock;
+    size_t size;                      // maximum number of keys
+    size_t count;
+    size_t nbuckets;
+    OQSX_KEYCACHE_ENTRY **buckets;
+    OQSX_KEYCACHE_ENTRY *head, *tail;
+    uint64_t hits, misses;
+};
+
+int oqsx_keycache_new(PROV_OQS_CTX *provctx, size_t size)
+{
+    OQSX_KEYCACHE *cache;
+
+    if (size == 0)
+        return 1;
+    if ((cache = OPENSSL_zalloc(sizeof(*cache))) == NULL)
+        return 0;
+    cache->size = size;
+    cache->nbuckets = 2 * size;
+    if ((cache->buckets = OPENSSL_zalloc(cache->nbuckets * sizeof(*cache->buckets))) == NULL) {
+        OPENSSL_free(cache);
+        return 0;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    provctx->keycache = cache;
+    OQS_KC_PRINTF2("OQS KC: caching up to %zu public keys\n", size);
+    return 1;
+}
+
+static void oqsx_keycache_entry_free(OQSX_KEYCACHE_ENTRY *e)
+{
+    oqsx_key_free(e->key);
+    OPENSSL_free(e->der);
+    OPENSSL_free(e);
+}
+
+void oqsx_keycache_free(PROV_OQS_CTX *provctx)
+{
+    OQSX_KEYCACHE *cache = provctx->keycache;
+    OQSX_KEYCACHE_ENTRY *e;
+
+    if (cache == NULL)
+        return;
+    while ((e = cache->head) != NULL) {
+        cache->head = e->next;
+        oqsx_keycache_entry_free(e);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    OPENSSL_free(cache->buckets);
+    OPENSSL_free(cache);
+    provctx->keycache = NULL;
+}
+
+/* lock held */
+static OQSX_KEYCACHE_ENTRY **oqsx_keycache_find(OQSX_KEYCACHE *cache, uint64_t hash,
+                                                const unsigned char *der, size_t derlen,
+                                                int nid)
+{
+    OQSX_KEYCACHE_ENTRY **pe;
+
+    for (pe = &cache->buckets[hash % cache->nbuckets]; *pe != NULL; pe = &(*pe)->chain)
+        if ((*pe)->hash == hash && (*pe)->nid == nid && (*pe)->derlen == derlen
+            && !memcmp((*pe)->der, der, derlen))
+            break;
+    return pe;
+}
+
+/* lock held */
+static void oqsx_keycache_unlink(OQSX_KEYCACHE *cache, OQSX_KEYCACHE_ENTRY *e)
+{
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+}
+
+/* lock held */
+static void oqsx_keycache_push(OQSX_KEYCACHE *cache, OQSX_KEYCACHE_ENTRY *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+}
+
+OQSX_KEY *oqsx_keycache_get(OQSX_KEYCACHE *cache, const unsigned char *der, size_t derlen,
+                            int nid)
+{
+    uint64_t hash = oqsx_hash(der, derlen, 0);
+    OQSX_KEYCACHE_ENTRY *e;
+    OQSX_KEY *key = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((e = *oqsx_keycache_find(cache, hash, der, derlen, nid)) != NULL
+        && oqsx_key_up_ref(e->key)) {
+        key = e->key;
+        oqsx_keycache_unlink(cache, e);
+        oqsx_keycache_push(cache, e);
+    }
+    if (key != NULL)
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return key;
+}
+
+void oqsx_keycache_put(OQSX_KEYCACHE *cache, const unsigned char *der, size_t derlen,
+                       int nid, OQSX_KEY *key)
+{
+    uint64_t hash = oqsx_hash(der, derlen, 0);
+    OQSX_KEYCACHE_ENTRY *e, **pe;
+
+    if ((e = OPENSSL_zalloc(sizeof(*e))) == NULL)
+        return;
+    if ((e->der = OPENSSL_memdup(der, derlen)) == NULL) {
+        OPENSSL_free(e);
+        return;
+    }
+    e->hash = hash;
+    e->derlen = derlen;
+    e->nid = nid;
+    // not yet seen by other threads: the caller holds the only reference
+    key->flags |= OQSX_KEY_FLAG_SHARED;
+
+    pthread_mutex_lock(&cache->lock);
+    if (*(pe = oqsx_keycache_find(cache, hash, der, derlen, nid)) != NULL
+        || !oqsx_key_up_ref(key)) { // decoded concurrently by another thread
+        pthread_mutex_unlock(&cache->lock);
+        OPENSSL_free(e->der);
+        OPENSSL_free(e);
+        return;
+    }
+    e->key = key;
+    *pe = e;
+    oqsx_keycache_push(cache, e);
+    if (++cache->count <= cache->size)
+        e = NULL;
+    else {
+        e = cache->tail;
+        oqsx_keycache_unlink(cache, e);
+        for (pe = &cache->buckets[e->hash % cache->nbuckets]; *pe != e; pe = &(*pe)->chain)
+            ;
+        *pe = e->chain;
+        cache->count--;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (e != NULL)
+        oqsx_keycache_entry_free(e); // users of the key keep their references
+}
+
+int oqsx_keycache_get_params(PROV_OQS_CTX *provctx, OSSL_PARAM params[])
+{
+    OQSX_KEYCACHE *cache = provctx->keycache;
+    uint64_t hits = 0, misses = 0;
+    OSSL_PARAM *p;
+
+    if (cache != NULL) {
+        pthread_mutex_lock(&cache->lock);
+        hits = cache->hits;
+        misses = cache->misses;
+        pthread_mutex_unlock(&cache->lock);
+    }
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_SPKI_CACHE_HITS);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, hits))
+        return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_SPKI_CACHE_MISSES);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, misses))
+        return 0;
+    return 1;
+}
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Pools of pre-generated KEM keypairs, e.g. for TLS client key shares.
+ *
+ * Enabled per group by the provider configuration options
+ * kem_keypool_groups and kem_keypool_depth. Key generation takes a key from
+ * the group's ring if one is ready; once the ring runs low, a worker thread
+ * of the provider's pool generates keys until it is full again. Keys leave
+ * the ring exactly once, so each is used for a single key exchange.
+ *
+ * The ring has a single producer (one refill at a time, guarded by
+ * 'refilling') and any number of lock-free consumers claiming keys by
+ * advancing 'head'.
+ *
+ * After fork(), parent and child would hand out the same keys: the child
+ * drops and cleanses all keys it inherited and refills its pools itself.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/params.h>
+#include "oqs_prov.h"
+
+#ifdef NDEBUG
+#define OQS_POOL_PRINTF(a)
+#define OQS_POOL_PRINTF2(a, b)
+#define OQS_POOL_PRINTF3(a, b, c)
+#else
+#define OQS_POOL_PRINTF(a) if (getenv("OQSPOOL")) printf(a)
+#define OQS_POOL_PRINTF2(a, b) if (getenv("OQSPOOL")) printf(a, b)
+#define OQS_POOL_PRINTF3(a, b, c) if (getenv("OQSPOOL")) printf(a, b, c)
+#endif // NDEBUG
+
+struct oqsx_keypool_st {
+    char *tls_name;
+    OSSL_LIB_CTX *libctx;
+    size_t depth;
+    size_t lowmark;             // refill once no more keys than this are left
+    _Atomic(OQSX_KEY *) *slots; // depth entries, indexed modulo depth
+    _Atomic size_t head;        // next key to hand out
+    _Atomic size_t tail;        // next slot to fill
+    _Atomic int refilling;
+    _Atomic int closing;
+    _Atomic uint64_t hits;      // keys handed out
+    _Atomic uint64_t refills;   // refills that generated keys
+    pthread_mutex_t lock;       // for waiting on the end of a refill
+    pthread_cond_t refilled;
+    /* key parameters, set by the first consumer before the first refill */
+    char *oqs_name;
+    const char *key_tls_name; // static name for keys, unlike tls_name
+    int primitive;
+    int bit_security;
+    int alg_idx;
+    OQSX_KEYPOOL *next;
+    OQSX_KEYPOOL *prevall, *nextall; // all pools of the process, for fork()
+};
+
+static pthread_mutex_t keypools_lock = PTHREAD_MUTEX_INITIALIZER;
+static OQSX_KEYPOOL *keypools_all = NULL;
+static pthread_once_t keypools_atfork_once = PTHREAD_ONCE_INIT;
+
+/* keys [head, tail) not handed out yet */
+static void oqsx_keypool_drain(OQSX_KEYPOOL *pool)
+{
+    size_t i;
+
+    for (i = atomic_load(&pool->head); i < atomic_load(&pool->tail); i++)
+        oqsx_key_free(atomic_load(&pool->slots[i % pool->depth]));
+    atomic_store(&pool->head, 0);
+    atomic_store(&pool->tail, 0);
+}
+
+static void oqsx_keypools_prepare(void)
+{
+    pthread_mutex_lock(&keypools_lock);
+}
+
+static void oqsx_keypools_parent(void)
+{
+    pthread_mutex_unlock(&keypools_lock);
+}
+
+/* child: refills in progress ran on threads that were not copied */
+static void oqsx_keypools_child(void)
+{
+    OQSX_KEYPOOL *pool;
+
+    for (pool = keypools_all; pool != NULL; pool = pool->nextall) {
+        oqsx_keypool_drain(pool);
+        atomic_store(&pool->refilling, 0);
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->refilled, NULL);
+    }
+    pthread_mutex_unlock(&keypools_lock);
+}
+
+static void oqsx_keypools_atfork(void)
+{
+    pthread_atfork(oqsx_keypools_prepare, oqsx_keypools_parent, oqsx_keypools_child);
+}
+
+static OQSX_KEYPOOL *oqsx_keypool_new(OSSL_LIB_CTX *libctx, const char *tls_name,
+                                      size_t len, size_t depth)
+{
+    OQSX_KEYPOOL *pool = OPENSSL_zalloc(sizeof(*pool));
+
+    if (pool == NULL
+        || (pool->tls_name = OPENSSL_strndup(tls_name, len)) == NULL
+        || (pool->slots = OPENSSL_zalloc(depth * sizeof(*pool->slots))) == NULL) {
+        if (pool != NULL)
+            OPENSSL_free(pool->tls_name);
+        OPENSSL_free(pool);
+        return NULL;
+    }
+    pool->libctx = libctx;
+    pool->depth = depth;
+    pool->lowmark = depth / 2;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->refilled, NULL);
+
+    pthread_mutex_lock(&keypools_lock);
+    if ((pool->nextall = keypools_all) != NULL)
+        keypools_all->prevall = pool;
+    keypools_all = pool;
+    pthread_mutex_unlock(&keypools_lock);
+    return pool;
+}
+
+static void oqsx_keypool_free(OQSX_KEYPOOL *pool)
+{
+    pthread_mutex_lock(&keypools_lock);
+    if (pool->prevall != NULL)
+        pool->prevall->nextall = pool->nextall;
+    else
+        keypools_all = pool->nextall;
+    if (pool->nextall != NULL)
+        pool->nextall->prevall = pool->prevall;
+    pthread_mutex_unlock(&keypools_lock);
+
+    atomic_store(&pool->closing, 1);
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->refilling)) // refill stops at next key
+        pthread_cond_wait(&pool->refilled, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    oqsx_keypool_drain(pool);
+    pthread_cond_destroy(&pool->refilled);
+    pthread_mutex_destroy(&pool->lock);
+    OPENSSL_free(pool->slots);
+    OPENSSL_free(pool->tls_name);
+    OPENSSL_free(pool);
+}
+
+int oqsx_keypools_new(PROV_OQS_CTX *provctx, const char *groups, size_t depth)
+{
+    const char *name = groups, *end;
+    OQSX_KEYPOOL *pool;
+
+    if (groups == NULL || depth == 0)
+        return 1;
+    pthread_once(&keypools_atfork_once, oqsx_keypools_atfork);
+    // groups: names separated by ',', ':' or blanks
+    while (*name != '\0') {
+        name += strspn(name, ",: \t");
+        end = name + strcspn(name, ",: \t");
+        if (end == name)
+            break;
+        if ((pool = oqsx_keypool_new(provctx->libctx, name, end - name, depth)) == NULL)
+            return 0;
+        pool->next = provctx->keypools;
+        provctx->keypools = pool;
+        OQS_POOL_PRINTF3("OQS POOL: %zu keys for %s\n", depth, pool->tls_name);
+        name = end;
+    }
+    return 1;
+}
+
+void oqsx_keypools_free(PROV_OQS_CTX *provctx)
+{
+    OQSX_KEYPOOL *pool;
+
+    while ((pool = provctx->keypools) != NULL) {
+        provctx->keypools = pool->next;
+        oqsx_keypool_free(pool);
+    }
+}
+
+OQSX_KEYPOOL *oqsx_keypool_get(PROV_OQS_CTX *provctx, const char *tls_name, int primitive)
+{
+    OQSX_KEYPOOL *pool;
+
+    if (primitive != KEY_TYPE_KEM && primitive != KEY_TYPE_ECP_HYB_KEM
+        && primitive != KEY_TYPE_ECX_HYB_KEM)
+        return NULL;
+    for (pool = provctx->keypools; pool != NULL; pool = pool->next)
+        if (!strcmp(pool->tls_name, tls_name))
+            return pool;
+    return NULL;
+}
+
+/* background job: generate keys until ring is full or pool closes */
+static void oqsx_keypool_refill(void *vpool, size_t unused)
+{
+    OQSX_KEYPOOL *pool = vpool;
+    size_t tail = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+    size_t start = tail;
+    OQSX_KEY *key;
+
+    while (!atomic_load_explicit(&pool->closing, memory_order_relaxed)
+           && tail - atomic_load_explicit(&pool->head, memory_order_acquire) < pool->depth) {
+        key = oqsx_key_new(pool->libctx, pool->oqs_name, pool->key_tls_name, pool->primitive,
+                           NULL, pool->bit_security, pool->alg_idx);
+        if (key == NULL || oqsx_key_gen(key)) {
+            oqsx_key_free(key);
+            ERR_clear_error(); // nobody to report to: consumers generate keys themselves
+            break;
+        }
+        atomic_store_explicit(&pool->slots[tail % pool->depth], key, memory_order_relaxed);
+        atomic_store_explicit(&pool->tail, ++tail, memory_order_release);
+    }
+    if (tail != start)
+        atomic_fetch_add_explicit(&pool->refills, 1, memory_order_relaxed);
+    OQS_POOL_PRINTF3("OQS POOL: %s refilled to %zu keys\n", pool->tls_name,
+                     tail - atomic_load(&pool->head));
+    pthread_mutex_lock(&pool->lock);
+    atomic_store_explicit(&pool->refilling, 0, memory_order_release);
+    pthread_cond_broadcast(&pool->refilled);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+OQSX_KEY *oqsx_keypool_pop(OQSX_KEYPOOL *pool, char *oqs_name, const char *tls_name,
+                           int primitive, int bit_security, int alg_idx)
+{
+    size_t head = atomic_load_explicit(&pool->head, memory_order_relaxed), tail;
+    OQSX_KEY *key = NULL;
+    int expected = 0;
+
+    for (;;) {
+        tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
+        if (head == tail)
+            break;
+        key = atomic_load_explicit(&pool->slots[head % pool->depth], memory_order_relaxed);
+        /* the slot is refilled only after head moved past it, which makes
+         * the CAS fail if that happened after we read it */
+        if (atomic_compare_exchange_weak_explicit(&pool->head, &head, head + 1,
+                                                  memory_order_acq_rel,
+                                                  memory_order_relaxed)) {
+            head++;
+            break;
+        }
+        key = NULL;
+    }
+
+    if (tail - head <= pool->lowmark
+        && atomic_compare_exchange_strong(&pool->refilling, &expected, 1)) {
+        if (pool->oqs_name == NULL) { // only set by the thread owning the refill
+            pool->primitive = primitive;
+            pool->bit_security = bit_security;
+            pool->alg_idx = alg_idx;
+            pool->key_tls_name = tls_name;
+            pool->oqs_name = oqs_name;
+        }
+        if (!oqsx_run_async(oqsx_keypool_refill, pool))
+            atomic_store(&pool->refilling, 0);
+    }
+    if (key != NULL)
+        atomic_fetch_add_explicit(&pool->hits, 1, memory_order_relaxed);
+    OQS_POOL_PRINTF3("OQS POOL: %s key from pool: %s\n", pool->tls_name, key ? "yes" : "no");
+    return key;
+}
+
+int oqsx_keypools_get_params(PROV_OQS_CTX *provctx, OSSL_PARAM params[])
+{
+    OQSX_KEYPOOL *pool;
+    uint64_t hits = 0, refills = 0;
+    OSSL_PARAM *p;
+
+    for (pool = provctx->keypools; pool != NULL; pool = pool->next) {
+        hits += atomic_load_explicit(&pool->hits, memory_order_relaxed);
+        refills += atomic_load_explicit(&pool->refills, memory_order_relaxed);
+    }
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_KEM_KEYPOOL_HITS);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, hits))
+        return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_KEM_KEYPOOL_REFILLS);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, refills))
+        return 0;
+    return 1;
+}
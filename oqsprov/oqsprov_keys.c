@@ -14,6 +14,9 @@
 #include <openssl/evp.h>
 #include <openssl/x509.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 #include <assert.h>
 #include "oqs_prov.h"
 
@@ -84,51 +87,241 @@ static oqs_nid_name_t nid_names[NID_TABLE_LEN] = {
 ///// OQS_TEMPLATE_FRAGMENT_OQSNAMES_END
 };
 
+/// Lookup index over nid_names
+
+/* tls names are found by a perfect hash of the hash-and-displace kind: a
+ * name's bucket selects a displacement, which moves the name's home slot to
+ * one no other name occupies. Seed and displacements are searched once, on
+ * first use. NIDs are only known after provider init registered the OIDs;
+ * they index a table of their own from then on. Either lookup falls back to
+ * scanning nid_names when its index cannot be built.
+ */
+#define OQSX_NAME_SLOTS   (2 * NID_TABLE_LEN)
+#define OQSX_NAME_BUCKETS ((NID_TABLE_LEN + 1) / 2)
+#define OQSX_NAME_SEEDS   64          // seeds tried before giving up on the hash
+#define OQSX_NID_SPAN     (4 * NID_TABLE_LEN) // NIDs indexed from the smallest one
+
+static pthread_once_t oqsx_name_once = PTHREAD_ONCE_INIT;
+static int oqsx_name_ready;
+static uint32_t oqsx_name_seed;
+static int oqsx_name_disp[OQSX_NAME_BUCKETS];
+static short oqsx_name_slot[OQSX_NAME_SLOTS]; // nid_names index, -1 if free
+
+static pthread_once_t oqsx_nid_once = PTHREAD_ONCE_INIT;
+static int oqsx_nid_base;
+static short oqsx_nid_slot[OQSX_NID_SPAN];   // nid_names index, -1 if none
+
+/* DER AlgorithmIdentifier of each signature algorithm, encoded with the NID
+ * index: signature contexts hand out these instead of encoding their own */
+#define OQSX_AID_MAX 128
+
+typedef struct {
+    unsigned char der[OQSX_AID_MAX];
+    int len; // 0 if not encoded
+} OQSX_AID;
+
+static OQSX_AID oqsx_aids[NID_TABLE_LEN];
+/* same, hashed by DER for decoding; linear probing */
+#define OQSX_AID_SLOTS (2 * NID_TABLE_LEN)
+static short oqsx_aid_slot[OQSX_AID_SLOTS]; // nid_names index, -1 if free
+
+uint64_t oqsx_hash(const unsigned char *p, size_t len, uint32_t seed) {
+    uint64_t h = 14695981039346656037ull ^ seed; // FNV-1a
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33; // spread into both halves
+    h *= 0xff51afd7ed558ccdull;
+    return h ^ (h >> 33);
+}
+
+static uint64_t oqsx_name_hash(const char *name, uint32_t seed) {
+    return oqsx_hash((const unsigned char *)name, strlen(name), seed);
+}
+
+/* places all names of bucket b; 0 if no displacement fits them */
+static int oqsx_name_place(int b, const uint64_t *h) {
+    int d, i, j, slot;
+
+    for (d = 0; d < OQSX_NAME_SLOTS; d++) {
+        for (i = 0; i < NID_TABLE_LEN; i++) {
+            if ((int)((h[i] >> 32) % OQSX_NAME_BUCKETS) != b)
+                continue;
+            slot = ((uint32_t)h[i] + d) % OQSX_NAME_SLOTS;
+            if (oqsx_name_slot[slot] >= 0)
+                break;
+            oqsx_name_slot[slot] = i; // taken back below unless all fit
+        }
+        if (i == NID_TABLE_LEN) {
+            oqsx_name_disp[b] = d;
+            return 1;
+        }
+        for (j = 0; j < i; j++)
+            if ((int)((h[j] >> 32) % OQSX_NAME_BUCKETS) == b)
+                oqsx_name_slot[((uint32_t)h[j] + d) % OQSX_NAME_SLOTS] = -1;
+    }
+    return 0;
+}
+
+static void oqsx_name_index_build(void) {
+    uint64_t h[NID_TABLE_LEN];
+    int size[OQSX_NAME_BUCKETS];
+    int b, i, s, ok;
+    uint32_t seed;
+
+    for (seed = 0; seed < OQSX_NAME_SEEDS; seed++) {
+        memset(size, 0, sizeof(size));
+        memset(oqsx_name_slot, -1, sizeof(oqsx_name_slot));
+        for (i = 0; i < NID_TABLE_LEN; i++) {
+            h[i] = oqsx_name_hash(nid_names[i].tlsname, seed);
+            size[(h[i] >> 32) % OQSX_NAME_BUCKETS]++;
+        }
+        // largest buckets first, while most slots are free
+        for (ok = 1, s = NID_TABLE_LEN; ok && s > 0; s--)
+            for (b = 0; ok && b < OQSX_NAME_BUCKETS; b++)
+                if (size[b] == s)
+                    ok = oqsx_name_place(b, h);
+        if (ok) {
+            oqsx_name_seed = seed;
+            oqsx_name_ready = 1;
+            OQS_KEY_PRINTF2("OQS KEY: tls name hash seed %u\n", seed);
+            return;
+        }
+    }
+}
+
+/* returns index into nid_names of tlsname or -1 */
+static int oqsx_name_lookup(const char *tlsname) {
+    uint64_t h;
+    int i;
+
+    pthread_once(&oqsx_name_once, oqsx_name_index_build);
+    if (oqsx_name_ready) {
+        h = oqsx_name_hash(tlsname, oqsx_name_seed);
+        i = oqsx_name_slot[((uint32_t)h + oqsx_name_disp[(h >> 32) % OQSX_NAME_BUCKETS])
+                           % OQSX_NAME_SLOTS];
+        return i >= 0 && !strcmp(nid_names[i].tlsname, tlsname) ? i : -1;
+    }
+    for (i = 0; i < NID_TABLE_LEN; i++)
+        if (!strcmp(nid_names[i].tlsname, tlsname))
+            return i;
+    return -1;
+}
+
 int oqs_set_nid(char* tlsname, int nid) {
-   int i;
-   for(i=0;i<NID_TABLE_LEN;i++) {
-      if (!strcmp(nid_names[i].tlsname, tlsname)) {
-          nid_names[i].nid = nid;
-          return 1;
-      }
-   }
-   return 0;
-}
-
-static int get_secbits(int nid) {
-   int i;
-   for(i=0;i<NID_TABLE_LEN;i++) {
-      if (nid_names[i].nid == nid)
-          return nid_names[i].secbits;
-   }
-   return 0; 
-}
-
-static int get_keytype(int nid) {
-   int i;
-   for(i=0;i<NID_TABLE_LEN;i++) {
-      if (nid_names[i].nid == nid)
-          return nid_names[i].keytype;
-   }
-   return 0; 
-}
-
-static char* get_oqsname(int nid) {
-   int i;
-   for(i=0;i<NID_TABLE_LEN;i++) {
-      if (nid_names[i].nid == nid)
-          return nid_names[i].oqsname;
-   }
-   return 0; 
-}
-
-static int get_oqsalg_idx(int nid) {
-   int i;
-   for(i=0;i<NID_TABLE_LEN;i++) {
-      if (nid_names[i].nid == nid)
-          return i;
-   }
-   return -1; 
+   int i = oqsx_name_lookup(tlsname);
+
+   if (i < 0)
+       return 0;
+   if (nid_names[i].nid != nid) // unchanged when further instances start
+       nid_names[i].nid = nid;
+   return 1;
+}
+
+static void oqsx_aid_encode(int i) {
+    X509_ALGOR *algor = X509_ALGOR_new();
+    unsigned char *der = oqsx_aids[i].der;
+    int len;
+
+    if (algor == NULL)
+        return;
+    if (X509_ALGOR_set0(algor, OBJ_txt2obj(nid_names[i].tlsname, 0), V_ASN1_UNDEF, NULL)
+        && (len = i2d_X509_ALGOR(algor, NULL)) > 0 && len <= OQSX_AID_MAX)
+        oqsx_aids[i].len = i2d_X509_ALGOR(algor, &der);
+    X509_ALGOR_free(algor);
+}
+
+static void oqsx_aid_index_add(int i) {
+    unsigned int slot = oqsx_hash(oqsx_aids[i].der, oqsx_aids[i].len, 0) % OQSX_AID_SLOTS;
+
+    while (oqsx_aid_slot[slot] >= 0) {
+        if (oqsx_aids[oqsx_aid_slot[slot]].len == oqsx_aids[i].len
+            && !memcmp(oqsx_aids[oqsx_aid_slot[slot]].der, oqsx_aids[i].der, oqsx_aids[i].len))
+            return; // OID used twice: first algorithm wins, as with OBJ_obj2nid
+        slot = (slot + 1) % OQSX_AID_SLOTS;
+    }
+    oqsx_aid_slot[slot] = i;
+}
+
+/* returns index into nid_names of algorithm with DER AlgorithmIdentifier aid or -1 */
+static int oqsx_aid_lookup(const unsigned char *aid, size_t len) {
+    unsigned int slot = oqsx_hash(aid, len, 0) % OQSX_AID_SLOTS;
+    int i;
+
+    while ((i = oqsx_aid_slot[slot]) >= 0) {
+        if ((size_t)oqsx_aids[i].len == len && !memcmp(oqsx_aids[i].der, aid, len))
+            return i;
+        slot = (slot + 1) % OQSX_AID_SLOTS;
+    }
+    return -1;
+}
+
+static void oqsx_nid_index_build(void) {
+    int i, base = 0;
+
+    memset(oqsx_nid_slot, -1, sizeof(oqsx_nid_slot));
+    memset(oqsx_aid_slot, -1, sizeof(oqsx_aid_slot));
+    for (i = 0; i < NID_TABLE_LEN; i++)
+        if (nid_names[i].nid > 0 && (base == 0 || nid_names[i].nid < base))
+            base = nid_names[i].nid;
+    // NIDs out of span, if any, are looked up by scanning
+    for (i = 0; i < NID_TABLE_LEN; i++)
+        if (nid_names[i].nid > 0 && nid_names[i].nid - base < OQSX_NID_SPAN)
+            oqsx_nid_slot[nid_names[i].nid - base] = i;
+    oqsx_nid_base = base;
+    for (i = 0; i < NID_TABLE_LEN; i++) {
+        if (nid_names[i].nid > 0)
+            oqsx_aid_encode(i);
+        if (oqsx_aids[i].len > 0)
+            oqsx_aid_index_add(i);
+    }
+}
+
+void oqsx_nid_index_init(void) {
+    pthread_once(&oqsx_nid_once, oqsx_nid_index_build);
+}
+
+const unsigned char *oqsx_get_aid(const char *tls_name, size_t *len) {
+    int i = oqsx_name_lookup(tls_name);
+
+    if (i < 0 || oqsx_aids[i].len == 0)
+        return NULL;
+    *len = oqsx_aids[i].len;
+    return oqsx_aids[i].der;
+}
+
+const unsigned char *oqsx_find_aid(const unsigned char *oid, size_t oidlen) {
+    unsigned char aid[sizeof(oqsx_aids[0].der)];
+    int i;
+
+    // AlgorithmIdentifier without parameters, as registered
+    if (oidlen > 0x7f || oidlen + 2 > sizeof(aid))
+        return NULL;
+    aid[0] = V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED;
+    aid[1] = (unsigned char)oidlen;
+    memcpy(aid + 2, oid, oidlen);
+    if ((i = oqsx_aid_lookup(aid, oidlen + 2)) < 0)
+        return NULL;
+    return oqsx_aids[i].der;
+}
+
+/* returns descriptor of algorithm with nid or NULL */
+static const oqs_nid_name_t *oqsx_nid_lookup(int nid) {
+    int i;
+
+    if (nid <= 0)
+        return NULL;
+    if (oqsx_nid_base > 0 && nid >= oqsx_nid_base && nid - oqsx_nid_base < OQSX_NID_SPAN) {
+        i = oqsx_nid_slot[nid - oqsx_nid_base];
+        if (i >= 0)
+            return &nid_names[i];
+    }
+    for (i = 0; i < NID_TABLE_LEN; i++)
+        if (nid_names[i].nid == nid)
+            return &nid_names[i];
+    return NULL;
 }
 
 static int oqsx_key_set_composites(OQSX_KEY *key) {
@@ -140,10 +333,12 @@ static int oqsx_key_set_composites(OQSX_KEY *key) {
 	}
 	else { // TBD: extend for more than 1 classic key:
 		int classic_pubkey_len, classic_privkey_len;
+		const OQSX_EVP_INFO *evp_info = key->oqsx_provider_ctx.oqsx_evp_ctx->evp_info;
 
 		if (key->privkey) {
 			key->comp_privkey[0] = key->privkey + SIZE_OF_UINT32;
 			DECODE_UINT32(classic_privkey_len, key->privkey);
+			ON_ERR_SET_GOTO(classic_privkey_len > evp_info->length_private_key, ret, 1, err);
 			key->comp_privkey[1] = key->privkey + classic_privkey_len + SIZE_OF_UINT32;
 		}
 		else {
@@ -153,6 +348,7 @@ static int oqsx_key_set_composites(OQSX_KEY *key) {
 		if (key->pubkey) {
 			key->comp_pubkey[0] = key->pubkey + SIZE_OF_UINT32;
 			DECODE_UINT32(classic_pubkey_len, key->pubkey);
+			ON_ERR_SET_GOTO(classic_pubkey_len > evp_info->length_public_key, ret, 1, err);
 			key->comp_pubkey[1] = key->pubkey + classic_pubkey_len + SIZE_OF_UINT32;
 		}
 		else {
@@ -164,17 +360,115 @@ static int oqsx_key_set_composites(OQSX_KEY *key) {
 	return ret;
 }
 
+/// Shared algorithm descriptor cache
+
+/* OQS_KEM/OQS_SIG objects are immutable once created, so all keys of one
+ * algorithm reference a single, provider-owned instance instead of creating
+ * their own. Slots are populated lazily and without locking: the first thread
+ * to publish a descriptor wins, losers discard their copy.
+ * Descriptors are released when the last provider instance is torn down.
+ * The tables are sized from liboqs' own algorithm lists: OQS_*_new only
+ * succeeds for names in those lists, so every algorithm always finds a slot.
+ */
+static _Atomic(OQS_KEM *) oqsx_kem_cache[OQS_KEM_algs_length];
+static _Atomic(OQS_SIG *) oqsx_sig_cache[OQS_SIG_algs_length];
+static _Atomic int oqsx_alg_cache_users;
+
+static unsigned int oqsx_alg_cache_hash(const char *name) {
+    unsigned int h = 2166136261u; // FNV-1a
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static OQS_KEM *oqsx_kem_cache_get(const char *oqs_name) {
+    size_t i, idx = oqsx_alg_cache_hash(oqs_name) % OSSL_NELEM(oqsx_kem_cache);
+
+    for (i = 0; i < OSSL_NELEM(oqsx_kem_cache); i++) {
+        _Atomic(OQS_KEM *) *slot = &oqsx_kem_cache[idx];
+        OQS_KEM *kem = atomic_load_explicit(slot, memory_order_acquire);
+
+        if (kem == NULL) {
+            OQS_KEM *newkem = OQS_KEM_new(oqs_name);
+
+            if (newkem == NULL)
+                return NULL;
+            if (atomic_compare_exchange_strong_explicit(slot, &kem, newkem,
+                                                        memory_order_acq_rel,
+                                                        memory_order_acquire))
+                return newkem;
+            // lost the race: kem now holds the winner
+            OQS_KEM_free(newkem);
+        }
+        if (!strcmp(kem->method_name, oqs_name))
+            return kem;
+        idx = (idx + 1) % OSSL_NELEM(oqsx_kem_cache);
+    }
+    return NULL;
+}
+
+static OQS_SIG *oqsx_sig_cache_get(const char *oqs_name) {
+    size_t i, idx = oqsx_alg_cache_hash(oqs_name) % OSSL_NELEM(oqsx_sig_cache);
+
+    for (i = 0; i < OSSL_NELEM(oqsx_sig_cache); i++) {
+        _Atomic(OQS_SIG *) *slot = &oqsx_sig_cache[idx];
+        OQS_SIG *sig = atomic_load_explicit(slot, memory_order_acquire);
+
+        if (sig == NULL) {
+            OQS_SIG *newsig = OQS_SIG_new(oqs_name);
+
+            if (newsig == NULL)
+                return NULL;
+            if (atomic_compare_exchange_strong_explicit(slot, &sig, newsig,
+                                                        memory_order_acq_rel,
+                                                        memory_order_acquire))
+                return newsig;
+            OQS_SIG_free(newsig);
+        }
+        if (!strcmp(sig->method_name, oqs_name))
+            return sig;
+        idx = (idx + 1) % OSSL_NELEM(oqsx_sig_cache);
+    }
+    return NULL;
+}
+
+static void oqsx_evp_ctx_cache_free(void);
+
+static void oqsx_alg_cache_free(void) {
+    size_t i;
+
+    oqsx_evp_ctx_cache_free();
+
+    for (i = 0; i < OSSL_NELEM(oqsx_kem_cache); i++)
+        OQS_KEM_free(atomic_exchange(&oqsx_kem_cache[i], NULL));
+    for (i = 0; i < OSSL_NELEM(oqsx_sig_cache); i++)
+        OQS_SIG_free(atomic_exchange(&oqsx_sig_cache[i], NULL));
+}
+
 PROV_OQS_CTX *oqsx_newprovctx(OSSL_LIB_CTX *libctx, const OSSL_CORE_HANDLE *handle, BIO_METHOD *bm) {
     PROV_OQS_CTX * ret = OPENSSL_zalloc(sizeof(PROV_OQS_CTX));
     if (ret) {
        ret->libctx = libctx;
        ret->handle = handle;
        ret->corebiometh = bm;
+       atomic_fetch_add(&oqsx_alg_cache_users, 1);
     }
     return ret;
 }
 
 void oqsx_freeprovctx(PROV_OQS_CTX *ctx) {
+    if (ctx == NULL)
+        return;
+    oqsx_keypools_free(ctx); // before the caches its keys use
+    oqsx_keycache_free(ctx);
+    if (atomic_fetch_sub(&oqsx_alg_cache_users, 1) == 1) {
+        oqsx_alg_cache_free();
+        oqsx_thread_pool_free();
+        oqsx_slab_free_all(); // after workers, which return cached buffers on exit
+    }
     OSSL_LIB_CTX_free(ctx->libctx);
     BIO_meth_free(ctx->corebiometh);
     OPENSSL_free(ctx);
@@ -187,18 +481,18 @@ void oqsx_key_set0_libctx(OQSX_KEY *key, OSSL_LIB_CTX *libctx)
 }
 
 /* convenience function creating OQSX keys from nids (only for sigs) */
-static OQSX_KEY *oqsx_key_new_from_nid(OSSL_LIB_CTX *libctx, const char *propq, int nid) {
+OQSX_KEY *oqsx_key_new_from_nid(OSSL_LIB_CTX *libctx, const char *propq, int nid) {
 	OQS_KEY_PRINTF2("Generating OQSX key for nid %d\n", nid);
 
-	char* tls_algname = (char *)OBJ_nid2sn(nid);
-	OQS_KEY_PRINTF2("                    for tls_name %s\n", tls_algname);
+	const oqs_nid_name_t *alg = oqsx_nid_lookup(nid);
 
-	if (!tls_algname) {
+	if (alg == NULL) {
 		ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
 		return NULL;
 	}
+	OQS_KEY_PRINTF2("                    for tls_name %s\n", alg->tlsname);
 
-	return oqsx_key_new(libctx, get_oqsname(nid), tls_algname, get_keytype(nid), propq, get_secbits(nid), get_oqsalg_idx(nid));
+	return oqsx_key_new(libctx, alg->oqsname, alg->tlsname, alg->keytype, propq, alg->secbits, (int)(alg - nid_names));
 }
 
 /* Workaround for not functioning EC PARAM initialization
@@ -225,6 +519,10 @@ EVP_PKEY* setECParams(EVP_PKEY *eck, int nid) {
     }
 }
 
+static OQSX_KEY *oqsx_key_decode(OQSX_KEY *key,
+                                 const unsigned char *p, int plen,
+                                 oqsx_key_op_t op);
+
 /* Re-create OQSX_KEY from encoding(s): Same end-state as after ken-gen */
 static OQSX_KEY *oqsx_key_op(const X509_ALGOR *palg,
                       const unsigned char *p, int plen,
@@ -232,9 +530,7 @@ static OQSX_KEY *oqsx_key_op(const X509_ALGOR *palg,
                       OSSL_LIB_CTX *libctx, const char *propq)
 {
     OQSX_KEY *key = NULL;
-    void **privkey, **pubkey;
     int nid = NID_undef;
-    int ret = 0;
 
     OQS_KEY_PRINTF2("OQSX KEY: key_op called with data of len %d\n", plen);
     if (palg != NULL) {
@@ -259,12 +555,22 @@ static OQSX_KEY *oqsx_key_op(const X509_ALGOR *palg,
         ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
         return 0;
     }
+    return oqsx_key_decode(key, p, plen, op);
+}
+
+/* Fills new key from encoding p; frees key on error */
+static OQSX_KEY *oqsx_key_decode(OQSX_KEY *key,
+                                 const unsigned char *p, int plen,
+                                 oqsx_key_op_t op)
+{
+    int ret = 0;
 
     if (op == KEY_OP_PUBLIC) {
 #ifdef USE_ENCODING_LIB
         if (key->oqsx_encoding_ctx.encoding_ctx && key->oqsx_encoding_ctx.encoding_impl) {
-            key->pubkeylen = key->oqsx_encoding_ctx.encoding_ctx->raw_crypto_publickeybytes;
-            if (key->oqsx_encoding_ctx.encoding_impl->crypto_publickeybytes != plen) {
+            // raw key is stored in place of the OQS one
+            if (key->oqsx_encoding_ctx.encoding_ctx->raw_crypto_publickeybytes != key->pubkeylen
+                || key->oqsx_encoding_ctx.encoding_impl->crypto_publickeybytes != plen) {
                 ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
                 goto err;
             }
@@ -449,6 +755,65 @@ OQSX_KEY *oqsx_key_from_x509pubkey(const X509_PUBKEY *xpk,
     return oqsx;
 }
 
+/* reads DER header of an element with tag at *pp, not beyond end; returns
+ * content length and moves *pp to content, or -1 if not strict DER */
+static long oqsx_der_header(const unsigned char **pp, const unsigned char *end, int tag)
+{
+    const unsigned char *p = *pp;
+    size_t len;
+    int n;
+
+    if (end - p < 2 || *p++ != tag)
+        return -1;
+    len = *p++;
+    if (len & 0x80) {
+        n = len & 0x7f;
+        // no indefinite, overlong or non-minimal lengths
+        if (n == 0 || n > 4 || end - p < n || *p == 0)
+            return -1;
+        for (len = 0; n > 0; n--)
+            len = len << 8 | *p++;
+        if (len < 0x80)
+            return -1;
+    }
+    if (len > (size_t)(end - p))
+        return -1;
+    *pp = p;
+    return (long)len;
+}
+
+int oqsx_key_from_spki(const unsigned char **pp, long len,
+                       OSSL_LIB_CTX *libctx, const char *propq, OQSX_KEY **key)
+{
+    const unsigned char *p = *pp, *end, *aid;
+    long n, bitslen;
+    int idx;
+
+    if (len <= 0 || (n = oqsx_der_header(&p, *pp + len, V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED)) < 0)
+        return 0;
+    end = p + n;
+    aid = p;
+    if ((n = oqsx_der_header(&p, end, V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED)) < 0)
+        return 0;
+    p += n;
+    // known OID without parameters, then the key in a BIT STRING ending the SPKI
+    if ((idx = oqsx_aid_lookup(aid, p - aid)) < 0
+        || (bitslen = oqsx_der_header(&p, end, V_ASN1_BIT_STRING)) < 2 || bitslen > INT_MAX
+        || p + bitslen != end || *p != 0)
+        return 0;
+
+    OQS_KEY_PRINTF2("OQSX KEY: SPKI of %s\n", nid_names[idx].tlsname);
+    *key = oqsx_key_new(libctx, nid_names[idx].oqsname, nid_names[idx].tlsname,
+                        nid_names[idx].keytype, propq, nid_names[idx].secbits, idx);
+    if (*key == NULL)
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+    else
+        *key = oqsx_key_decode(*key, p + 1, (int)(bitslen - 1), KEY_OP_PUBLIC);
+    if (*key != NULL)
+        *pp = end;
+    return 1;
+}
+
 OQSX_KEY *oqsx_key_from_pkcs8(const PKCS8_PRIV_KEY_INFO *p8inf,
                               OSSL_LIB_CTX *libctx, const char *propq)
 {
@@ -497,88 +862,132 @@ static const OQSX_EVP_INFO nids_ecx[] = {
         { 0,               0, 0,  0,  0,  0, 0}  // 256 bit
 };
 
-static int oqsx_hybsig_init(int bit_security, OQSX_EVP_CTX *evp_ctx, char* algname)
+/* Classic key parameters are identical for all keys using the same nids_*
+ * table entry: build one OQSX_EVP_CTX per entry on first use and let all
+ * keys point to it. Like the OQS descriptors above, these live until the
+ * last provider instance is torn down.
+ */
+static _Atomic(OQSX_EVP_CTX *) oqsx_evp_sig_cache[OSSL_NELEM(nids_sig)];
+static _Atomic(OQSX_EVP_CTX *) oqsx_evp_ecp_cache[OSSL_NELEM(nids_ecp)];
+static _Atomic(OQSX_EVP_CTX *) oqsx_evp_ecx_cache[OSSL_NELEM(nids_ecx)];
+
+static void oqsx_evp_ctx_free(OQSX_EVP_CTX *evp_ctx)
 {
-    int ret = 1;
-    int idx = (bit_security - 128) / 64;
-    ON_ERR_GOTO(idx < 0 || idx > 2, err);
+    if (evp_ctx == NULL)
+        return;
+    EVP_PKEY_CTX_free(atomic_load(&evp_ctx->keygen_ctx));
+    EVP_PKEY_free(evp_ctx->keyParam);
+    OPENSSL_free(evp_ctx);
+}
 
-    if (!strncmp(algname, "rsa3072_", 8)) idx += 3;
-    else if (algname[0]!='p') {
-        OQS_KEY_PRINTF2("OQS KEY: Incorrect hybrid name: %s\n", algname);
-        ret = 0;
-        goto err;
-    }
+static OQSX_EVP_CTX *oqsx_evp_ctx_new(const OQSX_EVP_INFO *evp_info)
+{
+    int ret = 0;
+    EVP_PKEY_CTX *pctx = NULL;
+    OQSX_EVP_CTX *evp_ctx = OPENSSL_zalloc(sizeof(OQSX_EVP_CTX));
+    ON_ERR_GOTO(!evp_ctx, err);
 
-    ON_ERR_GOTO(idx < 0 || idx > 3, err);
+    evp_ctx->evp_info = evp_info;
 
-    evp_ctx->evp_info = &nids_sig[idx];
+    if (evp_info->keytype == EVP_PKEY_EC) {
+        pctx = EVP_PKEY_CTX_new_id(evp_info->keytype, NULL);
+        ON_ERR_GOTO(!pctx, err);
 
-    evp_ctx->ctx = EVP_PKEY_CTX_new_id(evp_ctx->evp_info->keytype, NULL);
-    ON_ERR_GOTO(!evp_ctx->ctx, err);
+        ret = EVP_PKEY_paramgen_init(pctx);
+        ON_ERR_GOTO(ret <= 0, err);
 
-    if (idx < 3) { // EC
-	ret = EVP_PKEY_paramgen_init(evp_ctx->ctx);
-	ON_ERR_GOTO(ret <= 0, err);
+        ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, evp_info->nid);
+        ON_ERR_GOTO(ret <= 0, err);
 
-        ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(evp_ctx->ctx, evp_ctx->evp_info->nid);
-	ON_ERR_GOTO(ret <= 0, err);
+        ret = EVP_PKEY_paramgen(pctx, &evp_ctx->keyParam);
+        ON_ERR_GOTO(ret <= 0 || !evp_ctx->keyParam, err);
+    }
+    else if (evp_info->raw_key_support) { // ECX
+        evp_ctx->keyParam = EVP_PKEY_new();
+        ON_ERR_GOTO(!evp_ctx->keyParam, err);
 
-	ret = EVP_PKEY_paramgen(evp_ctx->ctx, &evp_ctx->keyParam);
-	ON_ERR_GOTO(ret <= 0 || !evp_ctx->keyParam, err);
+        ret = EVP_PKEY_set_type(evp_ctx->keyParam, evp_info->keytype);
+        ON_ERR_GOTO(ret <= 0, err);
     }
     // RSA bit length set only during keygen
 
+    EVP_PKEY_CTX_free(pctx);
+    return evp_ctx;
+
     err:
-    return ret;
+    EVP_PKEY_CTX_free(pctx);
+    oqsx_evp_ctx_free(evp_ctx);
+    return NULL;
 }
 
-static const int oqshybkem_init_ecp(int bit_security, OQSX_EVP_CTX *evp_ctx)
+static OQSX_EVP_CTX *oqsx_evp_ctx_get(_Atomic(OQSX_EVP_CTX *) *slot,
+                                      const OQSX_EVP_INFO *evp_info)
 {
-    int ret = 1;
-    int idx = (bit_security - 128) / 64;
-    ON_ERR_GOTO(idx < 0 || idx > 2, err);
+    OQSX_EVP_CTX *evp_ctx = atomic_load_explicit(slot, memory_order_acquire);
 
-    evp_ctx->evp_info = &nids_ecp[idx];
+    if (evp_ctx == NULL) {
+        OQSX_EVP_CTX *newctx = oqsx_evp_ctx_new(evp_info);
 
-    evp_ctx->ctx = EVP_PKEY_CTX_new_id(evp_ctx->evp_info->keytype, NULL);
-    ON_ERR_GOTO(!evp_ctx->ctx, err);
+        if (newctx == NULL)
+            return NULL;
+        if (atomic_compare_exchange_strong_explicit(slot, &evp_ctx, newctx,
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire))
+            return newctx;
+        oqsx_evp_ctx_free(newctx);
+    }
+    return evp_ctx;
+}
+
+static void oqsx_evp_ctx_cache_free(void)
+{
+    size_t i;
+
+    for (i = 0; i < OSSL_NELEM(oqsx_evp_sig_cache); i++)
+        oqsx_evp_ctx_free(atomic_exchange(&oqsx_evp_sig_cache[i], NULL));
+    for (i = 0; i < OSSL_NELEM(oqsx_evp_ecp_cache); i++)
+        oqsx_evp_ctx_free(atomic_exchange(&oqsx_evp_ecp_cache[i], NULL));
+    for (i = 0; i < OSSL_NELEM(oqsx_evp_ecx_cache); i++)
+        oqsx_evp_ctx_free(atomic_exchange(&oqsx_evp_ecx_cache[i], NULL));
+}
 
-    ret = EVP_PKEY_paramgen_init(evp_ctx->ctx);
-    ON_ERR_GOTO(ret <= 0, err);
+static OQSX_EVP_CTX *oqsx_hybsig_init(int bit_security, const char* algname)
+{
+    int idx = (bit_security - 128) / 64;
+    if (idx < 0 || idx > 2)
+        return NULL;
 
-    ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(evp_ctx->ctx, evp_ctx->evp_info->nid);
-    ON_ERR_GOTO(ret <= 0, err);
+    if (!strncmp(algname, "rsa3072_", 8)) idx += 3;
+    else if (algname[0]!='p') {
+        OQS_KEY_PRINTF2("OQS KEY: Incorrect hybrid name: %s\n", algname);
+        return NULL;
+    }
 
-    ret = EVP_PKEY_paramgen(evp_ctx->ctx, &evp_ctx->keyParam);
-    ON_ERR_GOTO(ret <= 0 || !evp_ctx->keyParam, err);
+    if (idx > 3)
+        return NULL;
 
-    err:
-    return ret;
+    return oqsx_evp_ctx_get(&oqsx_evp_sig_cache[idx], &nids_sig[idx]);
 }
 
-static const int oqshybkem_init_ecx(int bit_security, OQSX_EVP_CTX *evp_ctx)
+static OQSX_EVP_CTX *oqshybkem_init_ecp(int bit_security)
 {
-    int ret = 1;
     int idx = (bit_security - 128) / 64;
-    ON_ERR_GOTO(idx < 0 || idx > 2, err);
-
-    evp_ctx->evp_info = &nids_ecx[idx];
-
-    evp_ctx->keyParam = EVP_PKEY_new();
-    ON_ERR_SET_GOTO(!evp_ctx->keyParam, ret, -1, err);
+    if (idx < 0 || idx > 2)
+        return NULL;
 
-    ret = EVP_PKEY_set_type(evp_ctx->keyParam, evp_ctx->evp_info->keytype);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+    return oqsx_evp_ctx_get(&oqsx_evp_ecp_cache[idx], &nids_ecp[idx]);
+}
 
-    evp_ctx->ctx = EVP_PKEY_CTX_new(evp_ctx->keyParam, NULL);
-    ON_ERR_SET_GOTO(!evp_ctx->ctx, ret, -1, err);
+static OQSX_EVP_CTX *oqshybkem_init_ecx(int bit_security)
+{
+    int idx = (bit_security - 128) / 64;
+    if (idx < 0 || idx > 2)
+        return NULL;
 
-    err:
-    return ret;
+    return oqsx_evp_ctx_get(&oqsx_evp_ecx_cache[idx], &nids_ecx[idx]);
 }
 
-static const int (*init_kex_fun[])(int, OQSX_EVP_CTX *) = {
+static OQSX_EVP_CTX *(*init_kex_fun[])(int) = {
         oqshybkem_init_ecp,
         oqshybkem_init_ecx
 };
@@ -587,13 +996,17 @@ extern const char* oqs_alg_encoding_list[];
 #endif
 extern const char* oqs_oid_alg_list[];
 
-OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int primitive, const char *propq, int bit_security, int alg_idx)
+/* as oqsx_key_new; without room for the public key unless with_pubkey */
+static OQSX_KEY *oqsx_key_new_int(OSSL_LIB_CTX *libctx, char* oqs_name, const char* tls_name, int primitive, const char *propq, int bit_security, int alg_idx, int with_pubkey)
 {
-    OQSX_KEY *ret = OPENSSL_zalloc(sizeof(*ret));
+    OQSX_KEY *ret = NULL;
+    OQS_SIG *sig = NULL;
+    OQS_KEM *kem = NULL;
     OQSX_EVP_CTX *evp_ctx = NULL;
-    int ret2 = 0;
-
-    if (ret == NULL) goto err;
+    size_t privkeylen, pubkeylen, materiallen, propqlen = 0;
+#ifdef USE_ENCODING_LIB
+    OQSX_ENCODING_CTX encoding_ctx = { NULL, NULL };
+#endif
 
     if (oqs_name == NULL) {
         OQS_KEY_PRINTF("OQSX_KEY: Fatal error: No OQS key name provided:\n");
@@ -605,116 +1018,157 @@ OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int
         goto err;
     }
 
+    // determine key sizes first: key and public key material are allocated in one go
     switch(primitive) {
     case KEY_TYPE_SIG:
-        ret->numkeys = 1;
-        ret->comp_privkey = OPENSSL_malloc(sizeof(void *));
-        ret->comp_pubkey = OPENSSL_malloc(sizeof(void *));
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.sig = OQS_SIG_new(oqs_name);
-        if (!ret->oqsx_provider_ctx.oqsx_qs_ctx.sig) {
+        sig = oqsx_sig_cache_get(oqs_name);
+        if (!sig) {
             fprintf(stderr, "Could not create OQS signature algorithm %s. Enabled in liboqs?\n", oqs_name);
             goto err;
         }
 
 #ifdef USE_ENCODING_LIB
         if (alg_idx >= 0 && oqs_alg_encoding_list[2*alg_idx] != NULL && oqs_alg_encoding_list[2*alg_idx+1] != NULL) {
-            if (qsc_encoding_by_name_oid(&ret->oqsx_encoding_ctx.encoding_ctx, &ret->oqsx_encoding_ctx.encoding_impl, oqs_alg_encoding_list[2*alg_idx+1], oqs_alg_encoding_list[2*alg_idx]) != QSC_ENC_OK) {
+            if (qsc_encoding_by_name_oid(&encoding_ctx.encoding_ctx, &encoding_ctx.encoding_impl, oqs_alg_encoding_list[2*alg_idx+1], oqs_alg_encoding_list[2*alg_idx]) != QSC_ENC_OK) {
                 fprintf(stderr, "Could not create OQS signature encoding algorithm %s (%s, %s).\n", oqs_alg_encoding_list[2*alg_idx+1], oqs_name, oqs_alg_encoding_list[2*alg_idx]);
-                ret->oqsx_encoding_ctx.encoding_ctx = NULL;
-                ret->oqsx_encoding_ctx.encoding_impl = NULL;
                 goto err;
             }
         }
 #endif
-        ret->privkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_secret_key;
-        ret->pubkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_public_key;
-        ret->keytype = KEY_TYPE_SIG;
+        privkeylen = sig->length_secret_key;
+        pubkeylen = sig->length_public_key;
 	break;
     case KEY_TYPE_KEM:
-        ret->numkeys = 1;
-        ret->comp_privkey = OPENSSL_malloc(sizeof(void *));
-        ret->comp_pubkey = OPENSSL_malloc(sizeof(void *));
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = OQS_KEM_new(oqs_name);
-        if (!ret->oqsx_provider_ctx.oqsx_qs_ctx.kem) {
+        kem = oqsx_kem_cache_get(oqs_name);
+        if (!kem) {
             fprintf(stderr, "Could not create OQS KEM algorithm %s. Enabled in liboqs?\n", oqs_name);
             goto err;
         }
-        ret->privkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_secret_key;
-        ret->pubkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_public_key;
-        ret->keytype = KEY_TYPE_KEM;
+        privkeylen = kem->length_secret_key;
+        pubkeylen = kem->length_public_key;
 	break;
     case KEY_TYPE_ECX_HYB_KEM:
     case KEY_TYPE_ECP_HYB_KEM:
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = OQS_KEM_new(oqs_name);
-        if (!ret->oqsx_provider_ctx.oqsx_qs_ctx.kem) {
+        kem = oqsx_kem_cache_get(oqs_name);
+        if (!kem) {
             fprintf(stderr, "Could not create OQS KEM algorithm %s. Enabled in liboqs?\n", oqs_name);
             goto err;
         }
-        evp_ctx = OPENSSL_zalloc(sizeof(OQSX_EVP_CTX));
-        ON_ERR_GOTO(!evp_ctx, err);
-
-        ret2 = (init_kex_fun[primitive - KEY_TYPE_ECP_HYB_KEM])
+        evp_ctx = (init_kex_fun[primitive - KEY_TYPE_ECP_HYB_KEM])
 #ifdef CLOUDFLARE
-                (((!strcmp("Kyber768", oqs_name)&&(primitive==KEY_TYPE_ECX_HYB_KEM)))?128:bit_security, evp_ctx);
+                (((!strcmp("Kyber768", oqs_name)&&(primitive==KEY_TYPE_ECX_HYB_KEM)))?128:bit_security);
 #else
-                (bit_security, evp_ctx);
+                (bit_security);
 #endif
-        ON_ERR_GOTO(ret2 <= 0 || !evp_ctx->keyParam || !evp_ctx->ctx, err);
-
-        ret->numkeys = 2;
-        ret->comp_privkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
-        ret->comp_pubkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
-        ret->privkeylen = (ret->numkeys-1)*SIZE_OF_UINT32 + ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_secret_key + evp_ctx->evp_info->length_private_key;
-        ret->pubkeylen = (ret->numkeys-1)*SIZE_OF_UINT32 + ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_public_key + evp_ctx->evp_info->length_public_key;
-        ret->oqsx_provider_ctx.oqsx_evp_ctx = evp_ctx;
-        ret->keytype = primitive;
+        ON_ERR_GOTO(!evp_ctx || !evp_ctx->keyParam, err);
+
+        privkeylen = SIZE_OF_UINT32 + kem->length_secret_key + evp_ctx->evp_info->length_private_key;
+        pubkeylen = SIZE_OF_UINT32 + kem->length_public_key + evp_ctx->evp_info->length_public_key;
 	break;
     case KEY_TYPE_HYB_SIG:
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.sig = OQS_SIG_new(oqs_name);
-        if (!ret->oqsx_provider_ctx.oqsx_qs_ctx.sig) {
+        sig = oqsx_sig_cache_get(oqs_name);
+        if (!sig) {
             fprintf(stderr, "Could not create OQS signature algorithm %s. Enabled in liboqs?\n", oqs_name);
             goto err;
         }
-        evp_ctx = OPENSSL_zalloc(sizeof(OQSX_EVP_CTX));
+        evp_ctx = oqsx_hybsig_init(bit_security, tls_name);
         ON_ERR_GOTO(!evp_ctx, err);
 
-	ret2 = oqsx_hybsig_init(bit_security, evp_ctx, tls_name);
-        ON_ERR_GOTO(ret2 <= 0 || !evp_ctx->ctx, err);
-
-        ret->numkeys = 2;
-        ret->comp_privkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
-        ret->comp_pubkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
-        ret->privkeylen = (ret->numkeys-1) * SIZE_OF_UINT32 + ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_secret_key + evp_ctx->evp_info->length_private_key;
-        ret->pubkeylen = (ret->numkeys-1) * SIZE_OF_UINT32 + ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_public_key + evp_ctx->evp_info->length_public_key;
-        ret->oqsx_provider_ctx.oqsx_evp_ctx = evp_ctx;
-        ret->keytype = primitive;
-	ret->evp_info = evp_ctx->evp_info;
+        privkeylen = SIZE_OF_UINT32 + sig->length_secret_key + evp_ctx->evp_info->length_private_key;
+        pubkeylen = SIZE_OF_UINT32 + sig->length_public_key + evp_ctx->evp_info->length_public_key;
 	break;
     default: 
         OQS_KEY_PRINTF2("OQSX_KEY: Unknown key type encountered: %d\n", primitive);
 	goto err;
     }
 
+    if (propq != NULL)
+        propqlen = strlen(propq) + 1;
+    materiallen = with_pubkey ? pubkeylen : 0;
+    ret = OPENSSL_zalloc(sizeof(*ret) + materiallen + propqlen);
+    if (ret == NULL) goto err;
+
+    if (sig != NULL)
+        ret->oqsx_provider_ctx.oqsx_qs_ctx.sig = sig;
+    else
+        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = kem;
+    ret->oqsx_provider_ctx.oqsx_evp_ctx = evp_ctx;
+    if (primitive == KEY_TYPE_HYB_SIG)
+        ret->evp_info = evp_ctx->evp_info;
+#ifdef USE_ENCODING_LIB
+    ret->oqsx_encoding_ctx = encoding_ctx;
+#endif
+    ret->numkeys = evp_ctx != NULL ? 2 : 1;
+    ret->privkeylen = privkeylen;
+    ret->pubkeylen = pubkeylen;
+    ret->keytype = primitive;
     ret->libctx = libctx;
     ret->references = 1;
-    ret->tls_name = OPENSSL_strdup(tls_name);
+    ret->tls_name = tls_name;
     ret->bit_security = bit_security;
-
-    if (propq != NULL) {
-        ret->propq = OPENSSL_strdup(propq);
-        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
-        if (ret->propq == NULL)
-            goto err;
-    }
+    if (propq != NULL)
+        ret->propq = memcpy(ret->material + materiallen, propq, propqlen);
 
     OQS_KEY_PRINTF2("OQSX_KEY: new key created: %p\n", ret);
     return ret;
 err:
     ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
-    OPENSSL_free(ret);
     return NULL;
 }
 
+OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, const char* tls_name, int primitive, const char *propq, int bit_security, int alg_idx)
+{
+    return oqsx_key_new_int(libctx, oqs_name, tls_name, primitive, propq, bit_security, alg_idx, 1);
+}
+
+OQSX_KEY *oqsx_key_new_borrowed(OSSL_LIB_CTX *libctx, int nid,
+                                const unsigned char *pubkey, size_t pubkeylen,
+                                OQSX_PUBSTORE *store)
+{
+    const oqs_nid_name_t *alg = oqsx_nid_lookup(nid);
+    OQSX_KEY *key;
+
+    if (alg == NULL) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
+        return NULL;
+    }
+    key = oqsx_key_new_int(libctx, alg->oqsname, alg->tlsname, alg->keytype, NULL,
+                           alg->secbits, (int)(alg - nid_names), 0);
+    if (key == NULL)
+        return NULL;
+    if (key->pubkeylen != pubkeylen) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_SIZE);
+        oqsx_key_free(key); // not borrowing yet: frees what the constructor set up
+        return NULL;
+    }
+    // never written to: shared keys cannot be modified
+    key->pubkey = (void *)pubkey;
+    key->pubkey_store = store;
+    key->flags |= OQSX_KEY_FLAG_PUBKEY_BORROWED | OQSX_KEY_FLAG_SHARED;
+    oqsx_pubstore_up_ref(store);
+    if (oqsx_key_set_composites(key)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
+        oqsx_key_free(key);
+        return NULL;
+    }
+    return key;
+}
+
+int oqsx_key_set_propq(OQSX_KEY *key, const char *propq)
+{
+    char *newpropq = NULL;
+
+    if (propq != NULL && (newpropq = OPENSSL_strdup(propq)) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    if (key->flags & OQSX_KEY_FLAG_PROPQ_ALLOCATED)
+        OPENSSL_free(key->propq);
+    key->propq = newpropq;
+    key->flags |= OQSX_KEY_FLAG_PROPQ_ALLOCATED;
+    return 1;
+}
+
 void oqsx_key_free(OQSX_KEY *key)
 {
     int refcnt;
@@ -722,10 +1176,10 @@ void oqsx_key_free(OQSX_KEY *key)
     if (key == NULL)
         return;
 
+    // keys may be shared between threads: all their uses happen before
+    // the last reference is dropped
     refcnt = atomic_fetch_sub_explicit(&key->references, 1,
-                                       memory_order_relaxed) - 1;
-    if (refcnt == 0)
-        atomic_thread_fence(memory_order_acquire);
+                                       memory_order_acq_rel) - 1;
     OQS_KEY_PRINTF3("%p:%4d:OQSX_KEY\n", (void*)key, refcnt);
     if (refcnt > 0)
         return;
@@ -733,22 +1187,15 @@ void oqsx_key_free(OQSX_KEY *key)
     assert(refcnt == 0);
 #endif
 
-    OPENSSL_free(key->propq);
-    OPENSSL_free(key->tls_name);
-    OPENSSL_secure_clear_free(key->privkey, key->privkeylen);
-    OPENSSL_secure_clear_free(key->pubkey, key->pubkeylen);
-    OPENSSL_free(key->comp_pubkey);
-    OPENSSL_free(key->comp_privkey);
-    if (key->keytype == KEY_TYPE_KEM)
-        OQS_KEM_free(key->oqsx_provider_ctx.oqsx_qs_ctx.kem);
-    else if (key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM) {
-        OQS_KEM_free(key->oqsx_provider_ctx.oqsx_qs_ctx.kem);
-        EVP_PKEY_CTX_free(key->oqsx_provider_ctx.oqsx_evp_ctx->ctx);
-        EVP_PKEY_free(key->oqsx_provider_ctx.oqsx_evp_ctx->keyParam);
-        OPENSSL_free(key->oqsx_provider_ctx.oqsx_evp_ctx);
-    } else
-        OQS_SIG_free(key->oqsx_provider_ctx.oqsx_qs_ctx.sig);
-    OPENSSL_free(key->classical_pkey);
+    if (key->flags & OQSX_KEY_FLAG_PROPQ_ALLOCATED)
+        OPENSSL_free(key->propq);
+    oqsx_slab_clear_free(key->privkey, key->privkeylen);
+    // OQS descriptors and OQSX_EVP_CTX are shared: see oqsx_*_cache_get
+    EVP_PKEY_CTX_free(key->classical_sign_ctx);
+    EVP_PKEY_CTX_free(key->classical_verify_ctx);
+    EVP_PKEY_free(key->classical_pkey);
+    if (key->flags & OQSX_KEY_FLAG_PUBKEY_BORROWED)
+        oqsx_pubstore_free(key->pubkey_store);
     OPENSSL_free(key);
 }
 
@@ -770,13 +1217,11 @@ int oqsx_key_allocate_keymaterial(OQSX_KEY *key, int include_private)
     int ret = 0;
 
     if (!key->privkey && include_private) {
-        key->privkey = OPENSSL_secure_zalloc(key->privkeylen);
+        key->privkey = oqsx_slab_zalloc(key->privkeylen);
         ON_ERR_SET_GOTO(!key->privkey, ret, 1, err);
     }
-    if (!key->pubkey && !include_private) {
-        key->pubkey = OPENSSL_secure_zalloc(key->pubkeylen);
-        ON_ERR_SET_GOTO(!key->pubkey, ret, 1, err);
-    }
+    if (!key->pubkey && !include_private)
+        key->pubkey = key->material;
     err:
     return ret;
 }
@@ -784,42 +1229,42 @@ int oqsx_key_allocate_keymaterial(OQSX_KEY *key, int include_private)
 int oqsx_key_fromdata(OQSX_KEY *key, const OSSL_PARAM params[], int include_private)
 {
     const OSSL_PARAM *p;
+    const void *data;
+    size_t len;
 
+    // octet strings and octet pointers are both fine: data is copied below
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PRIV_KEY);
     if (p != NULL) {
-        if (p->data_type != OSSL_PARAM_OCTET_STRING) {
+        if (!OSSL_PARAM_get_octet_string_ptr(p, &data, &len)) {
             ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
             return 0;
         }
-        if (key->privkeylen != p->data_size) {
+        if (key->privkeylen != len) {
             ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_SIZE);
             return 0;
         }
-        OPENSSL_secure_clear_free(key->privkey, p->data_size);
-        key->privkey = OPENSSL_secure_malloc(p->data_size);
-        if (key->privkey == NULL) {
+        if (oqsx_key_allocate_keymaterial(key, 1)) {
             ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
             return 0;
         }
-        memcpy(key->privkey, p->data, p->data_size);
+        memcpy(key->privkey, data, len);
     }
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PUB_KEY);
     if (p != NULL) {
-        if (p->data_type != OSSL_PARAM_OCTET_STRING) {
+        if (!OSSL_PARAM_get_octet_string_ptr(p, &data, &len)) {
             OQS_KEY_PRINTF("invalid data type\n");
             return 0;
         }
-        if (key->pubkeylen != p->data_size) {
+        if (key->pubkeylen != len) {
             ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_SIZE);
             return 0;
         }
-        OPENSSL_secure_clear_free(key->pubkey, p->data_size);
-        key->pubkey = OPENSSL_secure_malloc(p->data_size);
-        if (key->pubkey == NULL) {
-            ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
-            return 0;
-        }
-        memcpy(key->pubkey, p->data, p->data_size);
+        oqsx_key_allocate_keymaterial(key, 0);
+        memcpy(key->pubkey, data, len);
+    }
+    if (oqsx_key_set_composites(key)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
+        return 0;
     }
     return 1;
 }
@@ -898,7 +1343,7 @@ static EVP_PKEY* oqsx_key_gen_evp_key(OQSX_EVP_CTX *ctx, unsigned char *pubkey,
     return NULL;
 }
 
-/* allocates OQS and classical keys; retains EVP_PKEY on success for sig OQSX_KEY */
+/* allocates OQS and classical keys; retains classical EVP_PKEY on success */
 int oqsx_key_gen(OQSX_KEY *key)
 {
     int ret = 0;
@@ -920,14 +1365,11 @@ int oqsx_key_gen(OQSX_KEY *key)
         ON_ERR_GOTO(ret, err);
         OQS_KEY_PRINTF3("OQSKM: OQSX_KEY privkeylen %ld & pubkeylen: %ld\n", key->privkeylen, key->pubkeylen);
 
-        if (key->keytype == KEY_TYPE_HYB_SIG) {
-           key->classical_pkey = pkey;
+        key->classical_pkey = pkey;
+        if (key->keytype == KEY_TYPE_HYB_SIG)
            ret = oqsx_key_gen_oqs(key, 0);
-	}
-	else {
-           EVP_PKEY_free(pkey);
+	else
            ret = oqsx_key_gen_oqs(key, 1);
-	}
     } else if (key->keytype == KEY_TYPE_SIG) {
         ret = oqsx_key_set_composites(key);
         ON_ERR_GOTO(ret, err);
@@ -943,6 +1385,78 @@ int oqsx_key_gen(OQSX_KEY *key)
     return ret;
 }
 
+/* decoded classic private key of a hybrid key, created on first use and
+ * kept until the key is freed; caller must not free it
+ */
+EVP_PKEY *oqsx_key_get0_classical_privkey(OQSX_KEY *key)
+{
+    EVP_PKEY *pkey = atomic_load_explicit(&key->classical_pkey, memory_order_acquire);
+    EVP_PKEY *newkey = NULL;
+    const OQSX_EVP_INFO *evp_info;
+    const unsigned char *enc_privkey;
+
+    if (pkey != NULL || key->numkeys != 2 || key->privkey == NULL
+        || key->oqsx_provider_ctx.oqsx_evp_ctx == NULL)
+        return pkey;
+
+    evp_info = key->oqsx_provider_ctx.oqsx_evp_ctx->evp_info;
+    enc_privkey = key->comp_privkey[0];
+    if (evp_info->raw_key_support)
+        newkey = EVP_PKEY_new_raw_private_key_ex(key->libctx, OBJ_nid2sn(evp_info->keytype),
+                                                 key->propq, enc_privkey,
+                                                 evp_info->length_private_key);
+    else
+        newkey = d2i_AutoPrivateKey_ex(NULL, &enc_privkey, evp_info->length_private_key,
+                                       key->libctx, key->propq);
+    if (newkey == NULL)
+        return NULL;
+
+    if (atomic_compare_exchange_strong_explicit(&key->classical_pkey, &pkey, newkey,
+                                                memory_order_acq_rel,
+                                                memory_order_acquire))
+        return newkey;
+    EVP_PKEY_free(newkey);
+    return pkey;
+}
+
+/* decoded classic key of a hybrid key, for keys without private key decoded
+ * from their public key on first use (see oqsx_key_new_borrowed); caller
+ * must not free it
+ */
+EVP_PKEY *oqsx_key_get0_classical_pubkey(OQSX_KEY *key)
+{
+    EVP_PKEY *pkey = atomic_load_explicit(&key->classical_pkey, memory_order_acquire);
+    EVP_PKEY *npk, *newkey;
+    const unsigned char *enc_pubkey;
+    uint32_t classical_pubkey_len;
+
+    if (pkey != NULL || key->numkeys != 2 || key->privkey != NULL
+        || key->pubkey == NULL || key->evp_info == NULL || key->evp_info->raw_key_support)
+        return pkey;
+
+    DECODE_UINT32(classical_pubkey_len, key->pubkey);
+    enc_pubkey = key->comp_pubkey[0];
+    if ((npk = EVP_PKEY_new()) == NULL)
+        return NULL;
+    if (key->evp_info->keytype != EVP_PKEY_RSA
+        && setECParams(npk, key->evp_info->nid) == NULL) {
+        EVP_PKEY_free(npk);
+        return NULL;
+    }
+    newkey = d2i_PublicKey(key->evp_info->keytype, &npk, &enc_pubkey, classical_pubkey_len);
+    if (newkey == NULL) {
+        EVP_PKEY_free(npk);
+        return NULL;
+    }
+
+    if (atomic_compare_exchange_strong_explicit(&key->classical_pkey, &pkey, newkey,
+                                                memory_order_acq_rel,
+                                                memory_order_acquire))
+        return newkey;
+    EVP_PKEY_free(newkey);
+    return pkey;
+}
+
 int oqsx_key_secbits(OQSX_KEY *key) {
     return key->bit_security;
 }
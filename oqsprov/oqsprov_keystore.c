@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Bulk export and import of private keys in key store files, see
+ * oqsprovider.h
+ *
+ * Export splits the keys into one contiguous range per thread. Each thread
+ * generates its keys directly as OQSX_KEY, encodes them with an encoder
+ * context of its own into a memory BIO and, whenever that holds enough
+ * data, appends it to the file, filling in the index entries of the keys
+ * it contains. The index is written last. Import decodes ranges of keys
+ * with one decoder context per thread.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/decoder.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include "oqs_prov.h"
+#include "oqsprovider.h"
+
+#ifdef NDEBUG
+#define OQS_KS_PRINTF3(a, b, c)
+#else
+#define OQS_KS_PRINTF3(a, b, c) if (getenv("OQSKS")) printf(a, b, c)
+#endif // NDEBUG
+
+#define OQSX_KEYSTORE_MAGIC     "OQSKEYS1"
+#define OQSX_KEYSTORE_HDRLEN    12 // magic, number of keys
+#define OQSX_KEYSTORE_ENTRYLEN  12 // offset, length
+/* encoded bytes a thread collects before appending them to the file */
+#define OQSX_KEYSTORE_FLUSH     (256 * 1024)
+
+typedef struct {
+    PROV_OQS_CTX *provctx;
+    int nid;
+    size_t n, nranges;
+    unsigned char *index;
+    pthread_mutex_t lock;   // file and end
+    FILE *fp;
+    uint64_t end;
+    _Atomic int failed;
+} OQSX_KEYSTORE_EXPORT;
+
+typedef struct {
+    OSSL_LIB_CTX *libctx;
+    const char *propq;
+    const unsigned char *data;
+    size_t n, nranges;
+    EVP_PKEY **keys;
+    _Atomic size_t decoded;
+} OQSX_KEYSTORE_IMPORT;
+
+static void oqsx_put_uint64(unsigned char *p, uint64_t v)
+{
+    ENCODE_UINT32(p, (uint32_t)(v >> 32));
+    ENCODE_UINT32(p + 4, (uint32_t)v);
+}
+
+static uint64_t oqsx_get_uint64(const unsigned char *p)
+{
+    uint32_t hi, lo;
+
+    DECODE_UINT32(hi, p);
+    DECODE_UINT32(lo, p + 4);
+    return (uint64_t)hi << 32 | lo;
+}
+
+/* appends the keys first..last-1 encoded in mem, whose lengths are indexed */
+static int oqsx_keystore_flush(OQSX_KEYSTORE_EXPORT *ex, BIO *mem,
+                               size_t first, size_t last)
+{
+    char *data;
+    long len = BIO_get_mem_data(mem, &data);
+    unsigned char *entry;
+    uint32_t keylen;
+    int ok;
+
+    if (len == 0)
+        return 1;
+    pthread_mutex_lock(&ex->lock);
+    ok = fwrite(data, 1, len, ex->fp) == (size_t)len;
+    for (; ok && first < last; first++) {
+        entry = ex->index + first * OQSX_KEYSTORE_ENTRYLEN;
+        DECODE_UINT32(keylen, entry + 8);
+        oqsx_put_uint64(entry, ex->end);
+        ex->end += keylen;
+    }
+    pthread_mutex_unlock(&ex->lock);
+    return ok && BIO_reset(mem) > 0;
+}
+
+static void oqsx_keystore_export_range(void *vex, size_t range)
+{
+    OQSX_KEYSTORE_EXPORT *ex = vex;
+    size_t i = range * ex->n / ex->nranges, end = (range + 1) * ex->n / ex->nranges;
+    size_t first = i;
+    void *encctx = oqsx_key2any_newctx(ex->provctx);
+    BIO *mem = BIO_new(BIO_s_secmem()); // cleared on reset and free
+    OQSX_KEY *key;
+    long pending = 0, len;
+    int ok = encctx != NULL && mem != NULL;
+
+    for (; ok && i < end && !ex->failed; i++) {
+        key = oqsx_key_new_from_nid(ex->provctx->libctx, NULL, ex->nid);
+        ok = key != NULL && !oqsx_key_gen(key)
+             && oqsx_key_to_pki_der_bio(encctx, mem, key)
+             && (len = BIO_pending(mem) - pending) > 0;
+        oqsx_key_free(key);
+        if (!ok)
+            break;
+        ENCODE_UINT32(ex->index + i * OQSX_KEYSTORE_ENTRYLEN + 8, (uint32_t)len);
+        if ((pending += len) >= OQSX_KEYSTORE_FLUSH) {
+            ok = oqsx_keystore_flush(ex, mem, first, i + 1);
+            first = i + 1;
+            pending = 0;
+        }
+    }
+    if (ok)
+        ok = oqsx_keystore_flush(ex, mem, first, i);
+    if (!ok)
+        ex->failed = 1;
+    BIO_free(mem);
+    oqsx_key2any_freectx(encctx);
+}
+
+int oqsprov_keystore_export(OSSL_PROVIDER *prov, const char *alg, size_t n,
+                            int nthreads, const char *path)
+{
+    OQSX_KEYSTORE_EXPORT ex;
+    unsigned char hdr[OQSX_KEYSTORE_HDRLEN];
+    size_t indexlen;
+    int fd, ok;
+
+    memset(&ex, 0, sizeof(ex));
+    if ((ex.provctx = oqsx_provctx_of(prov)) == NULL || alg == NULL || path == NULL
+        || n > INT_MAX || !oqsx_objects_init(ex.provctx)
+        || (ex.nid = OBJ_sn2nid(alg)) == NID_undef) {
+        ERR_raise(ERR_LIB_USER, ERR_R_PASSED_INVALID_ARGUMENT);
+        return -1;
+    }
+    indexlen = n * OQSX_KEYSTORE_ENTRYLEN;
+    if ((ex.index = OPENSSL_zalloc(indexlen + 1)) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+        return -1;
+    }
+    // private keys: readable by the owner only, also if the file existed
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0
+        || fchmod(fd, 0600) != 0
+        || (ex.fp = fdopen(fd, "wb")) == NULL) {
+        ERR_raise_data(ERR_LIB_SYS, errno, "calling open(%s)", path);
+        if (fd >= 0)
+            close(fd);
+        OPENSSL_free(ex.index);
+        return -1;
+    }
+    ex.n = n;
+    ex.end = OQSX_KEYSTORE_HDRLEN + indexlen;
+    // one range per thread, so that each thread sets up its contexts once
+    ex.nranges = (size_t)oqsx_thread_count(nthreads);
+    if (ex.nranges > n)
+        ex.nranges = n > 0 ? n : 1;
+    atomic_init(&ex.failed, 0);
+    pthread_mutex_init(&ex.lock, NULL);
+
+    memcpy(hdr, OQSX_KEYSTORE_MAGIC, 8);
+    ENCODE_UINT32(hdr + 8, (uint32_t)n);
+    // index written once complete: skip it
+    ok = fwrite(hdr, 1, sizeof(hdr), ex.fp) == sizeof(hdr)
+         && fseeko(ex.fp, (off_t)ex.end, SEEK_SET) == 0
+         && oqsx_parallel_for(ex.nranges, (int)ex.nranges,
+                              oqsx_keystore_export_range, &ex)
+         && !ex.failed
+         && fseeko(ex.fp, OQSX_KEYSTORE_HDRLEN, SEEK_SET) == 0
+         && fwrite(ex.index, 1, indexlen, ex.fp) == indexlen;
+    OQS_KS_PRINTF3("OQS KS: %zu keys exported to %s\n", ok ? n : 0, path);
+
+    ok = fclose(ex.fp) == 0 && ok;
+    pthread_mutex_destroy(&ex.lock);
+    OPENSSL_free(ex.index);
+    return ok ? (int)n : -1;
+}
+
+static void oqsx_keystore_import_range(void *vim, size_t range)
+{
+    OQSX_KEYSTORE_IMPORT *im = vim;
+    size_t i = range * im->n / im->nranges, end = (range + 1) * im->n / im->nranges;
+    size_t decoded = 0;
+    const unsigned char *entry, *der;
+    uint32_t keylen;
+    size_t derlen;
+    EVP_PKEY *pkey = NULL;
+    OSSL_DECODER_CTX *dctx;
+
+    // decodes into pkey for each key
+    dctx = OSSL_DECODER_CTX_new_for_pkey(&pkey, "DER", "PrivateKeyInfo", NULL,
+                                         OSSL_KEYMGMT_SELECT_KEYPAIR,
+                                         im->libctx, im->propq);
+    for (; dctx != NULL && i < end; i++) {
+        entry = im->data + OQSX_KEYSTORE_HDRLEN + i * OQSX_KEYSTORE_ENTRYLEN;
+        DECODE_UINT32(keylen, entry + 8);
+        der = im->data + oqsx_get_uint64(entry);
+        derlen = keylen;
+        pkey = NULL;
+        if (OSSL_DECODER_from_data(dctx, &der, &derlen) && pkey != NULL) {
+            im->keys[i] = pkey;
+            decoded++;
+        }
+    }
+    OSSL_DECODER_CTX_free(dctx);
+    ERR_clear_error(); // failed keys are reported as NULL
+    atomic_fetch_add_explicit(&im->decoded, decoded, memory_order_relaxed);
+}
+
+/* checks all index entries refer to data within the file */
+static int oqsx_keystore_check(const unsigned char *data, size_t len, size_t *n)
+{
+    const unsigned char *entry;
+    uint64_t offset;
+    uint32_t count, keylen;
+    size_t i;
+
+    if (len < OQSX_KEYSTORE_HDRLEN || memcmp(data, OQSX_KEYSTORE_MAGIC, 8))
+        return 0;
+    DECODE_UINT32(count, data + 8);
+    if (count > (len - OQSX_KEYSTORE_HDRLEN) / OQSX_KEYSTORE_ENTRYLEN)
+        return 0;
+    for (i = 0; i < count; i++) {
+        entry = data + OQSX_KEYSTORE_HDRLEN + i * OQSX_KEYSTORE_ENTRYLEN;
+        offset = oqsx_get_uint64(entry);
+        DECODE_UINT32(keylen, entry + 8);
+        if (offset > len || keylen > len - offset)
+            return 0;
+    }
+    *n = count;
+    return 1;
+}
+
+/* private key data: from the secure heap if it fits, else cleansed when freed */
+static unsigned char *oqsx_keystore_buf_alloc(size_t len)
+{
+    unsigned char *buf = OPENSSL_secure_malloc(len);
+
+    return buf != NULL ? buf : OPENSSL_malloc(len);
+}
+
+static void oqsx_keystore_buf_free(unsigned char *buf, size_t len)
+{
+    if (buf != NULL && CRYPTO_secure_allocated(buf))
+        OPENSSL_secure_clear_free(buf, len);
+    else
+        OPENSSL_clear_free(buf, len);
+}
+
+int oqsprov_keystore_import(OSSL_LIB_CTX *libctx, const char *propq,
+                            const char *path, EVP_PKEY **keys, size_t maxkeys,
+                            int nthreads)
+{
+    OQSX_KEYSTORE_IMPORT im;
+    unsigned char *data = NULL;
+    off_t len = -1;
+    FILE *fp;
+    size_t i;
+    int ok;
+
+    if (path == NULL || (keys == NULL && maxkeys > 0)) {
+        ERR_raise(ERR_LIB_USER, ERR_R_PASSED_INVALID_ARGUMENT);
+        return -1;
+    }
+    if ((fp = fopen(path, "rb")) == NULL) {
+        ERR_raise_data(ERR_LIB_SYS, errno, "calling fopen(%s)", path);
+        return -1;
+    }
+    ok = fseeko(fp, 0, SEEK_END) == 0 && (len = ftello(fp)) >= 0
+         && fseeko(fp, 0, SEEK_SET) == 0
+         && (data = oqsx_keystore_buf_alloc(len + 1)) != NULL
+         && fread(data, 1, len, fp) == (size_t)len;
+    fclose(fp);
+    if (!ok || !oqsx_keystore_check(data, len, &im.n)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
+        oqsx_keystore_buf_free(data, len > 0 ? len : 0);
+        return -1;
+    }
+
+    im.libctx = libctx;
+    im.propq = propq;
+    im.data = data;
+    im.keys = keys;
+    if (im.n > maxkeys)
+        im.n = maxkeys;
+    if (im.n > 0)
+        memset(keys, 0, im.n * sizeof(*keys));
+    im.nranges = (size_t)oqsx_thread_count(nthreads);
+    if (im.nranges > im.n)
+        im.nranges = im.n > 0 ? im.n : 1;
+    atomic_init(&im.decoded, 0);
+
+    ok = oqsx_parallel_for(im.nranges, (int)im.nranges,
+                           oqsx_keystore_import_range, &im);
+    OQS_KS_PRINTF3("OQS KS: %zu keys imported from %s\n", atomic_load(&im.decoded), path);
+    oqsx_keystore_buf_free(data, len);
+    if (!ok) {
+        // some ranges may have been decoded: return none
+        for (i = 0; i < im.n; i++) {
+            EVP_PKEY_free(keys[i]);
+            keys[i] = NULL;
+        }
+        return -1;
+    }
+    return (int)atomic_load(&im.decoded);
+}
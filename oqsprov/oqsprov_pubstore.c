@@ -0,0 +1,371 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Memory-mapped public key stores, see oqsprovider.h
+ *
+ * The store loader maps the file read-only and hands out one key per record,
+ * whose pubkey points into the mapping: loading a key allocates just the
+ * OQSX_KEY and its EVP_PKEY, and pages of the file are only read when their
+ * keys are used. Each key holds a reference to the mapping, which is removed
+ * once the loader and all keys are gone.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/core_object.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include "oqs_prov.h"
+#include "oqsprovider.h"
+
+#ifdef NDEBUG
+#define OQS_PKS_PRINTF3(a, b, c)
+#else
+#define OQS_PKS_PRINTF3(a, b, c) if (getenv("OQSPKS")) printf(a, b, c)
+#endif // NDEBUG
+
+#define OQSX_PUBSTORE_MAGIC     "OQSPKS01"
+#define OQSX_PUBSTORE_HDRLEN    16 // magic, number of groups, number of keys
+#define OQSX_PUBSTORE_ENTRYLEN  48 // offset, count, record length, OID
+#define OQSX_PUBSTORE_OIDMAX    31
+#define OQSX_PUBSTORE_ALIGN     8
+
+struct oqsx_pubstore_st {
+    _Atomic int references;
+    unsigned char *map;
+    size_t len;
+};
+
+typedef struct {
+    PROV_OQS_CTX *provctx;
+    OQSX_PUBSTORE *store;
+    uint32_t ngroups, group; // group of next key
+    uint32_t idx;            // its record in the group
+    int nid;                 // of group, NID_undef until resolved
+    int failed;
+} OQSX_PUBSTORE_CTX;
+
+static void oqsx_put_uint64(unsigned char *p, uint64_t v)
+{
+    ENCODE_UINT32(p, (uint32_t)(v >> 32));
+    ENCODE_UINT32(p + 4, (uint32_t)v);
+}
+
+static uint64_t oqsx_get_uint64(const unsigned char *p)
+{
+    uint32_t hi, lo;
+
+    DECODE_UINT32(hi, p);
+    DECODE_UINT32(lo, p + 4);
+    return (uint64_t)hi << 32 | lo;
+}
+
+void oqsx_pubstore_up_ref(OQSX_PUBSTORE *store)
+{
+    atomic_fetch_add_explicit(&store->references, 1, memory_order_relaxed);
+}
+
+void oqsx_pubstore_free(OQSX_PUBSTORE *store)
+{
+    if (store == NULL
+        || atomic_fetch_sub_explicit(&store->references, 1, memory_order_acq_rel) > 1)
+        return;
+    munmap(store->map, store->len);
+    OPENSSL_free(store);
+}
+
+/* checks all groups refer to records within the file */
+static int oqsx_pubstore_check(const unsigned char *data, size_t len, uint32_t *ngroups)
+{
+    const unsigned char *entry;
+    uint64_t offset, total = 0;
+    uint32_t groups, keys, count, reclen;
+    size_t i;
+
+    if (len < OQSX_PUBSTORE_HDRLEN || memcmp(data, OQSX_PUBSTORE_MAGIC, 8))
+        return 0;
+    DECODE_UINT32(groups, data + 8);
+    DECODE_UINT32(keys, data + 12);
+    if (groups > (len - OQSX_PUBSTORE_HDRLEN) / OQSX_PUBSTORE_ENTRYLEN)
+        return 0;
+    for (i = 0; i < groups; i++) {
+        entry = data + OQSX_PUBSTORE_HDRLEN + i * OQSX_PUBSTORE_ENTRYLEN;
+        offset = oqsx_get_uint64(entry);
+        DECODE_UINT32(count, entry + 8);
+        DECODE_UINT32(reclen, entry + 12);
+        if (entry[16] == 0 || entry[16] > OQSX_PUBSTORE_OIDMAX
+            || offset > len || (count > 0 && (reclen == 0 || count > (len - offset) / reclen)))
+            return 0;
+        total += count;
+    }
+    if (total != keys)
+        return 0;
+    *ngroups = groups;
+    return 1;
+}
+
+/* nid of the OID of group entry */
+static int oqsx_pubstore_nid(const unsigned char *entry)
+{
+    unsigned char der[2 + OQSX_PUBSTORE_OIDMAX];
+    const unsigned char *p = der;
+    ASN1_OBJECT *obj;
+    int nid;
+
+    der[0] = V_ASN1_OBJECT;
+    der[1] = entry[16];
+    memcpy(der + 2, entry + 17, entry[16]);
+    if ((obj = d2i_ASN1_OBJECT(NULL, &p, 2 + entry[16])) == NULL)
+        return NID_undef;
+    nid = OBJ_obj2nid(obj);
+    ASN1_OBJECT_free(obj);
+    return nid;
+}
+
+/* moves past groups without (further) records */
+static void oqsx_pubstore_skip(OQSX_PUBSTORE_CTX *ctx)
+{
+    uint32_t count;
+
+    for (; ctx->group < ctx->ngroups; ctx->group++, ctx->idx = 0, ctx->nid = NID_undef) {
+        DECODE_UINT32(count, ctx->store->map + OQSX_PUBSTORE_HDRLEN
+                             + ctx->group * OQSX_PUBSTORE_ENTRYLEN + 8);
+        if (ctx->idx < count)
+            break;
+    }
+}
+
+static void *oqsx_pubstore_open(void *provctx, const char *uri)
+{
+    const char *path = uri;
+    size_t schemelen = strlen(OQSPROV_PUBKEY_STORE_SCHEME);
+    OQSX_PUBSTORE_CTX *ctx = NULL;
+    OQSX_PUBSTORE *store = NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    uint32_t ngroups;
+    int fd;
+
+    if (!strncmp(uri, OQSPROV_PUBKEY_STORE_SCHEME, schemelen) && uri[schemelen] == ':')
+        path = uri + schemelen + 1;
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        ERR_raise_data(ERR_LIB_SYS, errno, "calling open(%s)", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || !oqsx_pubstore_check(map, (size_t)st.st_size, &ngroups)) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_ENCODING);
+        goto err;
+    }
+    if ((store = OPENSSL_zalloc(sizeof(*store))) == NULL
+        || (ctx = OPENSSL_zalloc(sizeof(*ctx))) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+    store->references = 1;
+    store->map = map;
+    store->len = (size_t)st.st_size;
+    ctx->provctx = provctx;
+    ctx->store = store;
+    ctx->ngroups = ngroups;
+    oqsx_pubstore_skip(ctx);
+    OQS_PKS_PRINTF3("OQS PKS: %u groups of keys in %s\n", ngroups, path);
+    return ctx;
+
+ err:
+    OPENSSL_free(store);
+    if (map != MAP_FAILED)
+        munmap(map, (size_t)st.st_size);
+    return NULL;
+}
+
+static int oqsx_pubstore_load(void *vctx, OSSL_CALLBACK *object_cb, void *object_cbarg,
+                              OSSL_PASSPHRASE_CALLBACK *pw_cb, void *pw_cbarg)
+{
+    OQSX_PUBSTORE_CTX *ctx = vctx;
+    const unsigned char *entry;
+    OQSX_KEY *key;
+    OSSL_PARAM params[4];
+    int object_type = OSSL_OBJECT_PKEY, ok;
+    uint32_t reclen;
+
+    if (ctx->failed || ctx->group >= ctx->ngroups)
+        return 0;
+    entry = ctx->store->map + OQSX_PUBSTORE_HDRLEN + ctx->group * OQSX_PUBSTORE_ENTRYLEN;
+    DECODE_UINT32(reclen, entry + 12);
+    if (ctx->nid == NID_undef)
+        ctx->nid = oqsx_pubstore_nid(entry);
+    key = oqsx_key_new_borrowed(ctx->provctx->libctx, ctx->nid,
+                                ctx->store->map + oqsx_get_uint64(entry)
+                                + (size_t)ctx->idx * reclen,
+                                reclen, ctx->store);
+    if (key == NULL) {
+        ctx->failed = 1;
+        return 0;
+    }
+    ctx->idx++;
+    oqsx_pubstore_skip(ctx);
+
+    params[0] = OSSL_PARAM_construct_int(OSSL_OBJECT_PARAM_TYPE, &object_type);
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_OBJECT_PARAM_DATA_TYPE,
+                                                 (char *)key->tls_name, 0);
+    /* The address of the key becomes the octet string */
+    params[2] = OSSL_PARAM_construct_octet_string(OSSL_OBJECT_PARAM_REFERENCE,
+                                                  &key, sizeof(key));
+    params[3] = OSSL_PARAM_construct_end();
+    ok = object_cb(params, object_cbarg);
+    oqsx_key_free(key); // NULL if taken over by oqsx_load
+    return ok;
+}
+
+static int oqsx_pubstore_eof(void *vctx)
+{
+    OQSX_PUBSTORE_CTX *ctx = vctx;
+
+    return ctx->failed || ctx->group >= ctx->ngroups;
+}
+
+static int oqsx_pubstore_close(void *vctx)
+{
+    OQSX_PUBSTORE_CTX *ctx = vctx;
+
+    oqsx_pubstore_free(ctx->store);
+    OPENSSL_free(ctx);
+    return 1;
+}
+
+const OSSL_DISPATCH oqs_pubkey_store_functions[] = {
+    { OSSL_FUNC_STORE_OPEN, (void (*)(void))oqsx_pubstore_open },
+    { OSSL_FUNC_STORE_LOAD, (void (*)(void))oqsx_pubstore_load },
+    { OSSL_FUNC_STORE_EOF, (void (*)(void))oqsx_pubstore_eof },
+    { OSSL_FUNC_STORE_CLOSE, (void (*)(void))oqsx_pubstore_close },
+    { 0, NULL }
+};
+
+typedef struct {
+    int nid;
+    const unsigned char *aid; // DER AlgorithmIdentifier, shared
+    uint32_t count, reclen;
+    uint64_t offset;
+} OQSX_PUBSTORE_GROUP;
+
+/* group of key in groups, added if new; NULL if key is none of ours */
+static OQSX_PUBSTORE_GROUP *oqsx_pubstore_group(OQSX_PUBSTORE_GROUP **groups,
+                                                size_t *ngroups, EVP_PKEY *key)
+{
+    const char *name = EVP_PKEY_get0_type_name(key);
+    const unsigned char *aid;
+    OQSX_PUBSTORE_GROUP *g;
+    size_t aidlen, reclen, i;
+    int nid;
+
+    if (name == NULL || (nid = OBJ_sn2nid(name)) == NID_undef)
+        return NULL;
+    for (i = 0; i < *ngroups; i++)
+        if ((*groups)[i].nid == nid)
+            return &(*groups)[i];
+    // SEQUENCE { OID } of a signature algorithm of ours, short lengths
+    if (oqsx_provctx_of(EVP_PKEY_get0_provider(key)) == NULL
+        || (aid = oqsx_get_aid(name, &aidlen)) == NULL || aidlen < 4
+        || aid[3] > OQSX_PUBSTORE_OIDMAX || aidlen != 4 + (size_t)aid[3]
+        || !EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, NULL, 0, &reclen)
+        || reclen == 0 || reclen > UINT32_MAX)
+        return NULL;
+    if ((g = OPENSSL_realloc(*groups, (*ngroups + 1) * sizeof(*g))) == NULL)
+        return NULL;
+    *groups = g;
+    g += (*ngroups)++;
+    memset(g, 0, sizeof(*g));
+    g->nid = nid;
+    g->aid = aid;
+    g->reclen = (uint32_t)reclen;
+    return g;
+}
+
+int oqsprov_pubkey_store_write(const char *path, EVP_PKEY *const *keys, size_t n)
+{
+    OQSX_PUBSTORE_GROUP *groups = NULL, *g;
+    unsigned char hdr[OQSX_PUBSTORE_HDRLEN], *index = NULL, *rec = NULL, *entry;
+    static const unsigned char pad[OQSX_PUBSTORE_ALIGN];
+    size_t ngroups = 0, maxlen = 0, len, i, j;
+    uint64_t end;
+    FILE *fp = NULL;
+    int ok = 0;
+
+    if (path == NULL || (keys == NULL && n > 0) || n > UINT32_MAX) {
+        ERR_raise(ERR_LIB_USER, ERR_R_PASSED_INVALID_ARGUMENT);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (keys[i] == NULL || (g = oqsx_pubstore_group(&groups, &ngroups, keys[i])) == NULL) {
+            ERR_raise(ERR_LIB_USER, OQSPROV_R_WRONG_PARAMETERS);
+            goto err;
+        }
+        g->count++;
+        if (g->reclen > maxlen)
+            maxlen = g->reclen;
+    }
+
+    // lay out the records of each group behind the index
+    end = OQSX_PUBSTORE_HDRLEN + (uint64_t)ngroups * OQSX_PUBSTORE_ENTRYLEN;
+    if ((index = OPENSSL_zalloc(ngroups * OQSX_PUBSTORE_ENTRYLEN + 1)) == NULL
+        || (rec = OPENSSL_malloc(maxlen + 1)) == NULL) {
+        ERR_raise(ERR_LIB_USER, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+    for (j = 0; j < ngroups; j++) {
+        g = &groups[j];
+        end = (end + OQSX_PUBSTORE_ALIGN - 1) & ~(uint64_t)(OQSX_PUBSTORE_ALIGN - 1);
+        g->offset = end;
+        end += (uint64_t)g->count * g->reclen;
+        entry = index + j * OQSX_PUBSTORE_ENTRYLEN;
+        oqsx_put_uint64(entry, g->offset);
+        ENCODE_UINT32(entry + 8, g->count);
+        ENCODE_UINT32(entry + 12, g->reclen);
+        entry[16] = g->aid[3];
+        memcpy(entry + 17, g->aid + 4, g->aid[3]);
+    }
+    memcpy(hdr, OQSX_PUBSTORE_MAGIC, 8);
+    ENCODE_UINT32(hdr + 8, (uint32_t)ngroups);
+    ENCODE_UINT32(hdr + 12, (uint32_t)n);
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        ERR_raise_data(ERR_LIB_SYS, errno, "calling fopen(%s)", path);
+        goto err;
+    }
+    ok = fwrite(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)
+         && fwrite(index, 1, ngroups * OQSX_PUBSTORE_ENTRYLEN, fp)
+            == ngroups * OQSX_PUBSTORE_ENTRYLEN;
+    end = OQSX_PUBSTORE_HDRLEN + (uint64_t)ngroups * OQSX_PUBSTORE_ENTRYLEN;
+    for (j = 0; ok && j < ngroups; j++) {
+        g = &groups[j];
+        ok = fwrite(pad, 1, g->offset - end, fp) == g->offset - end;
+        for (i = 0; ok && i < n; i++)
+            if (OBJ_sn2nid(EVP_PKEY_get0_type_name(keys[i])) == g->nid)
+                ok = EVP_PKEY_get_octet_string_param(keys[i], OSSL_PKEY_PARAM_PUB_KEY,
+                                                     rec, g->reclen, &len)
+                     && len == g->reclen
+                     && fwrite(rec, 1, len, fp) == len;
+        end = g->offset + (uint64_t)g->count * g->reclen;
+    }
+    ok = fclose(fp) == 0 && ok;
+    OQS_PKS_PRINTF3("OQS PKS: %zu keys written to %s\n", ok ? n : 0, path);
+
+ err:
+    OPENSSL_free(rec);
+    OPENSSL_free(index);
+    OPENSSL_free(groups);
+    return ok ? (int)n : -1;
+}
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Slab allocator for private key buffers.
+ *
+ * Buffers of one size, i.e., of one algorithm, form a class. A class carves
+ * its buffers out of chunks taken from the secure heap, keeps released ones
+ * in a mutex-protected depot and lets each thread hold a few in a local
+ * cache, so that most key allocations take no lock at all, in particular
+ * not the secure heap's global one. Buffers are zeroized when released and
+ * handed out zeroed. Chunks are returned to the secure heap when the last
+ * provider instance is torn down.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "oqs_prov.h"
+
+#ifdef NDEBUG
+#define OQS_SLAB_PRINTF3(a, b, c)
+#else
+#define OQS_SLAB_PRINTF3(a, b, c) if (getenv("OQSSLAB")) printf(a, b, c)
+#endif // NDEBUG
+
+#define OQSX_SLAB_MAX_CLASSES 64
+#define OQSX_SLAB_ALIGN       16
+#define OQSX_SLAB_CHUNK_BYTES (64 * 1024) // buffers per chunk: as many as fit, at least 1...
+#define OQSX_SLAB_CHUNK_MAX   64          // ...but no more than this
+#define OQSX_SLAB_TCACHE_MAX  8           // buffers per class and thread
+
+typedef struct oqsx_slab_buf_st {
+    struct oqsx_slab_buf_st *next; // while free; cleared when handed out
+} OQSX_SLAB_BUF;
+
+typedef struct oqsx_slab_chunk_st {
+    struct oqsx_slab_chunk_st *next;
+    size_t len;
+} OQSX_SLAB_CHUNK;
+
+#define OQSX_SLAB_CHUNK_HDR \
+    ((sizeof(OQSX_SLAB_CHUNK) + OQSX_SLAB_ALIGN - 1) & ~(size_t)(OQSX_SLAB_ALIGN - 1))
+
+typedef struct oqsx_slab_class_st {
+    size_t size;              // requested buffer size
+    size_t bufsize;           // aligned size of buffers in chunks
+    pthread_mutex_t lock;     // protects depot and chunks
+    OQSX_SLAB_BUF *depot;
+    OQSX_SLAB_CHUNK *chunks;
+} OQSX_SLAB_CLASS;
+
+typedef struct {
+    OQSX_SLAB_BUF *head;
+    int count;
+    unsigned int epoch;       // cache is stale unless equal to slab_epoch
+} OQSX_SLAB_TCACHE;
+
+static OQSX_SLAB_CLASS slab_classes[OQSX_SLAB_MAX_CLASSES];
+static _Atomic int slab_nclasses = 0;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER; // class creation
+/* bumped on teardown: caches of other threads then hold freed memory */
+static _Atomic unsigned int slab_epoch = 1;
+static pthread_key_t slab_tkey;
+static int slab_tkey_set = 0;
+
+static _Thread_local OQSX_SLAB_TCACHE slab_tcache[OQSX_SLAB_MAX_CLASSES];
+static _Thread_local unsigned int slab_tkey_epoch = 0;
+
+static void oqsx_slab_depot_put(OQSX_SLAB_CLASS *cls, OQSX_SLAB_BUF *head,
+                                OQSX_SLAB_BUF *tail)
+{
+    pthread_mutex_lock(&cls->lock);
+    tail->next = cls->depot;
+    cls->depot = head;
+    pthread_mutex_unlock(&cls->lock);
+}
+
+/* thread exit: hand cached buffers back */
+static void oqsx_slab_thread_stop(void *unused)
+{
+    unsigned int epoch = atomic_load(&slab_epoch);
+    OQSX_SLAB_TCACHE *tc;
+    OQSX_SLAB_BUF *tail;
+    int i;
+
+    for (i = 0; i < atomic_load(&slab_nclasses); i++) {
+        tc = &slab_tcache[i];
+        if (tc->epoch != epoch || tc->head == NULL)
+            continue;
+        for (tail = tc->head; tail->next != NULL; tail = tail->next)
+            ;
+        oqsx_slab_depot_put(&slab_classes[i], tc->head, tail);
+        tc->head = NULL;
+        tc->count = 0;
+    }
+}
+
+/* makes thread_stop run for this thread, once per epoch */
+static void oqsx_slab_thread_start(unsigned int epoch)
+{
+    if (slab_tkey_epoch == epoch)
+        return;
+    pthread_mutex_lock(&slab_lock);
+    if (!slab_tkey_set)
+        slab_tkey_set = pthread_key_create(&slab_tkey, oqsx_slab_thread_stop) == 0;
+    if (slab_tkey_set)
+        pthread_setspecific(slab_tkey, &slab_tkey); // any non-NULL value
+    pthread_mutex_unlock(&slab_lock);
+    slab_tkey_epoch = epoch;
+}
+
+/* returns index of class for size, creating it if needed; -1 if table full */
+static int oqsx_slab_class_get(size_t size)
+{
+    int i, n = atomic_load_explicit(&slab_nclasses, memory_order_acquire);
+
+    for (i = 0; i < n; i++)
+        if (slab_classes[i].size == size)
+            return i;
+
+    pthread_mutex_lock(&slab_lock);
+    n = atomic_load_explicit(&slab_nclasses, memory_order_relaxed);
+    for (; i < n; i++) // created meanwhile?
+        if (slab_classes[i].size == size)
+            break;
+    if (i == n && n < OQSX_SLAB_MAX_CLASSES) {
+        slab_classes[i].size = size;
+        slab_classes[i].bufsize = (size + OQSX_SLAB_ALIGN - 1) & ~(size_t)(OQSX_SLAB_ALIGN - 1);
+        pthread_mutex_init(&slab_classes[i].lock, NULL);
+        atomic_store_explicit(&slab_nclasses, n + 1, memory_order_release);
+        OQS_SLAB_PRINTF3("OQS SLAB: class %d for %zu byte buffers\n", i, size);
+    }
+    pthread_mutex_unlock(&slab_lock);
+    return i < OQSX_SLAB_MAX_CLASSES ? i : -1;
+}
+
+/* cls->lock held; adds a chunk of free buffers to the depot */
+static int oqsx_slab_grow(OQSX_SLAB_CLASS *cls)
+{
+    size_t n = OQSX_SLAB_CHUNK_BYTES / cls->bufsize, i;
+    OQSX_SLAB_CHUNK *chunk = NULL;
+    OQSX_SLAB_BUF *buf;
+    unsigned char *p;
+
+    if (n > OQSX_SLAB_CHUNK_MAX)
+        n = OQSX_SLAB_CHUNK_MAX;
+    if (n == 0)
+        n = 1;
+    // a small secure heap may not have room for a full chunk
+    while ((chunk = OPENSSL_secure_zalloc(OQSX_SLAB_CHUNK_HDR + n * cls->bufsize)) == NULL
+           && n > 1)
+        n /= 2;
+    if (chunk == NULL)
+        return 0;
+    chunk->len = OQSX_SLAB_CHUNK_HDR + n * cls->bufsize;
+    chunk->next = cls->chunks;
+    cls->chunks = chunk;
+
+    p = (unsigned char *)chunk + OQSX_SLAB_CHUNK_HDR;
+    for (i = 0; i < n; i++, p += cls->bufsize) {
+        buf = (OQSX_SLAB_BUF *)p;
+        buf->next = cls->depot;
+        cls->depot = buf;
+    }
+    OQSX_STATS_ADD(OQSX_STAT_SLAB_BYTES, chunk->len);
+    return 1;
+}
+
+void *oqsx_slab_zalloc(size_t size)
+{
+    unsigned int epoch = atomic_load_explicit(&slab_epoch, memory_order_relaxed);
+    OQSX_SLAB_TCACHE *tc;
+    OQSX_SLAB_CLASS *cls;
+    OQSX_SLAB_BUF *buf;
+    int idx;
+
+    if (size < sizeof(OQSX_SLAB_BUF) || (idx = oqsx_slab_class_get(size)) < 0)
+        return OPENSSL_secure_zalloc(size);
+    cls = &slab_classes[idx];
+    tc = &slab_tcache[idx];
+    if (tc->epoch != epoch) {
+        tc->head = NULL;
+        tc->count = 0;
+        tc->epoch = epoch;
+    }
+
+    if ((buf = tc->head) != NULL) {
+        tc->head = buf->next;
+        tc->count--;
+        OQSX_STATS_ADD(OQSX_STAT_SLAB_CACHE_HITS, 1);
+    } else {
+        pthread_mutex_lock(&cls->lock);
+        if (cls->depot == NULL && !oqsx_slab_grow(cls)) {
+            pthread_mutex_unlock(&cls->lock);
+            return NULL;
+        }
+        buf = cls->depot;
+        cls->depot = buf->next;
+        pthread_mutex_unlock(&cls->lock);
+    }
+    buf->next = NULL; // rest of buffer zeroized on release
+    OQSX_STATS_ADD(OQSX_STAT_SLAB_IN_USE, 1);
+    return buf;
+}
+
+void oqsx_slab_clear_free(void *ptr, size_t size)
+{
+    unsigned int epoch = atomic_load_explicit(&slab_epoch, memory_order_relaxed);
+    OQSX_SLAB_TCACHE *tc;
+    OQSX_SLAB_BUF *buf = ptr, *tail;
+    int idx, i;
+
+    if (ptr == NULL)
+        return;
+    if (size < sizeof(OQSX_SLAB_BUF) || (idx = oqsx_slab_class_get(size)) < 0) {
+        OPENSSL_secure_clear_free(ptr, size);
+        return;
+    }
+    OPENSSL_cleanse(ptr, size);
+    OQSX_STATS_ADD(OQSX_STAT_SLAB_IN_USE, -1);
+
+    tc = &slab_tcache[idx];
+    if (tc->epoch != epoch) {
+        tc->head = NULL;
+        tc->count = 0;
+        tc->epoch = epoch;
+    }
+    oqsx_slab_thread_start(epoch);
+    buf->next = tc->head;
+    tc->head = buf;
+    if (++tc->count <= OQSX_SLAB_TCACHE_MAX)
+        return;
+
+    // cache full: move half of it to depot
+    for (tail = buf, i = 1; i < OQSX_SLAB_TCACHE_MAX / 2; i++)
+        tail = tail->next;
+    tc->head = tail->next;
+    tc->count -= OQSX_SLAB_TCACHE_MAX / 2;
+    oqsx_slab_depot_put(&slab_classes[idx], buf, tail);
+}
+
+void oqsx_slab_free_all(void)
+{
+    OQSX_SLAB_CHUNK *chunk;
+    int i;
+
+    pthread_mutex_lock(&slab_lock);
+    atomic_fetch_add(&slab_epoch, 1);
+    for (i = 0; i < atomic_load(&slab_nclasses); i++) {
+        while ((chunk = slab_classes[i].chunks) != NULL) {
+            slab_classes[i].chunks = chunk->next;
+            OQSX_STATS_ADD(OQSX_STAT_SLAB_BYTES, -chunk->len);
+            OPENSSL_secure_clear_free(chunk, chunk->len);
+        }
+        slab_classes[i].depot = NULL;
+        pthread_mutex_destroy(&slab_classes[i].lock);
+    }
+    atomic_store(&slab_nclasses, 0);
+    // no destructor calls into this module once it may be unloaded
+    if (slab_tkey_set)
+        pthread_key_delete(slab_tkey);
+    slab_tkey_set = 0;
+    pthread_mutex_unlock(&slab_lock);
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Optional run-time counters, enabled with -DOQS_PROVIDER_STATS=ON and
+ * retrievable as unsigned integer provider parameters (OSSL_PROVIDER_get_params).
+ */
+
+#include <openssl/params.h>
+#include <time.h>
+#include "oqs_prov.h"
+
+#ifdef OQS_PROVIDER_STATS
+
+_Atomic uint64_t oqsx_stats[OQSX_STAT_MAX];
+
+/* indexed by oqsx_stat_t */
+static const char *oqsx_stat_names[OQSX_STAT_MAX] = {
+    OQS_PROV_PARAM_STAT_KEM_HYB_OPS,
+    OQS_PROV_PARAM_STAT_KEM_CLASSICAL_NS,
+    OQS_PROV_PARAM_STAT_KEM_QS_NS,
+    OQS_PROV_PARAM_STAT_PARAM_COPY_BYTES,
+    OQS_PROV_PARAM_STAT_PARAM_REF_BYTES,
+    OQS_PROV_PARAM_STAT_SLAB_BYTES,
+    OQS_PROV_PARAM_STAT_SLAB_IN_USE,
+    OQS_PROV_PARAM_STAT_SLAB_CACHE_HITS,
+    OQS_PROV_PARAM_STAT_ENCODE_COPY_BYTES,
+};
+
+uint64_t oqsx_stats_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int oqsx_stats_get_params(OSSL_PARAM params[])
+{
+    OSSL_PARAM *p;
+    int i;
+
+    for (i = 0; i < OQSX_STAT_MAX; i++) {
+        p = OSSL_PARAM_locate(params, oqsx_stat_names[i]);
+        if (p != NULL && !OSSL_PARAM_set_uint64(p, atomic_load_explicit(&oqsx_stats[i], memory_order_relaxed)))
+            return 0;
+    }
+    return 1;
+}
+
+#endif
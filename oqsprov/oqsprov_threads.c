@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Persistent worker thread pool for spreading independent work items.
+ *
+ * Callers submit a job of n items and take part in processing it; idle
+ * workers join in, up to the concurrency requested for the job. Background
+ * jobs are run by a worker alone, without the caller waiting for them.
+ * Workers are started on demand and live until the last provider instance
+ * is torn down. A child process created by fork() has none of them: it
+ * starts over with an empty pool.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include "oqs_prov.h"
+
+#ifdef NDEBUG
+#define OQS_THR_PRINTF(a)
+#define OQS_THR_PRINTF2(a, b)
+#else
+#define OQS_THR_PRINTF(a) if (getenv("OQSTHR")) printf(a)
+#define OQS_THR_PRINTF2(a, b) if (getenv("OQSTHR")) printf(a, b)
+#endif // NDEBUG
+
+#define OQSX_MAX_THREADS 64
+
+typedef struct oqsx_job_st {
+    oqsx_task_fn fn;
+    void *arg;
+    size_t n;
+    size_t next;        // next item to hand out
+    size_t finished;    // items completed
+    int active;         // threads currently working on job, incl. caller
+    int maxactive;
+    int background;     // allocated by oqsx_run_async, freed when done
+    struct oqsx_job_st *nextjob;
+} OQSX_JOB;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t pool_threads[OQSX_MAX_THREADS];
+static int pool_nthreads = 0;
+static int pool_shutdown = 0;
+static OQSX_JOB *pool_jobs = NULL;
+static pthread_once_t pool_atfork_once = PTHREAD_ONCE_INIT;
+
+static void *oqsx_pool_worker(void *unused);
+
+/* fork() with pool_lock held, so that the child finds a consistent pool */
+static void oqsx_pool_prepare(void)
+{
+    pthread_mutex_lock(&pool_lock);
+}
+
+static void oqsx_pool_parent(void)
+{
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* child: the workers and threads waiting for jobs were not copied */
+static void oqsx_pool_child(void)
+{
+    OQSX_JOB *job;
+
+    // jobs of parallel_for callers live on their stacks, which are gone
+    while ((job = pool_jobs) != NULL) {
+        pool_jobs = job->nextjob;
+        if (job->background)
+            OPENSSL_free(job);
+    }
+    pool_nthreads = 0;
+    pool_shutdown = 0;
+    pthread_cond_init(&pool_work, NULL);
+    pthread_cond_init(&pool_done, NULL);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void oqsx_pool_atfork(void)
+{
+    pthread_atfork(oqsx_pool_prepare, oqsx_pool_parent, oqsx_pool_child);
+}
+
+/* pool_lock held; returns job with unassigned items a thread may join */
+static OQSX_JOB *oqsx_pool_find_job(void)
+{
+    OQSX_JOB *job;
+
+    for (job = pool_jobs; job != NULL; job = job->nextjob)
+        if (job->next < job->n && job->active < job->maxactive)
+            return job;
+    return NULL;
+}
+
+/* pool_lock held */
+static void oqsx_pool_unlink(OQSX_JOB *job)
+{
+    OQSX_JOB **pj;
+
+    for (pj = &pool_jobs; *pj != job; pj = &(*pj)->nextjob)
+        ;
+    *pj = job->nextjob;
+}
+
+/* pool_lock held; start workers so that pool has at least n */
+static void oqsx_pool_grow(int n)
+{
+    if (pool_nthreads < n)
+        pthread_once(&pool_atfork_once, oqsx_pool_atfork);
+    while (pool_nthreads < n && !pool_shutdown) {
+        if (pthread_create(&pool_threads[pool_nthreads], NULL, oqsx_pool_worker, NULL) != 0)
+            break;
+        pool_nthreads++;
+        OQS_THR_PRINTF2("OQS THR: started worker %d\n", pool_nthreads);
+    }
+}
+
+/* pool_lock held; process items of job until none left to hand out */
+static void oqsx_pool_work_on(OQSX_JOB *job)
+{
+    size_t i;
+
+    while (job->next < job->n) {
+        i = job->next++;
+        pthread_mutex_unlock(&pool_lock);
+        job->fn(job->arg, i);
+        pthread_mutex_lock(&pool_lock);
+        if (++job->finished == job->n)
+            pthread_cond_broadcast(&pool_done);
+    }
+}
+
+static void *oqsx_pool_worker(void *unused)
+{
+    OQSX_JOB *job;
+
+    pthread_mutex_lock(&pool_lock);
+    while (!pool_shutdown) {
+        if ((job = oqsx_pool_find_job()) == NULL) {
+            pthread_cond_wait(&pool_work, &pool_lock);
+            continue;
+        }
+        job->active++;
+        oqsx_pool_work_on(job);
+        job->active--;
+        if (job->background && job->finished == job->n) {
+            oqsx_pool_unlink(job);
+            OPENSSL_free(job);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+int oqsx_thread_count(int nthreads)
+{
+    long ncpu = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads <= 0)
+        nthreads = ncpu > 0 ? (int)ncpu : 1;
+    return nthreads > OQSX_MAX_THREADS ? OQSX_MAX_THREADS : nthreads;
+}
+
+int oqsx_parallel_for(size_t n, int nthreads, oqsx_task_fn fn, void *arg)
+{
+    OQSX_JOB job = { fn, arg, n, 0, 0, 1, 0, 0, NULL };
+
+    nthreads = oqsx_thread_count(nthreads);
+    if (nthreads == 1 || n <= 1) {
+        for (job.next = 0; job.next < n; job.next++)
+            fn(arg, job.next);
+        return 1;
+    }
+    job.maxactive = nthreads;
+
+    pthread_mutex_lock(&pool_lock);
+    // caller works, too: pool needs nthreads-1 workers
+    oqsx_pool_grow(nthreads - 1);
+    job.nextjob = pool_jobs;
+    pool_jobs = &job;
+    pthread_cond_broadcast(&pool_work);
+
+    oqsx_pool_work_on(&job);
+    job.active--;
+    while (job.finished < n)
+        pthread_cond_wait(&pool_done, &pool_lock);
+
+    oqsx_pool_unlink(&job);
+    pthread_mutex_unlock(&pool_lock);
+    return 1;
+}
+
+int oqsx_run_async(oqsx_task_fn fn, void *arg)
+{
+    OQSX_JOB *job = OPENSSL_zalloc(sizeof(*job));
+    int ret = 0;
+
+    if (job == NULL)
+        return 0;
+    job->fn = fn;
+    job->arg = arg;
+    job->n = 1;
+    job->maxactive = 1;
+    job->background = 1;
+
+    pthread_mutex_lock(&pool_lock);
+    oqsx_pool_grow(1);
+    if (pool_nthreads > 0 && !pool_shutdown) {
+        job->nextjob = pool_jobs;
+        pool_jobs = job;
+        pthread_cond_broadcast(&pool_work);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (!ret)
+        OPENSSL_free(job);
+    return ret;
+}
+
+void oqsx_thread_pool_free(void)
+{
+    int i, n;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_shutdown = 1;
+    n = pool_nthreads;
+    pthread_cond_broadcast(&pool_work);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (i = 0; i < n; i++)
+        pthread_join(pool_threads[i], NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    // background jobs not run: their owners, provider instances, are gone
+    while (pool_jobs != NULL) {
+        OQSX_JOB *job = pool_jobs;
+
+        pool_jobs = job->nextjob;
+        if (job->background)
+            OPENSSL_free(job);
+    }
+    pool_nthreads = 0;
+    pool_shutdown = 0;
+    pthread_mutex_unlock(&pool_lock);
+    OQS_THR_PRINTF("OQS THR: pool stopped\n");
+}
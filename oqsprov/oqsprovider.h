@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * oqsprovider helper API
+ *
+ * Functions exported by the oqsprovider shared library in addition to the
+ * OpenSSL provider interface. Applications can link against oqsprovider or
+ * look the functions up in the loaded module.
+ */
+
+#ifndef OQSPROVIDER_H
+# define OQSPROVIDER_H
+
+# include <openssl/evp.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/* One signature to verify: key, message and signature over it */
+typedef struct {
+    EVP_PKEY *key;
+    const unsigned char *msg;
+    size_t msglen;
+    const unsigned char *sig;
+    size_t siglen;
+} OQSPROV_VERIFY_ITEM;
+
+/*
+ * Verifies n signatures with EVP_DigestVerify (no digest), spread over up to
+ * nthreads threads (0: one per online CPU). Bit i of results, least
+ * significant bit first, is set iff item i verified: results must hold
+ * (n + 7) / 8 bytes. Errors of failing items are not left on the error
+ * queue. Returns the number of items verified, or -1 on invalid arguments,
+ * including n > INT_MAX.
+ */
+int oqsprov_batch_verify(OSSL_LIB_CTX *libctx, const char *propq,
+                         const OQSPROV_VERIFY_ITEM *items, size_t n,
+                         int nthreads, unsigned char *results);
+
+/*
+ * Key store files hold private keys as PKCS#8 PrivateKeyInfo DER behind an
+ * index: the magic "OQSKEYS1", the number of keys as uint32, per key its
+ * file offset as uint64 and length as uint32, all big endian, then the keys.
+ */
+
+/*
+ * Generates n private keys of signature algorithm alg with prov, which must
+ * be a loaded instance of oqsprovider, and writes them to a new key store
+ * file at path. Keys are generated and encoded on up to nthreads threads
+ * (0: one per online CPU), each with encoder contexts of its own. A file
+ * created is accessible by its owner only. Returns n on success, -1 on
+ * error, when the file is incomplete.
+ */
+int oqsprov_keystore_export(OSSL_PROVIDER *prov, const char *alg, size_t n,
+                            int nthreads, const char *path);
+
+/*
+ * Reads the key store file at path and decodes its first maxkeys keys into
+ * keys with the PrivateKeyInfo decoders of libctx, on up to nthreads threads.
+ * Keys failing to decode are set to NULL. Returns the number of keys
+ * decoded, or -1 if the file cannot be read or is no key store, or decoding
+ * fails to run; no keys are returned then.
+ */
+int oqsprov_keystore_import(OSSL_LIB_CTX *libctx, const char *propq,
+                            const char *path, EVP_PKEY **keys, size_t maxkeys,
+                            int nthreads);
+
+/*
+ * Public key stores hold raw public keys of signature algorithms in fixed
+ * size records, grouped by algorithm, to be memory-mapped by verifiers: the
+ * magic "OQSPKS01", the number of groups and of keys as uint32, per group
+ * the file offset of its records as uint64, number of records and record
+ * length as uint32, OID length as uint8 and the OID content in 31 bytes, all
+ * big endian, then the records of each group, starting 8 byte aligned.
+ */
+
+/* URI scheme of public key stores, e.g., "oqspks:/etc/trust.pks" */
+# define OQSPROV_PUBKEY_STORE_SCHEME "oqspks"
+
+/*
+ * Writes the public keys of the n signature keys of oqsprovider in keys to a
+ * new public key store file at path. Within each algorithm, keys keep their
+ * order. Returns n on success, -1 on error.
+ *
+ * Opening such a file with OSSL_STORE_open_ex() under the scheme above
+ * yields the keys as EVP_PKEYs whose public key is not copied but read
+ * from the mapped file, which stays mapped while any of them exists. These
+ * keys cannot be modified.
+ */
+int oqsprov_pubkey_store_write(const char *path, EVP_PKEY *const *keys, size_t n);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
@@ -0,0 +1,1061 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Micro-benchmarks for oqsprovider hot paths.
+ *
+ * Usage: oqs_bench <module> <config> <benchmark> [algorithm ...]
+ *
+ * Each benchmark runs for OQS_BENCH_SECONDS (default 1) per algorithm and
+ * reports operations per second. OQS_BENCH_PAUSE_US idles between operations
+ * (not timed), as clients do between connections. Not part of ctest: numbers are meant to be
+ * compared between builds on the same machine.
+ */
+
+#include <openssl/core_names.h>
+#include <openssl/decoder.h>
+#include <openssl/encoder.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <openssl/pem.h>
+#include <openssl/provider.h>
+#include <openssl/ssl.h>
+#include <openssl/store.h>
+#include <openssl/x509.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "oqsprovider.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static OSSL_PROVIDER *prov = NULL;
+static char *progname = NULL;
+
+typedef int (*bench_op_fn)(const char *alg);
+
+typedef struct {
+  const char *name;
+  bench_op_fn setup; /* optional, run once per algorithm before timing */
+  bench_op_fn op;
+  const char *default_algs[8];
+  int flags;
+} bench_t;
+
+#define BENCH_KEM_STATS 0x1 /* report classical/quantum-safe time split */
+#define BENCH_RSS       0x2 /* report peak resident set size */
+#define BENCH_THREADS   0x4 /* run with 1, 4 and one thread per CPU */
+#define BENCH_LATENCY   0x8 /* report latency percentiles of single ops */
+#define BENCH_PARAM_STATS 0x10 /* report key bytes copied/referenced per op */
+#define BENCH_SLAB_STATS 0x20 /* report private key slab usage */
+#define BENCH_ENC_STATS 0x40 /* report key bytes copied by encoders per op */
+
+/* thread count for BENCH_THREADS benchmarks, 0: one per CPU */
+static int bench_threads = 1;
+/* items processed per op, set by setup of batch benchmarks */
+static long bench_items = 1;
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_ncpu(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (int)n : 1;
+}
+
+static double bench_duration(void)
+{
+  const char *s = getenv("OQS_BENCH_SECONDS");
+  double d = s != NULL ? atof(s) : 0;
+
+  return d > 0 ? d : 1.0;
+}
+
+static void bench_pause(void)
+{
+  static long us = -1;
+  struct timespec ts;
+
+  if (us < 0) {
+    const char *s = getenv("OQS_BENCH_PAUSE_US");
+
+    us = s != NULL ? atol(s) : 0;
+  }
+  if (us > 0) {
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = us % 1000000 * 1000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* one fresh key per call, as done for ephemeral KEM keys in TLS */
+static int bench_keygen(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  int ok;
+
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &key);
+
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+/* KEM work of one TLS 1.3 handshake: client keygen, server encaps, client decaps */
+static int bench_kex(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL, *encctx = NULL, *decctx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char *ct = NULL, *secenc = NULL, *secdec = NULL;
+  size_t ctlen, seclen;
+  int ok;
+
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &key)
+       && (encctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+       && EVP_PKEY_encapsulate_init(encctx, NULL)
+       && EVP_PKEY_encapsulate(encctx, NULL, &ctlen, NULL, &seclen)
+       && (ct = OPENSSL_malloc(ctlen)) != NULL
+       && (secenc = OPENSSL_malloc(seclen)) != NULL
+       && (secdec = OPENSSL_malloc(seclen)) != NULL
+       && EVP_PKEY_encapsulate(encctx, ct, &ctlen, secenc, &seclen)
+       && (decctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+       && EVP_PKEY_decapsulate_init(decctx, NULL)
+       && EVP_PKEY_decapsulate(decctx, secdec, &seclen, ct, ctlen)
+       && memcmp(secenc, secdec, seclen) == 0;
+
+  OPENSSL_free(ct);
+  OPENSSL_free(secenc);
+  OPENSSL_free(secdec);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_CTX_free(encctx);
+  EVP_PKEY_CTX_free(decctx);
+  return ok;
+}
+
+/* TLS 1.3 client offering a single key share of the group benchmarked */
+static SSL_CTX *bench_sslctx = NULL;
+
+static int bench_clienthello_setup(const char *alg)
+{
+  SSL_CTX_free(bench_sslctx);
+  return (bench_sslctx = SSL_CTX_new_ex(libctx, NULL, TLS_client_method())) != NULL
+         && SSL_CTX_set_min_proto_version(bench_sslctx, TLS1_3_VERSION)
+         && SSL_CTX_set1_groups_list(bench_sslctx, alg);
+}
+
+/* ClientHello generation incl. key share keygen, as done per connection */
+static int bench_clienthello(const char *alg)
+{
+  SSL *ssl = NULL;
+  BIO *rbio = NULL, *wbio = NULL;
+  int ok;
+
+  ok = (ssl = SSL_new(bench_sslctx)) != NULL
+       && (rbio = BIO_new(BIO_s_mem())) != NULL
+       && (wbio = BIO_new(BIO_s_mem())) != NULL;
+  if (ok) {
+    SSL_set_bio(ssl, rbio, wbio);
+    rbio = wbio = NULL;
+    SSL_set_connect_state(ssl);
+    ok = SSL_do_handshake(ssl) <= 0
+         && SSL_get_error(ssl, -1) == SSL_ERROR_WANT_READ
+         && BIO_pending(SSL_get_wbio(ssl)) > 0;
+  }
+  BIO_free(rbio);
+  BIO_free(wbio);
+  SSL_free(ssl);
+  return ok;
+}
+
+/* key and signature shared by sign/verify benchmarks */
+static EVP_PKEY *bench_key = NULL;
+static unsigned char *bench_sig = NULL;
+static size_t bench_siglen = 0, bench_sigmax = 0;
+static const unsigned char bench_msg[] = "The quick brown fox jumps over... you know what";
+
+static int bench_key_setup(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  int ok;
+
+  EVP_PKEY_free(bench_key);
+  bench_key = NULL;
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &bench_key);
+
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+/* encoded public key as fetched by libssl for every key share */
+static int bench_encpub(const char *alg)
+{
+  unsigned char *pub = NULL;
+  size_t publen = EVP_PKEY_get1_encoded_public_key(bench_key, &pub);
+
+  OPENSSL_free(pub);
+  return publen > 0;
+}
+
+/* SubjectPublicKeyInfo DER, as written for every certificate or CSR */
+static int bench_encspki(const char *alg)
+{
+  unsigned char *der = NULL;
+  int derlen = i2d_PUBKEY(bench_key, &der);
+
+  OPENSSL_free(der);
+  return derlen > 0;
+}
+
+/* PrivateKeyInfo DER, as written when exporting keys */
+static int bench_encp8(const char *alg)
+{
+  unsigned char *der = NULL;
+  int derlen = i2d_PrivateKey(bench_key, &der);
+
+  OPENSSL_clear_free(der, derlen > 0 ? derlen : 0);
+  return derlen > 0;
+}
+
+/* same, by reference: no copy if the provider supports it */
+static int bench_encpubref(const char *alg)
+{
+  void *pub = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_ptr(OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, &pub, 0),
+    OSSL_PARAM_END
+  };
+
+  // length of referenced data is returned in return_size
+  return EVP_PKEY_get_params(bench_key, params)
+         && pub != NULL && params[0].return_size > 0;
+}
+
+static int bench_sig_setup(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  EVP_PKEY_free(bench_key);
+  OPENSSL_free(bench_sig);
+  bench_key = NULL;
+  bench_sig = NULL;
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &bench_key)
+       && (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, bench_key, NULL)
+       && EVP_DigestSign(mdctx, NULL, &bench_sigmax, bench_msg, sizeof(bench_msg))
+       && (bench_sig = OPENSSL_malloc(bench_sigmax)) != NULL
+       && (bench_siglen = bench_sigmax) > 0
+       && EVP_DigestSign(mdctx, bench_sig, &bench_siglen, bench_msg, sizeof(bench_msg));
+
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+/* fresh EVP_MD_CTX per signature, as done by X509_sign and friends */
+static int bench_sign(const char *alg)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  unsigned char *sig = NULL;
+  size_t siglen = bench_sigmax;
+  int ok;
+
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, bench_key, NULL)
+       && (sig = OPENSSL_malloc(siglen)) != NULL
+       && EVP_DigestSign(mdctx, sig, &siglen, bench_msg, sizeof(bench_msg));
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+static int bench_verify(const char *alg)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, libctx, NULL, bench_key, NULL)
+       && EVP_DigestVerify(mdctx, bench_sig, bench_siglen, bench_msg, sizeof(bench_msg));
+
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+/* batch of signatures by a few keys, verified with oqsprov_batch_verify */
+#define BENCH_BATCH_SIZE 10000
+#define BENCH_BATCH_KEYS 16
+
+static OQSPROV_VERIFY_ITEM *bench_batch = NULL;
+static EVP_PKEY *bench_batch_keys[BENCH_BATCH_KEYS];
+static unsigned char *bench_batch_sigs = NULL;
+static unsigned char bench_batch_msgs[BENCH_BATCH_SIZE][32];
+static unsigned char bench_batch_results[(BENCH_BATCH_SIZE + 7) / 8];
+
+static void bench_batch_free(void)
+{
+  size_t i;
+
+  for (i = 0; i < BENCH_BATCH_KEYS; i++) {
+    EVP_PKEY_free(bench_batch_keys[i]);
+    bench_batch_keys[i] = NULL;
+  }
+  OPENSSL_free(bench_batch);
+  OPENSSL_free(bench_batch_sigs);
+  bench_batch = NULL;
+  bench_batch_sigs = NULL;
+}
+
+static int bench_batchverify_setup(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_MD_CTX *mdctx = NULL;
+  size_t i, sigmax = 0;
+  int ok;
+
+  bench_batch_free();
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && (mdctx = EVP_MD_CTX_new()) != NULL;
+  for (i = 0; ok && i < BENCH_BATCH_KEYS; i++)
+    ok = EVP_PKEY_generate(ctx, &bench_batch_keys[i]);
+  ok = ok && (sigmax = EVP_PKEY_get_size(bench_batch_keys[0])) > 0
+       && (bench_batch = OPENSSL_zalloc(BENCH_BATCH_SIZE * sizeof(*bench_batch))) != NULL
+       && (bench_batch_sigs = OPENSSL_malloc(BENCH_BATCH_SIZE * sigmax)) != NULL;
+  for (i = 0; ok && i < BENCH_BATCH_SIZE; i++) {
+    OQSPROV_VERIFY_ITEM *item = &bench_batch[i];
+
+    memcpy(bench_batch_msgs[i], &i, sizeof(i));
+    item->key = bench_batch_keys[i % BENCH_BATCH_KEYS];
+    item->msg = bench_batch_msgs[i];
+    item->msglen = sizeof(bench_batch_msgs[i]);
+    item->sig = bench_batch_sigs + i * sigmax;
+    item->siglen = sigmax;
+    // reset: re-init of a used ctx with another key would sign with the first
+    ok = EVP_MD_CTX_reset(mdctx)
+         && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, item->key, NULL)
+         && EVP_DigestSign(mdctx, bench_batch_sigs + i * sigmax, &item->siglen,
+                           item->msg, item->msglen);
+  }
+  bench_items = BENCH_BATCH_SIZE;
+
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+static int bench_batchverify(const char *alg)
+{
+  return oqsprov_batch_verify(libctx, NULL, bench_batch, BENCH_BATCH_SIZE,
+                              bench_threads, bench_batch_results)
+         == BENCH_BATCH_SIZE;
+}
+
+/* large message streamed in chunks without digest, as done by CMS/S/MIME
+ * and dgst -sign; the provider has to collect it for the PQ signature
+ */
+#define BENCH_BIGMSG_SIZE  (16 * 1024 * 1024)
+#define BENCH_BIGMSG_CHUNK (64 * 1024)
+
+static int bench_bigsign(const char *alg)
+{
+  static unsigned char chunk[BENCH_BIGMSG_CHUNK];
+  EVP_MD_CTX *mdctx = NULL;
+  unsigned char *sig = NULL;
+  size_t siglen = bench_sigmax, done;
+  int ok;
+
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, bench_key, NULL);
+  for (done = 0; ok && done < BENCH_BIGMSG_SIZE; done += sizeof(chunk))
+    ok = EVP_DigestSignUpdate(mdctx, chunk, sizeof(chunk));
+  ok = ok && (sig = OPENSSL_malloc(siglen)) != NULL
+       && EVP_DigestSignFinal(mdctx, sig, &siglen);
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+/* DER of a self-signed certificate, as found in chains to be verified */
+static unsigned char *bench_cert = NULL;
+static int bench_certlen = 0;
+
+static int bench_cert_setup(const char *alg)
+{
+  X509 *x = NULL;
+  X509_NAME *name = NULL;
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  OPENSSL_free(bench_cert);
+  bench_cert = NULL;
+  ok = bench_key_setup(alg)
+       && (x = X509_new_ex(libctx, NULL)) != NULL
+       && (name = X509_NAME_new()) != NULL
+       && X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                     (const unsigned char *)"oqs_bench", -1, -1, 0)
+       && X509_set_version(x, X509_VERSION_3)
+       && ASN1_INTEGER_set(X509_get_serialNumber(x), 1)
+       && X509_set_subject_name(x, name)
+       && X509_set_issuer_name(x, name)
+       && X509_gmtime_adj(X509_getm_notBefore(x), 0)
+       && X509_gmtime_adj(X509_getm_notAfter(x), 3600)
+       && X509_set_pubkey(x, bench_key)
+       && (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, bench_key, NULL)
+       && X509_sign_ctx(x, mdctx) > 0
+       && (bench_certlen = i2d_X509(x, &bench_cert)) > 0;
+
+  EVP_MD_CTX_free(mdctx);
+  X509_NAME_free(name);
+  X509_free(x);
+  return ok;
+}
+
+/* certificate parsing incl. decoding of its public key */
+static int bench_certparse(const char *alg)
+{
+  const unsigned char *p = bench_cert;
+  X509 *x = X509_new_ex(libctx, NULL);
+  int ok;
+
+  ok = x != NULL
+       && d2i_X509(&x, &p, bench_certlen) != NULL
+       && X509_get0_pubkey(x) != NULL;
+
+  X509_free(x);
+  return ok;
+}
+
+/* PEM bundle of private and public keys, as loaded by servers at startup */
+#define BENCH_PEM_KEYS 32
+
+static BIO *bench_pem = NULL;
+
+static int bench_pem_setup(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  int i, ok;
+
+  BIO_free(bench_pem);
+  ok = (bench_pem = BIO_new(BIO_s_mem())) != NULL
+       && (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx);
+  for (i = 0; ok && i < BENCH_PEM_KEYS; i++) {
+    ok = EVP_PKEY_generate(ctx, &key)
+         && PEM_write_bio_PrivateKey(bench_pem, key, NULL, NULL, 0, NULL, NULL)
+         && PEM_write_bio_PUBKEY(bench_pem, key);
+    EVP_PKEY_free(key);
+    key = NULL;
+  }
+  bench_items = 2 * BENCH_PEM_KEYS;
+
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+static int bench_pemload(const char *alg)
+{
+  char *pem;
+  long pemlen = BIO_get_mem_data(bench_pem, &pem);
+  BIO *in = BIO_new_mem_buf(pem, pemlen);
+  EVP_PKEY *key;
+  int i, ok = in != NULL;
+
+  for (i = 0; ok && i < BENCH_PEM_KEYS; i++) {
+    ok = (key = PEM_read_bio_PrivateKey_ex(in, NULL, NULL, NULL, libctx, NULL)) != NULL;
+    EVP_PKEY_free(key);
+    ok = ok && (key = PEM_read_bio_PUBKEY_ex(in, NULL, NULL, NULL, libctx, NULL)) != NULL;
+    EVP_PKEY_free(key);
+  }
+
+  BIO_free(in);
+  return ok;
+}
+
+/* DER key store of classical and OQS keys, private and public, as decoded
+ * by OSSL_STORE or applications not knowing the key types in advance
+ */
+static const char *bench_store_algs[] = {
+  "RSA", "EC", "ED25519", "dilithium2", "p256_dilithium2", "rsa3072_dilithium2",
+  "falcon512", "p521_dilithium5", "sphincssha256128frobust",
+};
+#define BENCH_STORE_MAX (2 * sizeof(bench_store_algs) / sizeof(bench_store_algs[0]))
+
+static unsigned char *bench_store[BENCH_STORE_MAX];
+static int bench_storelen[BENCH_STORE_MAX];
+static size_t bench_nstore = 0;
+
+static void bench_store_free(void)
+{
+  while (bench_nstore > 0)
+    OPENSSL_free(bench_store[--bench_nstore]);
+}
+
+static int bench_store_setup(const char *alg)
+{
+  EVP_PKEY_CTX *ctx;
+  EVP_PKEY *key;
+  size_t i;
+  int ok = 1;
+
+  bench_store_free();
+  for (i = 0; ok && i < BENCH_STORE_MAX / 2; i++) {
+    if (!alg_is_enabled(bench_store_algs[i]))
+      continue;
+    key = NULL;
+    ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, bench_store_algs[i], NULL)) != NULL
+         && EVP_PKEY_keygen_init(ctx)
+         && (strcmp(bench_store_algs[i], "EC") || EVP_PKEY_CTX_set_group_name(ctx, "P-256"))
+         && EVP_PKEY_generate(ctx, &key)
+         && (bench_storelen[bench_nstore] = i2d_PrivateKey(key, &bench_store[bench_nstore])) > 0;
+    bench_nstore += ok;
+    ok = ok && (bench_storelen[bench_nstore] = i2d_PUBKEY(key, &bench_store[bench_nstore])) > 0;
+    bench_nstore += ok;
+    EVP_PKEY_free(key);
+    EVP_PKEY_CTX_free(ctx);
+  }
+  bench_items = bench_nstore;
+  return ok;
+}
+
+/* decoding of each key of the store with its type guessed */
+static int bench_storeload(const char *alg)
+{
+  OSSL_DECODER_CTX *dctx;
+  EVP_PKEY *key;
+  const unsigned char *p;
+  size_t i, len;
+  int ok = 1;
+
+  for (i = 0; ok && i < bench_nstore; i++) {
+    key = NULL;
+    p = bench_store[i];
+    len = bench_storelen[i];
+    ok = (dctx = OSSL_DECODER_CTX_new_for_pkey(&key, "DER", NULL, NULL, 0, libctx, NULL)) != NULL
+         && OSSL_DECODER_from_data(dctx, &p, &len)
+         && key != NULL;
+    EVP_PKEY_free(key);
+    OSSL_DECODER_CTX_free(dctx);
+  }
+  return ok;
+}
+
+/* hybrid KEM counters, only available if built with OQS_PROVIDER_STATS */
+static int kem_stats_get(uint64_t stats[3])
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-kem-hybrid-ops", &stats[0]),
+    OSSL_PARAM_uint64("oqs-kem-classical-ns", &stats[1]),
+    OSSL_PARAM_uint64("oqs-kem-qs-ns", &stats[2]),
+    OSSL_PARAM_END
+  };
+
+  return prov != NULL && OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]);
+}
+
+/* key bytes copied into/referenced by params, if built with OQS_PROVIDER_STATS */
+static int param_stats_get(uint64_t stats[2])
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-param-copy-bytes", &stats[0]),
+    OSSL_PARAM_uint64("oqs-param-ref-bytes", &stats[1]),
+    OSSL_PARAM_END
+  };
+
+  return prov != NULL && OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]);
+}
+
+/* key bytes copied by encoders, if built with OQS_PROVIDER_STATS */
+static int enc_stats_get(uint64_t *copied)
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-encode-copy-bytes", copied),
+    OSSL_PARAM_END
+  };
+
+  return prov != NULL && OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]);
+}
+
+/* slab bytes, buffers in use, thread cache hits, if built with OQS_PROVIDER_STATS */
+static int slab_stats_get(uint64_t stats[3])
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-slab-bytes", &stats[0]),
+    OSSL_PARAM_uint64("oqs-slab-in-use", &stats[1]),
+    OSSL_PARAM_uint64("oqs-slab-cache-hits", &stats[2]),
+    OSSL_PARAM_END
+  };
+
+  return prov != NULL && OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]);
+}
+
+/* key store of many keys of one algorithm, written or read at once */
+#define BENCH_KEYSTORE_KEYS 1000
+
+static char bench_keystore_path[64];
+static EVP_PKEY *bench_keystore_keys[BENCH_KEYSTORE_KEYS];
+
+static void bench_keystore_free(void)
+{
+  size_t i;
+
+  for (i = 0; i < BENCH_KEYSTORE_KEYS; i++) {
+    EVP_PKEY_free(bench_keystore_keys[i]);
+    bench_keystore_keys[i] = NULL;
+  }
+  if (bench_keystore_path[0] != '\0')
+    unlink(bench_keystore_path);
+}
+
+static int bench_keystore_setup(const char *alg)
+{
+  bench_keystore_free();
+  snprintf(bench_keystore_path, sizeof(bench_keystore_path),
+           "oqs_bench_keystore_%d.bin", (int)getpid());
+  bench_items = BENCH_KEYSTORE_KEYS;
+  return 1;
+}
+
+/* as done without key stores: each key generated and encoded on its own */
+static int bench_p8export(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  OSSL_ENCODER_CTX *ectx;
+  EVP_PKEY *key;
+  BIO *out = NULL;
+  size_t i;
+  int ok;
+
+  ok = (out = BIO_new_file(bench_keystore_path, "wb")) != NULL
+       && (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx);
+  for (i = 0; ok && i < BENCH_KEYSTORE_KEYS; i++) {
+    key = NULL;
+    ectx = NULL;
+    ok = EVP_PKEY_generate(ctx, &key)
+         && (ectx = OSSL_ENCODER_CTX_new_for_pkey(key, OSSL_KEYMGMT_SELECT_KEYPAIR,
+                                                  "DER", "PrivateKeyInfo", NULL)) != NULL
+         && OSSL_ENCODER_to_bio(ectx, out);
+    OSSL_ENCODER_CTX_free(ectx);
+    EVP_PKEY_free(key);
+  }
+
+  EVP_PKEY_CTX_free(ctx);
+  BIO_free(out);
+  return ok;
+}
+
+static int bench_ksexport(const char *alg)
+{
+  return oqsprov_keystore_export(prov, alg, BENCH_KEYSTORE_KEYS, bench_threads,
+                                 bench_keystore_path) == BENCH_KEYSTORE_KEYS;
+}
+
+static int bench_ksimport_setup(const char *alg)
+{
+  return bench_keystore_setup(alg)
+         && oqsprov_keystore_export(prov, alg, BENCH_KEYSTORE_KEYS, 0,
+                                    bench_keystore_path) == BENCH_KEYSTORE_KEYS;
+}
+
+/* including freeing the keys of the previous run */
+static int bench_ksimport(const char *alg)
+{
+  size_t i;
+
+  for (i = 0; i < BENCH_KEYSTORE_KEYS; i++)
+    EVP_PKEY_free(bench_keystore_keys[i]);
+  return oqsprov_keystore_import(libctx, NULL, bench_keystore_path, bench_keystore_keys,
+                                 BENCH_KEYSTORE_KEYS, bench_threads) == BENCH_KEYSTORE_KEYS;
+}
+
+/* trust store of many public keys, cycling through fewer distinct ones */
+#define BENCH_TRUST_KEYS     1000
+#define BENCH_TRUST_DISTINCT 100
+
+static char bench_trust_path[64];
+static EVP_PKEY *bench_trust_keys[BENCH_TRUST_KEYS];
+
+static void bench_trust_free(void)
+{
+  size_t i;
+
+  for (i = 0; i < BENCH_TRUST_KEYS; i++) {
+    EVP_PKEY_free(bench_trust_keys[i]);
+    bench_trust_keys[i] = NULL;
+  }
+  if (bench_trust_path[0] != '\0')
+    unlink(bench_trust_path);
+}
+
+/* writes the trust store as PEM file if pem, else as public key store */
+static int bench_trust_setup(const char *alg, int pem)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *keys[BENCH_TRUST_DISTINCT];
+  BIO *out = NULL;
+  size_t i;
+  int ok;
+
+  bench_trust_free();
+  snprintf(bench_trust_path, sizeof(bench_trust_path),
+           "oqs_bench_trust_%d.%s", (int)getpid(), pem ? "pem" : "pks");
+  memset(keys, 0, sizeof(keys));
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx);
+  for (i = 0; ok && i < BENCH_TRUST_DISTINCT; i++)
+    ok = EVP_PKEY_generate(ctx, &keys[i]);
+  // the keys of the store live in bench_trust_keys only while loaded
+  for (i = 0; ok && i < BENCH_TRUST_KEYS; i++)
+    bench_trust_keys[i] = keys[i % BENCH_TRUST_DISTINCT];
+  if (ok && pem) {
+    ok = (out = BIO_new_file(bench_trust_path, "w")) != NULL;
+    for (i = 0; ok && i < BENCH_TRUST_KEYS; i++)
+      ok = PEM_write_bio_PUBKEY(out, bench_trust_keys[i]);
+  } else if (ok) {
+    ok = oqsprov_pubkey_store_write(bench_trust_path, bench_trust_keys,
+                                    BENCH_TRUST_KEYS) == BENCH_TRUST_KEYS;
+  }
+  memset(bench_trust_keys, 0, sizeof(bench_trust_keys));
+  bench_items = BENCH_TRUST_KEYS;
+
+  for (i = 0; i < BENCH_TRUST_DISTINCT; i++)
+    EVP_PKEY_free(keys[i]);
+  BIO_free(out);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+static int bench_trustpem_setup(const char *alg)
+{
+  return bench_trust_setup(alg, 1);
+}
+
+static int bench_trustmap_setup(const char *alg)
+{
+  return bench_trust_setup(alg, 0);
+}
+
+/* loads all keys of the trust store, freeing those of the previous run;
+ * a plain path, for the file loader, without scheme */
+static int bench_trust_load(const char *scheme)
+{
+  char uri[80];
+  OSSL_STORE_CTX *store;
+  OSSL_STORE_INFO *info;
+  size_t n = 0;
+  int ok;
+
+  for (n = 0; n < BENCH_TRUST_KEYS; n++) {
+    EVP_PKEY_free(bench_trust_keys[n]);
+    bench_trust_keys[n] = NULL;
+  }
+  snprintf(uri, sizeof(uri), "%s%s%s", scheme != NULL ? scheme : "",
+           scheme != NULL ? ":" : "", bench_trust_path);
+  ok = (store = OSSL_STORE_open_ex(uri, libctx, NULL, NULL, NULL, NULL, NULL, NULL)) != NULL;
+  for (n = 0; ok && n < BENCH_TRUST_KEYS; n++) {
+    ok = (info = OSSL_STORE_load(store)) != NULL
+         && (bench_trust_keys[n] = OSSL_STORE_INFO_get1_PUBKEY(info)) != NULL;
+    OSSL_STORE_INFO_free(info);
+  }
+  OSSL_STORE_close(store);
+  return ok;
+}
+
+static int bench_trustpem(const char *alg)
+{
+  return bench_trust_load(NULL);
+}
+
+static int bench_trustmap(const char *alg)
+{
+  return bench_trust_load(OQSPROV_PUBKEY_STORE_SCHEME);
+}
+
+/*
+ * Process start-up as seen by a command line tool: a fresh process loads the
+ * provider, generates a key and signs once. Pass a configuration with
+ * lazy_init = 1 to compare.
+ */
+#define BENCH_FIRSTSIGN "firstsign"
+
+extern char **environ;
+
+static int bench_startup(const char *alg)
+{
+  char *args[] = { progname, modulename, configfile, BENCH_FIRSTSIGN, (char *)alg, NULL };
+  pid_t pid;
+  int status;
+
+  return posix_spawnp(&pid, progname, NULL, NULL, args, environ) == 0
+         && waitpid(pid, &status, 0) == pid
+         && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static const bench_t benchmarks[] = {
+  { "keygen", NULL, bench_keygen,
+    { "kyber512", "p256_kyber512", "x25519_kyber512", "dilithium2",
+      "p256_dilithium2", "falcon512", NULL }, BENCH_SLAB_STATS },
+  { "kex", NULL, bench_kex,
+    { "p256_kyber512", "p384_kyber768", "p256_frodo640aes",
+      "p384_frodo976aes", "x25519_kyber512", NULL }, BENCH_KEM_STATS },
+  { "kexlat", NULL, bench_kex,
+    { "p521_frodo1344aes", "x448_hqc192", "p384_frodo976aes", "p256_kyber512",
+      "x25519_kyber512", NULL }, BENCH_LATENCY },
+  { "sign", bench_sig_setup, bench_sign,
+    { "p256_dilithium2", "rsa3072_dilithium2", "p384_dilithium3", "p521_dilithium5",
+      "p256_falcon512", "rsa3072_falcon512", "dilithium2", NULL } },
+  { "verify", bench_sig_setup, bench_verify,
+    { "p256_dilithium2", "rsa3072_dilithium2", "p384_dilithium3", "p521_dilithium5",
+      "p256_falcon512", "rsa3072_falcon512", "dilithium2", NULL } },
+  { "bigsign", bench_sig_setup, bench_bigsign,
+    { "p256_dilithium2", "rsa3072_dilithium2", "p256_falcon512", "dilithium2", NULL },
+    BENCH_RSS },
+  { "clienthello", bench_clienthello_setup, bench_clienthello,
+    { "kyber512", "p256_kyber512", "x25519_kyber512", "p384_kyber768",
+      "p521_frodo1344aes", "x448_hqc192", NULL }, BENCH_LATENCY },
+  { "encpub", bench_key_setup, bench_encpub,
+    { "frodo1344aes", "p521_frodo1344aes", "kyber768", "x25519_kyber512", NULL },
+    BENCH_PARAM_STATS },
+  { "encpubref", bench_key_setup, bench_encpubref,
+    { "frodo1344aes", "p521_frodo1344aes", "kyber768", "x25519_kyber512", NULL },
+    BENCH_PARAM_STATS },
+  { "signlat", bench_sig_setup, bench_sign,
+    { "rsa3072_dilithium2", "rsa3072_falcon512", "p256_dilithium2", "p521_dilithium5",
+      "p256_falcon512", NULL }, BENCH_LATENCY },
+  { "verifylat", bench_sig_setup, bench_verify,
+    { "rsa3072_dilithium2", "rsa3072_falcon512", "p256_dilithium2", "p521_dilithium5",
+      "p256_falcon512", NULL }, BENCH_LATENCY },
+  { "batchverify", bench_batchverify_setup, bench_batchverify,
+    { "dilithium2", "falcon512", "p256_dilithium2", "sphincssha256128frobust", NULL },
+    BENCH_THREADS },
+  { "certparse", bench_cert_setup, bench_certparse,
+    { "dilithium2", "p256_dilithium2", "rsa3072_dilithium2", "p521_dilithium5",
+      "falcon512", "sphincssha256128frobust", NULL } },
+  { "pemload", bench_pem_setup, bench_pemload,
+    { "dilithium2", "p256_dilithium2", "rsa3072_dilithium2", "falcon512",
+      "sphincssha256128frobust", NULL } },
+  { "encspki", bench_key_setup, bench_encspki,
+    { "dilithium5", "p521_dilithium5", "falcon1024", "rsa3072_falcon512",
+      "sphincssha256128frobust", NULL }, BENCH_ENC_STATS },
+  { "encp8", bench_key_setup, bench_encp8,
+    { "dilithium5", "p521_dilithium5", "falcon1024", "rsa3072_falcon512",
+      "sphincssha256128frobust", NULL }, BENCH_ENC_STATS },
+  { "storeload", bench_store_setup, bench_storeload, { "mixed", NULL } },
+  { "p8export", bench_keystore_setup, bench_p8export,
+    { "dilithium3", "falcon512", "p256_dilithium2", NULL } },
+  { "ksexport", bench_keystore_setup, bench_ksexport,
+    { "dilithium3", "falcon512", "p256_dilithium2", NULL }, BENCH_THREADS },
+  { "ksimport", bench_ksimport_setup, bench_ksimport,
+    { "dilithium3", "falcon512", "p256_dilithium2", NULL }, BENCH_THREADS },
+  { "trustpem", bench_trustpem_setup, bench_trustpem,
+    { "dilithium2", "falcon512", "p256_dilithium2", "dilithium5", NULL }, BENCH_RSS },
+  { "trustmap", bench_trustmap_setup, bench_trustmap,
+    { "dilithium2", "falcon512", "p256_dilithium2", "dilithium5", NULL }, BENCH_RSS },
+  { "startup", NULL, bench_startup,
+    { "dilithium2", "falcon512", "p256_dilithium2", NULL }, BENCH_LATENCY },
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+/* latencies of single ops in seconds, for BENCH_LATENCY */
+#define BENCH_MAX_SAMPLES 100000
+static double bench_samples[BENCH_MAX_SAMPLES];
+static size_t bench_nsamples = 0;
+/* ops done by last run_timed */
+static long bench_ops = 0;
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void print_latency(void)
+{
+  qsort(bench_samples, bench_nsamples, sizeof(bench_samples[0]), cmp_double);
+  printf("%-12s %-36s p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+         "", "", bench_samples[bench_nsamples * 50 / 100] * 1e6,
+         bench_samples[bench_nsamples * 90 / 100] * 1e6,
+         bench_samples[bench_nsamples * 99 / 100] * 1e6,
+         bench_samples[bench_nsamples - 1] * 1e6);
+}
+
+/* timed loop, returns ops per second or < 0 on failure */
+static double run_timed(const bench_t *b, const char *alg)
+{
+  double duration = bench_duration(), start, elapsed, t0, t1;
+  long ops = 0;
+
+  bench_nsamples = 0;
+  start = t1 = bench_now();
+  do {
+    bench_pause();
+    t0 = bench_now();
+    if (!b->op(alg)) {
+      fprintf(stderr, cRED "  %s failed for %s" cNORM "\n", b->name, alg);
+      ERR_print_errors_fp(stderr);
+      return -1;
+    }
+    t1 = bench_now();
+    if (bench_nsamples < BENCH_MAX_SAMPLES)
+      bench_samples[bench_nsamples++] = t1 - t0;
+    ops += bench_items;
+  } while ((elapsed = t1 - start) < duration);
+  bench_ops = ops;
+  return ops / elapsed;
+}
+
+static int run_bench(const bench_t *b, const char *alg)
+{
+  static const int threads[] = { 1, 4, 0 };
+  double rate;
+  uint64_t s0[3], s1[3], p0[2], p1[2], l0[3], l1[3], e0, e1;
+  size_t i;
+  int stats, pstats, lstats, estats;
+
+  if (!alg_is_enabled(alg)) {
+    printf("Not benchmarking disabled algorithm %s.\n", alg);
+    return 1;
+  }
+  bench_items = 1;
+  if (b->setup != NULL && !b->setup(alg)) {
+    fprintf(stderr, cRED "  %s setup failed for %s" cNORM "\n", b->name, alg);
+    ERR_print_errors_fp(stderr);
+    return 0;
+  }
+  if (b->flags & BENCH_THREADS) {
+    for (i = 0; i < nelem(threads); i++) {
+      char label[64];
+
+      bench_threads = threads[i];
+      if ((rate = run_timed(b, alg)) < 0)
+        return 0;
+      snprintf(label, sizeof(label), "%s/%dt", alg, threads[i] > 0 ? threads[i] : bench_ncpu());
+      printf("%-12s %-36s %12.1f ops/s\n", b->name, label, rate);
+    }
+    return 1;
+  }
+  stats = (b->flags & BENCH_KEM_STATS) && kem_stats_get(s0);
+  pstats = (b->flags & BENCH_PARAM_STATS) && param_stats_get(p0);
+  lstats = (b->flags & BENCH_SLAB_STATS) && slab_stats_get(l0);
+  estats = (b->flags & BENCH_ENC_STATS) && enc_stats_get(&e0);
+  if ((rate = run_timed(b, alg)) < 0)
+    return 0;
+
+  printf("%-12s %-36s %12.1f ops/s\n", b->name, alg, rate);
+  if (b->flags & BENCH_LATENCY)
+    print_latency();
+  if (b->flags & BENCH_RSS) {
+    struct rusage ru;
+
+    // process-wide maximum: run one algorithm per invocation to compare
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+      printf("%-12s %-36s peak RSS %ld KiB\n", "", "", ru.ru_maxrss);
+  }
+  if (stats && kem_stats_get(s1) && s1[0] > s0[0]) {
+    double cl = (s1[1] - s0[1]) / 1e3, qs = (s1[2] - s0[2]) / 1e3;
+
+    printf("%-12s %-36s classical %.1f us, quantum-safe %.1f us per op\n",
+           "", "", cl / (s1[0] - s0[0]), qs / (s1[0] - s0[0]));
+  }
+  if (pstats && param_stats_get(p1) && bench_ops > 0)
+    printf("%-12s %-36s key bytes copied %.0f, referenced %.0f per op\n", "", "",
+           (double)(p1[0] - p0[0]) / bench_ops, (double)(p1[1] - p0[1]) / bench_ops);
+  if (lstats && slab_stats_get(l1) && bench_ops > 0)
+    printf("%-12s %-36s slabs %llu KiB, %llu keys live, %.1f%% from thread cache\n", "", "",
+           (unsigned long long)l1[0] / 1024, (unsigned long long)l1[1],
+           100.0 * (l1[2] - l0[2]) / bench_ops);
+  if (estats && enc_stats_get(&e1) && bench_ops > 0)
+    printf("%-12s %-36s key bytes copied %.0f per op\n", "", "",
+           (double)(e1 - e0) / bench_ops);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  const bench_t *b = NULL;
+  size_t i;
+  int errcnt = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  if (argc < 4) {
+    fprintf(stderr, "Usage: %s <module> <config> <benchmark> [algorithm ...]\n", argv[0]);
+    fprintf(stderr, "Benchmarks:");
+    for (i = 0; i < nelem(benchmarks); i++)
+      fprintf(stderr, " %s", benchmarks[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  progname = argv[0];
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  if (!strcmp(argv[3], BENCH_FIRSTSIGN)) {
+    // child process of the startup benchmark
+    T(argc == 5);
+    errcnt = !bench_sig_setup(argv[4]);
+  } else {
+    for (i = 0; i < nelem(benchmarks); i++)
+      if (!strcmp(benchmarks[i].name, argv[3]))
+        b = &benchmarks[i];
+    T(b != NULL);
+
+    if (argc > 4) {
+      for (i = 4; i < (size_t)argc; i++)
+        errcnt += !run_bench(b, argv[i]);
+    } else {
+      for (i = 0; b->default_algs[i] != NULL; i++)
+        errcnt += !run_bench(b, b->default_algs[i]);
+    }
+  }
+
+  EVP_PKEY_free(bench_key);
+  OPENSSL_free(bench_sig);
+  OPENSSL_free(bench_cert);
+  BIO_free(bench_pem);
+  bench_store_free();
+  bench_keystore_free();
+  bench_trust_free();
+  bench_batch_free();
+  SSL_CTX_free(bench_sslctx);
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+  return errcnt != 0;
+}
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Allocation count regression tests: counts OPENSSL_malloc/realloc calls
+ * (also those done by the provider, which shares libcrypto's allocator)
+ * across selected provider operations.
+ */
+
+#include <openssl/core_dispatch.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/x509.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static OSSL_PROVIDER *prov = NULL;
+
+static int counting = 0;
+static size_t alloc_count = 0;
+/* allocations done by provider key object code, incl. private key slabs */
+static size_t key_alloc_count = 0;
+
+static const char *key_sources[] = { "oqsprov_keys.c", "oqsprov_slab.c" };
+
+static void count_alloc(const char *file)
+{
+  size_t len = file != NULL ? strlen(file) : 0, i;
+
+  alloc_count += counting;
+  for (i = 0; i < sizeof(key_sources) / sizeof(key_sources[0]); i++)
+    if (len >= strlen(key_sources[i])
+        && !strcmp(file + len - strlen(key_sources[i]), key_sources[i]))
+      key_alloc_count += counting;
+}
+
+static void *count_malloc(size_t num, const char *file, int line)
+{
+  count_alloc(file);
+  return malloc(num);
+}
+
+static void *count_realloc(void *addr, size_t num, const char *file, int line)
+{
+  count_alloc(file);
+  return realloc(addr, num);
+}
+
+static void count_free(void *addr, const char *file, int line)
+{
+  free(addr);
+}
+
+static const char *sigalg_names[] = {
+  "dilithium2", "falcon512", "p256_dilithium2", "rsa3072_falcon512",
+};
+
+#define CHUNK_SIZE  16
+#define CHUNK_COUNT (64 * 1024)
+
+static int log2_ceil(size_t n)
+{
+  int l = 0;
+
+  while (((size_t)1 << l) < n)
+    l++;
+  return l;
+}
+
+/* many small updates without digest: data collected by the provider must
+ * only be reallocated O(log n) times
+ */
+static int test_sig_update_allocs(const char *sigalg_name)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char chunk[CHUNK_SIZE] = { 0 };
+  unsigned char *sig = NULL;
+  size_t siglen = 0, i, allocs;
+  int testresult = 1;
+  int maxallocs = log2_ceil(CHUNK_SIZE * CHUNK_COUNT) + 1;
+
+  if (!alg_is_enabled(sigalg_name)) {
+    printf("Not testing disabled algorithm %s.\n", sigalg_name);
+    return 1;
+  }
+
+  testresult &=
+    (ctx = EVP_PKEY_CTX_new_from_name(libctx, sigalg_name, NULL)) != NULL
+    && EVP_PKEY_keygen_init(ctx)
+    && EVP_PKEY_generate(ctx, &key)
+    && (mdctx = EVP_MD_CTX_new()) != NULL
+    && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, key, NULL);
+
+  alloc_count = 0;
+  counting = 1;
+  for (i = 0; testresult && i < CHUNK_COUNT; i++)
+    testresult &= EVP_DigestSignUpdate(mdctx, chunk, sizeof(chunk));
+  counting = 0;
+  allocs = alloc_count;
+  testresult &= EVP_DigestSignFinal(mdctx, NULL, &siglen)
+                && (sig = OPENSSL_malloc(siglen)) != NULL
+                && EVP_DigestSignFinal(mdctx, sig, &siglen);
+
+  if (testresult) {
+    printf("  %s: %zu allocations (limit %d)\n", sigalg_name, allocs, maxallocs);
+    testresult &= allocs <= (size_t)maxallocs;
+  }
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+/* implementation of alg among the provider's algorithms of operation */
+static const OSSL_DISPATCH *prov_impl(int operation, const char *alg)
+{
+  const OSSL_ALGORITHM *a;
+  size_t len = strlen(alg);
+  int no_cache;
+
+  a = OSSL_PROVIDER_query_operation(prov, operation, &no_cache);
+  for (; a != NULL && a->algorithm_names != NULL; a++)
+    if (!strncmp(a->algorithm_names, alg, len)
+        && (a->algorithm_names[len] == '\0' || a->algorithm_names[len] == ':'))
+      return a->implementation;
+  return NULL;
+}
+
+/* entry of function id in dispatch table d */
+static const OSSL_DISPATCH *prov_fn(const OSSL_DISPATCH *d, int id)
+{
+  static const OSSL_DISPATCH none = { 0, NULL };
+
+  for (; d != NULL && d->function_id != 0; d++)
+    if (d->function_id == id)
+      return d;
+  return &none;
+}
+
+/* the same on one provider signature ctx, initialized again after the
+ * first signature: EVP_DigestSignInit does not do that in OpenSSL 3.0,
+ * so the provider's functions are called directly. The data buffer is
+ * kept, so feeding the same amount again must not allocate at all.
+ */
+static int test_sig_reinit_allocs(const char *sigalg_name)
+{
+  const OSSL_DISPATCH *kmgmt = prov_impl(OSSL_OP_KEYMGMT, sigalg_name);
+  const OSSL_DISPATCH *sigfns = prov_impl(OSSL_OP_SIGNATURE, sigalg_name);
+  OSSL_FUNC_keymgmt_gen_init_fn *gen_init;
+  OSSL_FUNC_keymgmt_gen_fn *gen;
+  OSSL_FUNC_keymgmt_gen_cleanup_fn *gen_cleanup;
+  OSSL_FUNC_keymgmt_free_fn *key_free;
+  OSSL_FUNC_signature_newctx_fn *newctx;
+  OSSL_FUNC_signature_freectx_fn *freectx;
+  OSSL_FUNC_signature_digest_sign_init_fn *sign_init;
+  OSSL_FUNC_signature_digest_sign_update_fn *sign_update;
+  OSSL_FUNC_signature_digest_sign_final_fn *sign_final;
+  void *provctx = OSSL_PROVIDER_get0_provider_ctx(prov);
+  void *genctx = NULL, *key = NULL, *sigctx = NULL;
+  unsigned char chunk[CHUNK_SIZE] = { 0 };
+  unsigned char *sig = NULL;
+  size_t siglen = 0, sigmax = 0, i, allocs[2];
+  int round, testresult = 1;
+
+  if (!alg_is_enabled(sigalg_name)) {
+    printf("Not testing disabled algorithm %s.\n", sigalg_name);
+    return 1;
+  }
+
+  gen_init = OSSL_FUNC_keymgmt_gen_init(prov_fn(kmgmt, OSSL_FUNC_KEYMGMT_GEN_INIT));
+  gen = OSSL_FUNC_keymgmt_gen(prov_fn(kmgmt, OSSL_FUNC_KEYMGMT_GEN));
+  gen_cleanup = OSSL_FUNC_keymgmt_gen_cleanup(prov_fn(kmgmt, OSSL_FUNC_KEYMGMT_GEN_CLEANUP));
+  key_free = OSSL_FUNC_keymgmt_free(prov_fn(kmgmt, OSSL_FUNC_KEYMGMT_FREE));
+  newctx = OSSL_FUNC_signature_newctx(prov_fn(sigfns, OSSL_FUNC_SIGNATURE_NEWCTX));
+  freectx = OSSL_FUNC_signature_freectx(prov_fn(sigfns, OSSL_FUNC_SIGNATURE_FREECTX));
+  sign_init = OSSL_FUNC_signature_digest_sign_init(prov_fn(sigfns, OSSL_FUNC_SIGNATURE_DIGEST_SIGN_INIT));
+  sign_update = OSSL_FUNC_signature_digest_sign_update(prov_fn(sigfns, OSSL_FUNC_SIGNATURE_DIGEST_SIGN_UPDATE));
+  sign_final = OSSL_FUNC_signature_digest_sign_final(prov_fn(sigfns, OSSL_FUNC_SIGNATURE_DIGEST_SIGN_FINAL));
+
+  testresult &= gen_init != NULL && gen != NULL && gen_cleanup != NULL && key_free != NULL
+    && newctx != NULL && freectx != NULL && sign_init != NULL && sign_update != NULL
+    && sign_final != NULL
+    && (genctx = gen_init(provctx, OSSL_KEYMGMT_SELECT_KEYPAIR, NULL)) != NULL
+    && (key = gen(genctx, NULL, NULL)) != NULL
+    && (sigctx = newctx(provctx, NULL)) != NULL;
+
+  for (round = 0; testresult && round < 2; round++) {
+    testresult &= sign_init(sigctx, NULL, key, NULL);
+    alloc_count = 0;
+    counting = 1;
+    for (i = 0; testresult && i < CHUNK_COUNT; i++)
+      testresult &= sign_update(sigctx, chunk, sizeof(chunk));
+    counting = 0;
+    allocs[round] = alloc_count;
+    if (sig == NULL)
+      testresult &= sign_final(sigctx, NULL, &sigmax, 0)
+                    && (sig = OPENSSL_malloc(sigmax)) != NULL;
+    siglen = sigmax;
+    testresult &= sign_final(sigctx, sig, &siglen, sigmax);
+  }
+
+  if (testresult) {
+    printf("  %s: %zu allocations in first, %zu in re-initialized run\n",
+           sigalg_name, allocs[0], allocs[1]);
+    testresult &= allocs[1] == 0;
+  }
+
+  OPENSSL_free(sig);
+  if (sigctx != NULL)
+    freectx(sigctx);
+  if (key != NULL)
+    key_free(key);
+  if (genctx != NULL)
+    gen_cleanup(genctx);
+  return testresult;
+}
+
+static const char *keyalg_names[] = {
+  "dilithium2", "p256_dilithium2", "kyber768", "p384_kyber768", "x25519_kyber512",
+};
+
+/* key objects: one allocation for key and public key. The private key comes
+ * from a slab, which the first round allocated: none for it in the second.
+ */
+#define KEY_ALLOCS_KEYPAIR 1
+#define KEY_ALLOCS_PUBLIC  1
+
+static int test_key_allocs(const char *alg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *pub = NULL;
+  unsigned char *der = NULL;
+  const unsigned char *p;
+  size_t allocs[2] = { 0, 0 };
+  int derlen = 0, round, testresult = 1;
+
+  if (!alg_is_enabled(alg_name)) {
+    printf("Not testing disabled algorithm %s.\n", alg_name);
+    return 1;
+  }
+
+  // second round counts: first one populates the provider's algorithm caches
+  for (round = 0; testresult && round < 2; round++) {
+    EVP_PKEY_free(key);
+    key = NULL;
+    EVP_PKEY_CTX_free(ctx);
+    testresult &=
+      (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg_name, NULL)) != NULL
+      && EVP_PKEY_keygen_init(ctx);
+    key_alloc_count = 0;
+    counting = 1;
+    testresult &= EVP_PKEY_generate(ctx, &key);
+    counting = 0;
+    allocs[0] = key_alloc_count;
+  }
+
+  // KEMs have no SPKI encoding
+  if (testresult && strstr(alg_name, "dilithium") != NULL) {
+    testresult &= (derlen = i2d_PUBKEY(key, &der)) > 0;
+    for (round = 0; testresult && round < 2; round++) {
+      EVP_PKEY_free(pub);
+      p = der;
+      key_alloc_count = 0;
+      counting = 1;
+      testresult &= (pub = d2i_PUBKEY_ex(NULL, &p, derlen, libctx, NULL)) != NULL;
+      counting = 0;
+      allocs[1] = key_alloc_count;
+    }
+  }
+
+  if (testresult) {
+    printf("  %s: %zu allocations for key pair, %zu for decoded public key\n",
+           alg_name, allocs[0], allocs[1]);
+    testresult &= allocs[0] <= KEY_ALLOCS_KEYPAIR && allocs[1] <= KEY_ALLOCS_PUBLIC;
+  }
+
+  OPENSSL_free(der);
+  EVP_PKEY_free(pub);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+int main(int argc, char *argv[])
+{
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  // must precede any allocation
+  T(CRYPTO_set_mem_functions(count_malloc, count_realloc, count_free));
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (test_sig_update_allocs(sigalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  Signature update allocation test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Signature update allocation test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (test_sig_reinit_allocs(sigalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  Signature re-init allocation test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Signature re-init allocation test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < nelem(keyalg_names); i++) {
+    if (test_key_allocs(keyalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  Key allocation test succeeded: %s" cNORM "\n",
+              keyalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Key allocation test failed: %s" cNORM "\n",
+              keyalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
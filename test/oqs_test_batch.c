@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Test of batch signature verification: oqsprov_batch_verify must report
+ * exactly the valid signatures of a batch mixing valid, tampered and
+ * mismatched items of several keys, spanning several worker tasks, with any
+ * number of threads, leave the caller's errors alone and reject batches
+ * whose count cannot be returned.
+ */
+
+#include <limits.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <string.h>
+#include "test_common.h"
+#include "oqsprovider.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+
+static const char *sigalg_names[] = {
+  "dilithium2", "falcon512", "p256_dilithium2",
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+#define ITEM_COUNT 203 // several tasks of 64 items and a partial results byte
+#define MSG_LEN    32
+
+static EVP_PKEY *keygen(const char *alg)
+{
+  EVP_PKEY_CTX *ctx;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+      && EVP_PKEY_keygen_init(ctx))
+    EVP_PKEY_generate(ctx, &key);
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+static int sign(EVP_PKEY *key, const unsigned char *msg, unsigned char **sig, size_t *siglen)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  *sig = NULL;
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, key, NULL)
+       && EVP_DigestSign(mdctx, NULL, siglen, msg, MSG_LEN)
+       && (*sig = OPENSSL_malloc(*siglen)) != NULL
+       && EVP_DigestSign(mdctx, *sig, siglen, msg, MSG_LEN);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+/* items are valid unless tampered with: every third signature has a byte
+ * flipped, every seventh item is checked against another message and one
+ * has no key
+ */
+static int item_valid(size_t i)
+{
+  return i % 3 != 0 && i % 7 != 0 && i != ITEM_COUNT - 3;
+}
+
+static int test_batch(EVP_PKEY **keys, size_t nkeys)
+{
+  static const int threads[] = { 1, 4, 0 };
+  OQSPROV_VERIFY_ITEM items[ITEM_COUNT];
+  unsigned char msgs[ITEM_COUNT][MSG_LEN], *sigs[ITEM_COUNT];
+  unsigned char results[(ITEM_COUNT + 7) / 8];
+  size_t i, t, expected = 0;
+  int n, ok = 1;
+
+  memset(sigs, 0, sizeof(sigs));
+  ok = RAND_bytes(&msgs[0][0], sizeof(msgs)) > 0;
+  for (i = 0; ok && i < ITEM_COUNT; i++) {
+    items[i].key = i != ITEM_COUNT - 3 ? keys[i % nkeys] : NULL;
+    items[i].msg = msgs[i];
+    items[i].msglen = MSG_LEN;
+    ok = sign(keys[i % nkeys], msgs[i], &sigs[i], &items[i].siglen);
+    items[i].sig = sigs[i];
+    if (i % 3 == 0)
+      sigs[i][0] ^= 0x01;
+    if (i % 7 == 0)
+      items[i].msg = msgs[(i + 1) % ITEM_COUNT];
+    expected += item_valid(i);
+  }
+
+  for (t = 0; ok && t < nelem(threads); t++) {
+    memset(results, 0xff, sizeof(results));
+    ERR_raise(ERR_LIB_EVP, ERR_R_PASSED_INVALID_ARGUMENT); // caller's, to be kept
+    n = oqsprov_batch_verify(libctx, NULL, items, ITEM_COUNT, threads[t], results);
+    if (ERR_GET_REASON(ERR_peek_last_error()) != ERR_R_PASSED_INVALID_ARGUMENT) {
+      fprintf(stderr, cRED "  %d threads: error queue of caller changed" cNORM "\n",
+              threads[t]);
+      ok = 0;
+    }
+    ERR_clear_error();
+    if (n != (int)expected) {
+      fprintf(stderr, cRED "  %d threads: %d items verified, expected %zu" cNORM "\n",
+              threads[t], n, expected);
+      ok = 0;
+    }
+    for (i = 0; ok && i < ITEM_COUNT; i++) {
+      if (((results[i / 8] >> (i % 8)) & 1) != item_valid(i)) {
+        fprintf(stderr, cRED "  %d threads: wrong result for item %zu" cNORM "\n",
+                threads[t], i);
+        ok = 0;
+      }
+    }
+    // unused bits of the last byte
+    if (ok && (results[ITEM_COUNT / 8] >> (ITEM_COUNT % 8)) != 0) {
+      fprintf(stderr, cRED "  %d threads: bits beyond the batch set" cNORM "\n", threads[t]);
+      ok = 0;
+    }
+  }
+
+  if (ok && oqsprov_batch_verify(libctx, NULL, items, 0, 1, results) != 0) {
+    fprintf(stderr, cRED "  empty batch not accepted" cNORM "\n");
+    ok = 0;
+  }
+  if (ok && oqsprov_batch_verify(libctx, NULL, items, (size_t)INT_MAX + 1, 1, results) != -1) {
+    fprintf(stderr, cRED "  batch beyond INT_MAX items not rejected" cNORM "\n");
+    ok = 0;
+  }
+  ERR_clear_error();
+
+  for (i = 0; i < ITEM_COUNT; i++)
+    OPENSSL_free(sigs[i]);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  EVP_PKEY *keys[nelem(sigalg_names)];
+  size_t i, n = 0;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (!alg_is_enabled(sigalg_names[i])) {
+      printf("Not testing disabled algorithm %s.\n", sigalg_names[i]);
+      continue;
+    }
+    T((keys[n++] = keygen(sigalg_names[i])) != NULL);
+  }
+
+  if (n > 0 && test_batch(keys, n)) {
+    fprintf(stderr, cGREEN "  Batch verification test succeeded" cNORM "\n");
+  } else if (n > 0) {
+    fprintf(stderr, cRED "  Batch verification test failed" cNORM "\n");
+    ERR_print_errors_fp(stderr);
+    errcnt++;
+  }
+  for (i = 0; i < n; i++)
+    EVP_PKEY_free(keys[i]);
+
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
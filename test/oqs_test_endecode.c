@@ -207,6 +207,20 @@ static int decode_EVP_PKEY_prov(const char *input_type, const char *structure, c
     return ok;
 }
 
+static int reencode_EVP_PKEY_prov(const EVP_PKEY *pkey, const ENDECODE_PARAMS *params,
+                                  const void *encoded, const long encoded_len) {
+    void *reencoded = NULL;
+    long reencoded_len = 0;
+    int ok;
+
+    ok = encode_EVP_PKEY_prov(pkey, params->format, params->structure, NULL,
+                              params->selection, &reencoded, &reencoded_len)
+         && reencoded_len == encoded_len
+         && memcmp(reencoded, encoded, encoded_len) == 0;
+    OPENSSL_free(reencoded);
+    return ok;
+}
+
 static int test_oqs_encdec(const char *sigalg_name) {
     EVP_PKEY *pkey = NULL;
     EVP_PKEY *decoded_pkey = NULL;
@@ -238,9 +252,24 @@ static int test_oqs_encdec(const char *sigalg_name) {
 
         if (EVP_PKEY_eq(pkey, decoded_pkey) != 1)
             goto end;
+
+        /* unencrypted encodings are deterministic: same output for the decoded key,
+         * which also covers its private part */
+        if (test_params_list[i].pass == NULL
+            && !reencode_EVP_PKEY_prov(decoded_pkey, &test_params_list[i], encoded, encoded_len)) {
+            printf("Failed re-encoding %s", sigalg_name);
+            goto end;
+        }
+        OPENSSL_free(encoded);
+        encoded = NULL;
+        EVP_PKEY_free(pkey);
+        pkey = NULL;
+        EVP_PKEY_free(decoded_pkey);
+        decoded_pkey = NULL;
     }
     ok = 1;
     end:
+    OPENSSL_free(encoded);
     EVP_PKEY_free(pkey);
     EVP_PKEY_free(decoded_pkey);
     return ok;
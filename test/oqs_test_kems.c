@@ -3,6 +3,7 @@
 #include <openssl/evp.h>
 #include <openssl/provider.h>
 #include "test_common.h"
+#include <ctype.h>
 #include <string.h>
 #include "oqs/oqs.h"
 
@@ -82,6 +83,23 @@ static const char *kemalg_names[] = {
 ///// OQS_TEMPLATE_FRAGMENT_KEM_CASES_END
 };
 
+/* group name of keygen ctx can only be the algorithm's own, in any case */
+static int test_group_name(EVP_PKEY_CTX *ctx, const char *kemalg_name)
+{
+  char upper[64];
+  size_t i;
+  int ok;
+
+  for (i = 0; kemalg_name[i] != '\0' && i < sizeof(upper) - 1; i++)
+    upper[i] = toupper((unsigned char)kemalg_name[i]);
+  upper[i] = '\0';
+  ok = EVP_PKEY_CTX_set_group_name(ctx, upper) > 0
+       && EVP_PKEY_CTX_set_group_name(ctx, strcmp(kemalg_name, "kyber512") ? "kyber512"
+                                                                          : "kyber768") <= 0;
+  ERR_clear_error();
+  return ok;
+}
+
 static int test_oqs_kems(const char *kemalg_name)
 {
   EVP_MD_CTX *mdctx = NULL;
@@ -102,6 +120,7 @@ static int test_oqs_kems(const char *kemalg_name)
     testresult &=
       (ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) != NULL
       && EVP_PKEY_keygen_init(ctx)
+      && test_group_name(ctx, kemalg_name)
       && EVP_PKEY_generate(ctx, &key);
 
     if (!testresult) goto err;
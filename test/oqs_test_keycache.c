@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Tests public keys served by the provider's decoded key cache (configured
+ * in the config file passed): threads concurrently decode more distinct
+ * SPKIs than the cache holds, so that keys are shared, evicted and decoded
+ * again while in use elsewhere. Each decoded key must equal the original
+ * and verify its signature.
+ */
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <string.h>
+#include "test_common.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static OSSL_PROVIDER *prov = NULL;
+
+/* more keys than spki_cache_size in oqs_keycache.cnf */
+static const char *sigalg_names[] = {
+  "dilithium2", "falcon512", "p256_dilithium2", "rsa3072_falcon512",
+  "dilithium3", "p384_dilithium3", "falcon1024", "p256_falcon512",
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+#define THREAD_COUNT 8
+#define ROUNDS       200 // decodes per thread
+
+typedef struct {
+  EVP_PKEY *key;
+  unsigned char *spki;
+  int spkilen;
+  unsigned char *sig;
+  size_t siglen;
+} TEST_KEY;
+
+static TEST_KEY keys[nelem(sigalg_names)];
+static const unsigned char msg[] = "The quick brown fox jumps over... you know what";
+static _Atomic int failures = 0;
+
+static int key_make(const char *alg, TEST_KEY *k)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &k->key)
+       && (k->spkilen = i2d_PUBKEY(k->key, &k->spki)) > 0
+       && (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, k->key, NULL)
+       && EVP_DigestSign(mdctx, NULL, &k->siglen, msg, sizeof(msg))
+       && (k->sig = OPENSSL_malloc(k->siglen)) != NULL
+       && EVP_DigestSign(mdctx, k->sig, &k->siglen, msg, sizeof(msg));
+
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+static int decode_and_verify(const TEST_KEY *k)
+{
+  const unsigned char *p = k->spki;
+  EVP_PKEY *pub = NULL;
+  EVP_MD_CTX *mdctx = NULL;
+  int ok;
+
+  if (k->key == NULL) // algorithm disabled
+    return 1;
+  ok = (pub = d2i_PUBKEY_ex(NULL, &p, k->spkilen, libctx, NULL)) != NULL
+       && EVP_PKEY_eq(pub, k->key) == 1
+       && (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, libctx, NULL, pub, NULL)
+       && EVP_DigestVerify(mdctx, k->sig, k->siglen, msg, sizeof(msg)) == 1;
+
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_free(pub);
+  return ok;
+}
+
+static void *decode_thread(void *arg)
+{
+  size_t t = (size_t)arg, i;
+
+  for (i = 0; i < ROUNDS; i++)
+    if (!decode_and_verify(&keys[(i * 5 + t) % nelem(keys)])) {
+      failures++;
+      ERR_print_errors_fp(stderr);
+    }
+  return NULL;
+}
+
+static int test_concurrent_decode(void)
+{
+  pthread_t threads[THREAD_COUNT];
+  size_t i, started;
+
+  for (started = 0; started < THREAD_COUNT; started++)
+    if (pthread_create(&threads[started], NULL, decode_thread, (void *)started) != 0)
+      break;
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  return started == THREAD_COUNT && failures == 0;
+}
+
+/* decoded keys may be shared with other users: no modifications */
+static int test_immutable(const TEST_KEY *k)
+{
+  const unsigned char *p = k->spki;
+  EVP_PKEY *pub = NULL;
+  unsigned char *enc = NULL;
+  size_t enclen;
+  char propq[] = "provider=oqsprovider";
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_PROPERTIES, propq, 0),
+    OSSL_PARAM_END
+  };
+  int ok;
+
+  ok = (pub = d2i_PUBKEY_ex(NULL, &p, k->spkilen, libctx, NULL)) != NULL
+       && (enclen = EVP_PKEY_get1_encoded_public_key(pub, &enc)) > 0
+       && !EVP_PKEY_set1_encoded_public_key(pub, enc, enclen)
+       && !EVP_PKEY_set_params(pub, params);
+  ERR_clear_error();
+
+  OPENSSL_free(enc);
+  EVP_PKEY_free(pub);
+  return ok;
+}
+
+/* hits and misses */
+static int cache_stats_get(uint64_t stats[2])
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-spki-cache-hits", &stats[0]),
+    OSSL_PARAM_uint64("oqs-spki-cache-misses", &stats[1]),
+    OSSL_PARAM_END
+  };
+
+  return OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]) && OSSL_PARAM_modified(&params[1]);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t stats[2];
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (!alg_is_enabled(sigalg_names[i])) {
+      printf("Not testing disabled algorithm %s.\n", sigalg_names[i]);
+      continue;
+    }
+    T(key_make(sigalg_names[i], &keys[i]));
+  }
+
+  if (test_concurrent_decode()) {
+    fprintf(stderr, cGREEN "  Concurrent decoding test succeeded" cNORM "\n");
+  } else {
+    fprintf(stderr, cRED "  Concurrent decoding test failed: %d decodes" cNORM "\n",
+            (int)failures);
+    errcnt++;
+  }
+  if (keys[0].key == NULL || test_immutable(&keys[0])) {
+    fprintf(stderr, cGREEN "  Decoded key immutability test succeeded" cNORM "\n");
+  } else {
+    fprintf(stderr, cRED "  Decoded key immutability test failed" cNORM "\n");
+    ERR_print_errors_fp(stderr);
+    errcnt++;
+  }
+  if (!cache_stats_get(stats)) {
+    fprintf(stderr, cRED "  Decoded key cache counters not available" cNORM "\n");
+    errcnt++;
+  } else {
+    printf("  %llu cache hits, %llu misses\n",
+           (unsigned long long)stats[0], (unsigned long long)stats[1]);
+    if (stats[0] == 0) {
+      fprintf(stderr, cRED "  Decoded key cache not used" cNORM "\n");
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < nelem(keys); i++) {
+    EVP_PKEY_free(keys[i].key);
+    OPENSSL_free(keys[i].spki);
+    OPENSSL_free(keys[i].sig);
+  }
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Tests KEM keys handed out by the provider's keypair pools (configured in
+ * the config file passed): keys must come from the pool, which must get
+ * refilled, and every key must work and be used only once.
+ */
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <string.h>
+#include "test_common.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static OSSL_PROVIDER *prov = NULL;
+
+/* groups with pools in oqs_keypool.cnf */
+static const char *kemalg_names[] = {
+  "kyber512", "p256_kyber512", "x25519_kyber512", "p384_kyber768",
+};
+
+#define KEY_COUNT 1024 /* upper bound on keys generated before REFILLS */
+/* the pool of the group tested before may still finish one refill: at least
+ * two of these are refills of the pool under test, i.e., it got refilled
+ * after its initial fill */
+#define REFILLS   3
+
+static int kem_roundtrip(EVP_PKEY *key)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  unsigned char *ct = NULL, *secenc = NULL, *secdec = NULL;
+  size_t ctlen, seclen;
+  int ok;
+
+  ok = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+       && EVP_PKEY_encapsulate_init(ctx, NULL)
+       && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &seclen)
+       && (ct = OPENSSL_malloc(ctlen)) != NULL
+       && (secenc = OPENSSL_malloc(seclen)) != NULL
+       && (secdec = OPENSSL_malloc(seclen)) != NULL
+       && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secenc, &seclen)
+       && EVP_PKEY_decapsulate_init(ctx, NULL)
+       && EVP_PKEY_decapsulate(ctx, secdec, &seclen, ct, ctlen)
+       && memcmp(secenc, secdec, seclen) == 0;
+
+  OPENSSL_free(ct);
+  OPENSSL_free(secenc);
+  OPENSSL_free(secdec);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+/* keys handed out by and refills of all pools */
+static int keypool_stats_get(uint64_t stats[2])
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64("oqs-kem-keypool-hits", &stats[0]),
+    OSSL_PARAM_uint64("oqs-kem-keypool-refills", &stats[1]),
+    OSSL_PARAM_END
+  };
+
+  return OSSL_PROVIDER_get_params(prov, params)
+         && OSSL_PARAM_modified(&params[0]) && OSSL_PARAM_modified(&params[1]);
+}
+
+static int test_keypool(const char *kemalg_name)
+{
+  static EVP_PKEY *keys[KEY_COUNT];
+  static unsigned char *pubs[KEY_COUNT];
+  static size_t publen[KEY_COUNT];
+  EVP_PKEY_CTX *ctx = NULL;
+  uint64_t before[2], after[2] = { 0, 0 };
+  int i, j, n, testresult = 1;
+
+  if (!alg_is_enabled(kemalg_name)) {
+    printf("Not testing disabled algorithm %s.\n", kemalg_name);
+    return 1;
+  }
+
+  testresult &= keypool_stats_get(before)
+                && (ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) != NULL
+                && EVP_PKEY_keygen_init(ctx);
+  /* the first key triggers the initial fill; keep taking keys until the
+   * pool has run low and been refilled again */
+  for (i = 0; testresult && i < KEY_COUNT && after[1] - before[1] < REFILLS; i++) {
+    testresult &= EVP_PKEY_generate(ctx, &keys[i])
+                  && kem_roundtrip(keys[i])
+                  && EVP_PKEY_get_octet_string_param(keys[i], OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                                     NULL, 0, &publen[i])
+                  && (pubs[i] = OPENSSL_malloc(publen[i])) != NULL
+                  && EVP_PKEY_get_octet_string_param(keys[i], OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                                     pubs[i], publen[i], &publen[i]);
+    for (j = 0; testresult && j < i; j++)
+      testresult &= publen[j] != publen[i] || memcmp(pubs[j], pubs[i], publen[i]) != 0;
+    testresult &= keypool_stats_get(after);
+  }
+  n = i;
+  if (testresult) {
+    printf("  %s: %d keys, %llu from pool, %llu refills\n", kemalg_name, n,
+           (unsigned long long)(after[0] - before[0]),
+           (unsigned long long)(after[1] - before[1]));
+    testresult &= after[0] > before[0] && after[1] - before[1] >= REFILLS;
+  }
+
+  for (i = 0; i < n; i++) {
+    EVP_PKEY_free(keys[i]);
+    OPENSSL_free(pubs[i]);
+    keys[i] = NULL;
+    pubs[i] = NULL;
+  }
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+int main(int argc, char *argv[])
+{
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  for (i = 0; i < nelem(kemalg_names); i++) {
+    if (test_keypool(kemalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  KEM keypool test succeeded: %s" cNORM "\n",
+              kemalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  KEM keypool test failed: %s" cNORM "\n",
+              kemalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
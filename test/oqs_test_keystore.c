@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Round-trip test of key store files: keys exported by several threads with
+ * oqsprov_keystore_export must be imported by oqsprov_keystore_import,
+ * encode to exactly the DER stored for them and sign verifiably. Damaged
+ * files must be rejected.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "oqsprovider.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static OSSL_PROVIDER *prov = NULL;
+
+static const char *sigalg_names[] = {
+  "dilithium2", "falcon512", "p256_dilithium2", "p384_dilithium3",
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+#define KEY_COUNT 100
+#define THREADS   4
+
+static const unsigned char msg[] = "The quick brown fox jumps over... you know what";
+
+static unsigned char *file_read(const char *path, long *len)
+{
+  FILE *fp = fopen(path, "rb");
+  unsigned char *data = NULL;
+
+  if (fp != NULL && fseek(fp, 0, SEEK_END) == 0 && (*len = ftell(fp)) > 0
+      && fseek(fp, 0, SEEK_SET) == 0 && (data = OPENSSL_malloc(*len)) != NULL
+      && fread(data, 1, *len, fp) != (size_t)*len) {
+    OPENSSL_free(data);
+    data = NULL;
+  }
+  if (fp != NULL)
+    fclose(fp);
+  return data;
+}
+
+static int file_write(const char *path, const unsigned char *data, long len)
+{
+  FILE *fp = fopen(path, "wb");
+  int ok = fp != NULL && fwrite(data, 1, len, fp) == (size_t)len;
+
+  return fp != NULL && fclose(fp) == 0 && ok;
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+  return (unsigned long)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* stored DER of key i */
+static const unsigned char *store_key(const unsigned char *store, size_t i, long *len)
+{
+  const unsigned char *entry = store + 12 + 12 * i;
+
+  *len = get_u32(entry + 8);
+  return store + (get_u32(entry) << 32 | get_u32(entry + 4));
+}
+
+static int sign_verify(EVP_PKEY *key)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  unsigned char *sig = NULL;
+  size_t siglen;
+  int ok;
+
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, key, NULL)
+       && EVP_DigestSign(mdctx, NULL, &siglen, msg, sizeof(msg))
+       && (sig = OPENSSL_malloc(siglen)) != NULL
+       && EVP_DigestSign(mdctx, sig, &siglen, msg, sizeof(msg))
+       && EVP_MD_CTX_reset(mdctx)
+       && EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, libctx, NULL, key, NULL)
+       && EVP_DigestVerify(mdctx, sig, siglen, msg, sizeof(msg)) == 1;
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+static int test_keystore(const char *alg, const char *path)
+{
+  EVP_PKEY *keys[KEY_COUNT];
+  unsigned char *store = NULL, *der;
+  const unsigned char *stored;
+  long storelen = 0, len;
+  struct stat st;
+  size_t i;
+  int derlen, n, ok = 1;
+
+  memset(keys, 0, sizeof(keys));
+  // an existing file readable by others must be restricted, too
+  if (!file_write(path, msg, sizeof(msg)) || chmod(path, 0644) != 0) {
+    fprintf(stderr, cRED "  cannot create %s" cNORM "\n", path);
+    return 0;
+  }
+  if ((n = oqsprov_keystore_export(prov, alg, KEY_COUNT, THREADS, path)) != KEY_COUNT) {
+    fprintf(stderr, cRED "  export returned %d" cNORM "\n", n);
+    return 0;
+  }
+  if (stat(path, &st) != 0 || (st.st_mode & 077) != 0) {
+    fprintf(stderr, cRED "  key store accessible by others" cNORM "\n");
+    ok = 0;
+  }
+  if ((n = oqsprov_keystore_import(libctx, NULL, path, keys, KEY_COUNT, THREADS)) != KEY_COUNT) {
+    fprintf(stderr, cRED "  import returned %d" cNORM "\n", n);
+    ok = 0;
+  }
+  if ((store = file_read(path, &storelen)) == NULL)
+    ok = 0;
+  for (i = 0; ok && i < KEY_COUNT; i++) {
+    der = NULL;
+    stored = store_key(store, i, &len);
+    ok = keys[i] != NULL
+         && (derlen = i2d_PrivateKey(keys[i], &der)) == len
+         && !memcmp(der, stored, len);
+    OPENSSL_free(der);
+    if (!ok)
+      fprintf(stderr, cRED "  key %zu does not match its DER" cNORM "\n", i);
+  }
+  if (ok && EVP_PKEY_eq(keys[0], keys[KEY_COUNT - 1]) == 1) {
+    fprintf(stderr, cRED "  keys generated are not distinct" cNORM "\n");
+    ok = 0;
+  }
+  if (ok && !sign_verify(keys[KEY_COUNT - 1])) {
+    fprintf(stderr, cRED "  imported key does not sign" cNORM "\n");
+    ok = 0;
+  }
+  for (i = 0; i < KEY_COUNT; i++)
+    EVP_PKEY_free(keys[i]);
+
+  // index pointing beyond the end of the file
+  if (ok
+      && (!file_write(path, store, storelen - 1)
+          || oqsprov_keystore_import(libctx, NULL, path, keys, KEY_COUNT, THREADS) != -1)) {
+    fprintf(stderr, cRED "  truncated key store not rejected" cNORM "\n");
+    ok = 0;
+  }
+  OPENSSL_free(store);
+  unlink(path);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  char path[64];
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  snprintf(path, sizeof(path), "oqs_test_keystore_%d.bin", (int)getpid());
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (!alg_is_enabled(sigalg_names[i])) {
+      printf("Not testing disabled algorithm %s.\n", sigalg_names[i]);
+      continue;
+    }
+    if (test_keystore(sigalg_names[i], path)) {
+      fprintf(stderr,
+              cGREEN "  Key store test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Key store test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
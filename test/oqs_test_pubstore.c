@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Round-trip test of public key stores: public keys written by
+ * oqsprov_pubkey_store_write must be loaded through OSSL_STORE, equal the
+ * keys written, grouped by algorithm, and verify signatures of their private
+ * keys after the store is closed. Loaded keys must not be modifiable and
+ * damaged files must be rejected.
+ */
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/store.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "oqsprovider.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+
+static const char *sigalg_names[] = {
+  "dilithium2", "falcon512", "p256_dilithium2", "p384_dilithium3",
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+#define KEY_COUNT 40 // interleaving all algorithms
+
+static const unsigned char msg[] = "The quick brown fox jumps over... you know what";
+
+static int file_truncate(const char *path, long len)
+{
+  return truncate(path, len) == 0;
+}
+
+static EVP_PKEY *keygen(const char *alg)
+{
+  EVP_PKEY_CTX *ctx;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+      && EVP_PKEY_keygen_init(ctx))
+    EVP_PKEY_generate(ctx, &key);
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+static int sign_verify(EVP_PKEY *priv, EVP_PKEY *pub)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  unsigned char *sig = NULL;
+  size_t siglen;
+  int ok;
+
+  ok = (mdctx = EVP_MD_CTX_new()) != NULL
+       && EVP_DigestSignInit_ex(mdctx, NULL, NULL, libctx, NULL, priv, NULL)
+       && EVP_DigestSign(mdctx, NULL, &siglen, msg, sizeof(msg))
+       && (sig = OPENSSL_malloc(siglen)) != NULL
+       && EVP_DigestSign(mdctx, sig, &siglen, msg, sizeof(msg))
+       && EVP_MD_CTX_reset(mdctx)
+       && EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, libctx, NULL, pub, NULL)
+       && EVP_DigestVerify(mdctx, sig, siglen, msg, sizeof(msg)) == 1;
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+/* loads up to max keys from store at path; -1 on error */
+static int store_load(const char *path, EVP_PKEY **keys, int max)
+{
+  char uri[80];
+  OSSL_STORE_CTX *store;
+  OSSL_STORE_INFO *info;
+  int n = 0, ok = 1;
+
+  snprintf(uri, sizeof(uri), "%s:%s", OQSPROV_PUBKEY_STORE_SCHEME, path);
+  if ((store = OSSL_STORE_open_ex(uri, libctx, NULL, NULL, NULL, NULL, NULL, NULL)) == NULL)
+    return -1;
+  while (ok && !OSSL_STORE_eof(store)) {
+    if ((info = OSSL_STORE_load(store)) == NULL)
+      ok = OSSL_STORE_eof(store);
+    else if (n >= max || OSSL_STORE_INFO_get_type(info) != OSSL_STORE_INFO_PUBKEY)
+      ok = 0;
+    else
+      ok = (keys[n++] = OSSL_STORE_INFO_get1_PUBKEY(info)) != NULL;
+    OSSL_STORE_INFO_free(info);
+  }
+  OSSL_STORE_close(store);
+  return ok ? n : -1;
+}
+
+static int test_pubstore(EVP_PKEY **keys, size_t nkeys, const char *path)
+{
+  EVP_PKEY *loaded[KEY_COUNT];
+  unsigned char pub[8];
+  size_t i, j, k = 0;
+  int n, ok = 1;
+
+  memset(loaded, 0, sizeof(loaded));
+  if ((n = oqsprov_pubkey_store_write(path, keys, nkeys)) != (int)nkeys) {
+    fprintf(stderr, cRED "  writing store returned %d" cNORM "\n", n);
+    return 0;
+  }
+  if ((n = store_load(path, loaded, KEY_COUNT)) != (int)nkeys) {
+    fprintf(stderr, cRED "  loading store returned %d" cNORM "\n", n);
+    ok = 0;
+  }
+  // one group per algorithm, in order of first appearance
+  for (j = 0; ok && j < nkeys; j++) {
+    for (i = 0; i < j && !EVP_PKEY_is_a(keys[i], EVP_PKEY_get0_type_name(keys[j])); i++)
+      ;
+    for (i = i < j ? nkeys : j; ok && i < nkeys; i++) {
+      if (!EVP_PKEY_is_a(keys[i], EVP_PKEY_get0_type_name(keys[j])))
+        continue;
+      ok = EVP_PKEY_eq(keys[i], loaded[k]) == 1
+           && sign_verify(keys[i], loaded[k]);
+      if (!ok)
+        fprintf(stderr, cRED "  key %zu not loaded as key %zu" cNORM "\n", i, k);
+      k++;
+    }
+  }
+  if (ok && EVP_PKEY_set1_encoded_public_key(loaded[0], pub, sizeof(pub))) {
+    fprintf(stderr, cRED "  loaded key modified" cNORM "\n");
+    ok = 0;
+  }
+  for (i = 0; i < KEY_COUNT; i++)
+    EVP_PKEY_free(loaded[i]);
+  ERR_clear_error();
+
+  // records beyond the end of the file
+  if (ok && (!file_truncate(path, 100) || store_load(path, loaded, KEY_COUNT) != -1)) {
+    fprintf(stderr, cRED "  truncated public key store not rejected" cNORM "\n");
+    ok = 0;
+  }
+  ERR_clear_error();
+  unlink(path);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  EVP_PKEY *keys[KEY_COUNT];
+  const char *alg;
+  char path[64];
+  size_t i, n = 0;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+
+  for (i = 0; i < KEY_COUNT; i++) {
+    alg = sigalg_names[i % nelem(sigalg_names)];
+    if (!alg_is_enabled(alg)) {
+      if (i < nelem(sigalg_names))
+        printf("Not testing disabled algorithm %s.\n", alg);
+      continue;
+    }
+    T((keys[n++] = keygen(alg)) != NULL);
+  }
+
+  snprintf(path, sizeof(path), "oqs_test_pubstore_%d.bin", (int)getpid());
+  if (n > 0 && test_pubstore(keys, n, path)) {
+    fprintf(stderr, cGREEN "  Public key store test succeeded" cNORM "\n");
+  } else if (n > 0) {
+    fprintf(stderr, cRED "  Public key store test failed" cNORM "\n");
+    ERR_print_errors_fp(stderr);
+    errcnt++;
+  }
+  for (i = 0; i < n; i++)
+    EVP_PKEY_free(keys[i]);
+
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
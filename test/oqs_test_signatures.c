@@ -2,6 +2,8 @@
 
 #include <openssl/evp.h>
 #include <openssl/provider.h>
+#include <openssl/core_names.h>
+#include <openssl/x509.h>
 #include "test_common.h"
 #include "oqs/oqs.h"
 
@@ -58,6 +60,40 @@ static const char *sigalg_names[] = {
 ///// OQS_TEMPLATE_FRAGMENT_SIGNATURE_CASES_END
 };
 
+// the AlgorithmIdentifier reported for certificates must name the algorithm,
+// also for duplicated contexts
+static int test_aid(EVP_MD_CTX *mdctx, const char *sigalg_name)
+{
+  X509_ALGOR *algor = X509_ALGOR_new();
+  EVP_MD_CTX *dupctx = EVP_MD_CTX_new();
+  unsigned char aid[128], aid2[128], *expected = NULL;
+  int expectedlen = 0, ok;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_string(OSSL_SIGNATURE_PARAM_ALGORITHM_ID, aid, sizeof(aid)),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM params2[] = {
+    OSSL_PARAM_octet_string(OSSL_SIGNATURE_PARAM_ALGORITHM_ID, aid2, sizeof(aid2)),
+    OSSL_PARAM_END
+  };
+
+  ok = algor != NULL && dupctx != NULL
+    && X509_ALGOR_set0(algor, OBJ_txt2obj(sigalg_name, 0), V_ASN1_UNDEF, NULL)
+    && (expectedlen = i2d_X509_ALGOR(algor, &expected)) > 0
+    && EVP_PKEY_CTX_get_params(EVP_MD_CTX_get_pkey_ctx(mdctx), params)
+    && params[0].return_size == (size_t)expectedlen
+    && !memcmp(aid, expected, expectedlen)
+    && EVP_MD_CTX_copy_ex(dupctx, mdctx)
+    && EVP_PKEY_CTX_get_params(EVP_MD_CTX_get_pkey_ctx(dupctx), params2)
+    && params2[0].return_size == (size_t)expectedlen
+    && !memcmp(aid2, expected, expectedlen);
+
+  OPENSSL_free(expected);
+  EVP_MD_CTX_free(dupctx);
+  X509_ALGOR_free(algor);
+  return ok;
+}
+
 // sign-and-hash must work with and without providing a digest algorithm
 static int test_oqs_signatures(const char *sigalg_name)
 {
@@ -115,6 +151,7 @@ static int test_oqs_signatures(const char *sigalg_name)
     && EVP_DigestSignFinal(mdctx, NULL, &siglen)
     && (sig = OPENSSL_malloc(siglen)) != NULL
     && EVP_DigestSignFinal(mdctx, sig, &siglen)
+    && test_aid(mdctx, sigalg_name)
     && EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, libctx, NULL, key, NULL)
     && EVP_DigestVerifyUpdate(mdctx, msg, sizeof(msg))
     && EVP_DigestVerifyFinal(mdctx, sig, siglen);
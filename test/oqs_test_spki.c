@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Equivalence test of the direct SubjectPublicKeyInfo decoder: for valid and
+ * randomly mutated SPKIs it must give the same result as decoding via
+ * X509_PUBKEY, whenever it takes the input at all. The SPKIs are made by the
+ * direct encoder, which must match X509_PUBKEY too. Calls provider internals,
+ * so it links the provider, which is also the module OpenSSL loads.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/x509.h>
+#include <string.h>
+#include "test_common.h"
+#include "oqs_prov.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+
+static const char *sigalg_names[] = {
+  "dilithium2", "dilithium2_aes", "falcon512", "p256_dilithium2",
+  "rsa3072_falcon512", "p521_dilithium5",
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+#define FUZZ_ROUNDS 2000 // per algorithm
+#define SPKI_MAX    8192
+
+typedef struct {
+  unsigned char der[SPKI_MAX];
+  size_t len;
+  const unsigned char *aid; // AlgorithmIdentifier within der
+  size_t aidlen;
+  const unsigned char *bits; // key, after the unused bits byte
+  size_t bitslen;
+} SPKI;
+
+static SPKI spkis[nelem(sigalg_names)];
+
+static unsigned long long rnd_state = 0x9e3779b97f4a7c15ull;
+
+static unsigned int rnd(void)
+{
+  rnd_state ^= rnd_state << 13; // xorshift64, fixed seed: reproducible
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return (unsigned int)(rnd_state >> 32);
+}
+
+static size_t der_header(unsigned char *out, int tag, size_t len)
+{
+  size_t n = 0;
+
+  out[n++] = tag;
+  if (len < 0x80) {
+    out[n++] = len;
+  } else if (len < 0x100) {
+    out[n++] = 0x81;
+    out[n++] = len;
+  } else {
+    out[n++] = 0x82;
+    out[n++] = len >> 8;
+    out[n++] = len & 0xff;
+  }
+  return n;
+}
+
+/* header length of well-formed DER element at p */
+static size_t der_skip_header(const unsigned char *p, size_t *len)
+{
+  size_t n = 2, i;
+
+  *len = p[1];
+  if (p[1] & 0x80) {
+    for (*len = 0, i = 0; i < (p[1] & 0x7fu); i++)
+      *len = *len << 8 | p[n++];
+  }
+  return n;
+}
+
+static size_t spki_build(unsigned char *out, const unsigned char *aid, size_t aidlen,
+                         const unsigned char *bits, size_t bitslen)
+{
+  unsigned char hdr[8];
+  size_t bhdr = der_header(hdr, 0x03, bitslen + 1);
+  size_t n = der_header(out, 0x30, aidlen + bhdr + bitslen + 1);
+
+  memcpy(out + n, aid, aidlen);
+  n += aidlen;
+  memcpy(out + n, hdr, bhdr);
+  n += bhdr;
+  out[n++] = 0;
+  memcpy(out + n, bits, bitslen);
+  return n + bitslen;
+}
+
+static int spki_make(const char *alg, SPKI *spki)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char *p = spki->der;
+  const unsigned char *q;
+  size_t len;
+  int ok;
+
+  ok = (ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) != NULL
+       && EVP_PKEY_keygen_init(ctx)
+       && EVP_PKEY_generate(ctx, &key)
+       && i2d_PUBKEY(key, NULL) <= SPKI_MAX
+       && (spki->len = i2d_PUBKEY(key, &p)) > 0;
+  if (ok) {
+    q = spki->der + der_skip_header(spki->der, &len);
+    spki->aid = q;
+    q += der_skip_header(q, &len) + len;
+    spki->aidlen = q - spki->aid;
+    q += der_skip_header(q, &len);
+    spki->bits = q + 1;
+    spki->bitslen = len - 1;
+  }
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return ok;
+}
+
+/* random variant of spki into out, mostly still of SPKI shape */
+static size_t spki_mutate(const SPKI *spki, unsigned char *out)
+{
+  unsigned char bits[SPKI_MAX];
+  const SPKI *other;
+  size_t len = spki->len, bitslen, i;
+
+  switch (rnd() % 6) {
+  case 0: // flip bytes
+    memcpy(out, spki->der, len);
+    for (i = rnd() % 3; i < 3; i++)
+      out[rnd() % len] ^= 1 + rnd() % 255;
+    return len;
+  case 1: // truncate
+    memcpy(out, spki->der, len);
+    return rnd() % len;
+  case 2: // key shorter or longer
+    bitslen = spki->bitslen + (rnd() % 33) - 16;
+    for (i = 0; i < bitslen; i++)
+      bits[i] = i < spki->bitslen ? spki->bits[i] : rnd();
+    return spki_build(out, spki->aid, spki->aidlen, bits, bitslen);
+  case 3: // key of another algorithm, among the enabled ones
+    do
+      other = &spkis[rnd() % nelem(spkis)];
+    while (other->len == 0);
+    return spki_build(out, other->aid, other->aidlen, spki->bits, spki->bitslen);
+  case 4: // trailing data
+    memcpy(out, spki->der, len);
+    for (i = 1 + rnd() % 8; i > 0; i--)
+      out[len++] = rnd();
+    return len;
+  default: // non-minimal outer length
+    out[0] = 0x30;
+    out[1] = 0x83;
+    out[2] = 0;
+    len = spki->len - der_skip_header(spki->der, &i);
+    out[3] = i >> 8;
+    out[4] = i & 0xff;
+    memcpy(out + 5, spki->der + spki->len - len, len);
+    return len + 5;
+  }
+}
+
+/* -1: direct decoder did not take input, 0: results differ, 1: same */
+static int spki_compare(const unsigned char *der, size_t len)
+{
+  const unsigned char *p1 = der, *p2 = der;
+  OQSX_KEY *k1 = NULL, *k2 = NULL;
+  X509_PUBKEY *xpk;
+  int ret;
+
+  if (!oqsx_key_from_spki(&p1, len, NULL, NULL, &k1)) {
+    ret = p1 == der ? -1 : 0;
+  } else {
+    xpk = oqsx_d2i_X509_PUBKEY_INTERNAL(&p2, len, NULL);
+    k2 = oqsx_key_from_x509pubkey(xpk, NULL, NULL);
+    X509_PUBKEY_free(xpk);
+    if (k1 == NULL || k2 == NULL)
+      ret = k1 == k2;
+    else
+      ret = p1 == p2
+            && !strcmp(k1->tls_name, k2->tls_name)
+            && k1->pubkeylen == k2->pubkeylen
+            && !memcmp(k1->pubkey, k2->pubkey, k1->pubkeylen);
+  }
+  ERR_clear_error();
+  oqsx_key_free(k1);
+  oqsx_key_free(k2);
+  return ret;
+}
+
+/* encoder output must equal the SPKI serialized via X509_PUBKEY */
+static int spki_reencode(const SPKI *spki)
+{
+  const unsigned char *p = spki->der;
+  OQSX_KEY *key = NULL;
+  X509_PUBKEY *xpk = NULL;
+  unsigned char *der = NULL, *pub = NULL;
+  int derlen = 0, ok;
+
+  ok = oqsx_key_from_spki(&p, spki->len, NULL, NULL, &key) && key != NULL
+       && (xpk = X509_PUBKEY_new()) != NULL
+       && (pub = OPENSSL_memdup(key->pubkey, key->pubkeylen)) != NULL
+       && X509_PUBKEY_set0_param(xpk, OBJ_nid2obj(OBJ_sn2nid(key->tls_name)),
+                                 V_ASN1_UNDEF, NULL, pub, key->pubkeylen);
+  if (!ok)
+    OPENSSL_free(pub);
+  ok = ok && (derlen = i2d_X509_PUBKEY(xpk, &der)) > 0
+       && (size_t)derlen == spki->len && !memcmp(der, spki->der, derlen);
+
+  OPENSSL_free(der);
+  X509_PUBKEY_free(xpk);
+  oqsx_key_free(key);
+  return ok;
+}
+
+static int test_spki(size_t idx)
+{
+  unsigned char der[SPKI_MAX + 64];
+  size_t len, taken = 0;
+  int i, r;
+
+  if (spki_compare(spkis[idx].der, spkis[idx].len) != 1) {
+    fprintf(stderr, cRED "  valid SPKI not decoded directly" cNORM "\n");
+    return 0;
+  }
+  if (!spki_reencode(&spkis[idx])) {
+    fprintf(stderr, cRED "  encoded SPKI differs from X509_PUBKEY" cNORM "\n");
+    return 0;
+  }
+  for (i = 0; i < FUZZ_ROUNDS; i++) {
+    len = spki_mutate(&spkis[idx], der);
+    if ((r = spki_compare(der, len)) == 0) {
+      fprintf(stderr, cRED "  results differ for input:" cNORM "\n");
+      hexdump(der, len);
+      return 0;
+    }
+    taken += r > 0;
+  }
+  printf("  %zu of %d variants decoded directly\n", taken, FUZZ_ROUNDS);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+
+  for (i = 0; i < nelem(sigalg_names); i++)
+    if (alg_is_enabled(sigalg_names[i]))
+      T(spki_make(sigalg_names[i], &spkis[i]));
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (spkis[i].len == 0) {
+      printf("Not testing disabled algorithm %s.\n", sigalg_names[i]);
+      continue;
+    }
+    if (test_spki(i)) {
+      fprintf(stderr,
+              cGREEN "  SPKI decoding test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  SPKI decoding test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}